@@ -0,0 +1,554 @@
+/**
+ * batch.c
+ * Purpose: Run many jobs, each a program with an input and an output
+ *          file, on a pool of threads.
+ *
+ * Every distinct program is loaded, decoded and jitted once, and every
+ * worker runs it on a VM of its own that shares all of it but the data,
+ * see vm_share_image(). The jobs are
+ * split into one contiguous range per worker. A worker runs its range
+ * from the front, and once it is empty steals the back half of what
+ * another worker has left, so the jobs stay balanced however long each
+ * one takes. The output of every job is kept in memory and written out by
+ * the main thread in the order of the manifest, as soon as every job
+ * before it has finished.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "headers/batch.h"
+#include "headers/libvm.h"
+#include "headers/enums.h"
+
+struct BATCH_JOB {
+    char       *line;         /* The three fields below, one after the
+                               * other.                                 */
+    const char *program_fn;
+    const char *input_fn;
+    const char *output_fn;
+    int         program;      /* Index into batch_t.programs.           */
+    char       *output;
+    size_t      output_len;
+    size_t      output_cap;
+    status_t    status;
+    double      latency;      /* Seconds from picking the job up to its
+                               * output being complete.                 */
+    int         done;
+};
+
+typedef struct BATCH_JOB batch_job_t;
+
+/* The jobs a worker has not started yet, next up to end. */
+struct BATCH_QUEUE {
+    pthread_mutex_t lock;
+    size_t          next;
+    size_t          end;
+};
+
+typedef struct BATCH_QUEUE batch_queue_t;
+
+struct BATCH {
+    batch_job_t        *jobs;
+    size_t              n_jobs;
+    vm_t              **programs;     /* NULL if it failed to load.     */
+    int                 n_programs;
+    batch_queue_t      *queues;
+    int                 n_threads;
+    const vm_options_t *options;
+    pthread_mutex_t     done_lock;
+    pthread_cond_t      done_cond;
+};
+
+typedef struct BATCH batch_t;
+
+struct BATCH_WORKER {
+    batch_t   *batch;
+    int        id;
+    pthread_t  thread;
+};
+
+typedef struct BATCH_WORKER batch_worker_t;
+
+static double vm_batch_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * The vm_io_t write callback of a job, appending to its output buffer.
+ */
+static void vm_batch_write (void *ctx, const char *buf, size_t len)
+{
+    batch_job_t *job = (batch_job_t *)ctx;
+
+    if (job->output_len + len > job->output_cap) {
+        size_t cap = job->output_cap ? job->output_cap : 4096;
+        char *output = NULL;
+
+        while (cap < job->output_len + len) {
+            cap *= 2;
+        }
+        output = (char *)realloc(job->output, cap);
+        if (output == NULL) {
+            fprintf(stderr, "\nError: Not enough memory for malloc");
+            job->status = FAILURE;
+            return;
+        }
+        job->output = output;
+        job->output_cap = cap;
+    }
+    memcpy(&job->output[job->output_len], buf, len);
+    job->output_len += len;
+}
+
+/**
+ * Read a whole file into a buffer that grows as needed.
+ *
+ * @param[in]     fn
+ * @param[inout]  buf
+ * @param[inout]  cap    The size of buf.
+ * @param[out]    len    The size of the file.
+ *
+ * @return        FAILURE if the file could not be read.
+ */
+static status_t vm_batch_read_file (const char *fn, char **buf, size_t *cap,
+                                    size_t *len)
+{
+    FILE *fp = fopen(fn, "rb");
+    size_t n = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", fn);
+        return FAILURE;
+    }
+    *len = 0;
+    do {
+        if (*len == *cap) {
+            const size_t new_cap = *cap ? *cap * 2 : 4096;
+            char *new_buf = (char *)realloc(*buf, new_cap);
+            if (new_buf == NULL) {
+                fprintf(stderr, "\nError: Not enough memory for malloc");
+                fclose(fp);
+                return FAILURE;
+            }
+            *buf = new_buf;
+            *cap = new_cap;
+        }
+        n = fread(&(*buf)[*len], 1, *cap - *len, fp);
+        *len += n;
+    } while (n > 0);
+    fclose(fp);
+    return SUCCESS;
+}
+
+/**
+ * Pick the next job of a worker, stealing from the others once it has
+ * none left.
+ *
+ * @param[in]   batch
+ * @param[in]   id       The worker.
+ * @param[out]  index    The job.
+ *
+ * @return      0 once every job has been picked.
+ */
+static int vm_batch_next (batch_t *batch, const int id, size_t *index)
+{
+    batch_queue_t *own = &batch->queues[id];
+    int i = 0;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        *index = own->next ++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (i = 1; i < batch->n_threads; i ++) {
+        batch_queue_t *victim = &batch->queues[(id + i) % batch->n_threads];
+        size_t lo = 0,
+               hi = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end) {
+            hi = victim->end;
+            victim->end -= (victim->end - victim->next + 1) / 2;
+            lo = victim->end;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (lo < hi) {
+            pthread_mutex_lock(&own->lock);
+            own->next = lo + 1;
+            own->end = hi;
+            pthread_mutex_unlock(&own->lock);
+            *index = lo;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *vm_batch_worker (void *arg)
+{
+    batch_worker_t *worker = (batch_worker_t *)arg;
+    batch_t *batch = worker->batch;
+    vm_t *vm = NULL;
+    int program = -1;
+    char *input = NULL;
+    size_t input_cap = 0,
+           input_len = 0,
+           index = 0;
+
+    if (vm_create(&vm, batch->options) == FAILURE) {
+        vm = NULL;
+    }
+    while (vm_batch_next(batch, worker->id, &index)) {
+        batch_job_t *job = &batch->jobs[index];
+        const double start = vm_batch_now();
+        vm_io_t io = {NULL, vm_batch_write, job, NULL, 0};
+
+        job->status = FAILURE;
+        if (vm != NULL && batch->programs[job->program] != NULL &&
+            (program == job->program ||
+             vm_share_image(vm, batch->programs[job->program]) == SUCCESS)) {
+            program = job->program;
+            job->status = SUCCESS;
+        } else {
+            program = -1;
+        }
+        if (job->status == SUCCESS && strcmp(job->input_fn, "-") != 0) {
+            job->status = vm_batch_read_file(job->input_fn, &input,
+                                             &input_cap, &input_len);
+            io.input = input;
+            io.input_len = input_len;
+        }
+        if (job->status == SUCCESS && vm_run(vm, &io) == FAILURE) {
+            job->status = FAILURE;
+        }
+        job->latency = vm_batch_now() - start;
+
+        pthread_mutex_lock(&batch->done_lock);
+        job->done = 1;
+        pthread_cond_signal(&batch->done_cond);
+        pthread_mutex_unlock(&batch->done_lock);
+    }
+    vm_destroy(vm);
+    free(input);
+    return NULL;
+}
+
+/**
+ * Read the manifest into batch->jobs and load every distinct program once.
+ *
+ * @return  FAILURE if the manifest could not be read.
+ */
+static status_t vm_batch_parse (batch_t *batch, const char *manifest_fn)
+{
+    FILE *fp = fopen(manifest_fn, "r");
+    char *line = NULL;
+    size_t line_cap = 0,
+           jobs_cap = 0;
+    const char **program_fns = NULL;
+    unsigned line_num = 0;
+    status_t rc = SUCCESS;
+
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", manifest_fn);
+        return FAILURE;
+    }
+    while (rc == SUCCESS && getline(&line, &line_cap, fp) != -1) {
+        batch_job_t *job = NULL;
+        char *save = NULL;
+        const char *program_fn = NULL,
+                   *input_fn = NULL,
+                   *output_fn = NULL;
+        int i = 0;
+
+        line_num ++;
+        program_fn = strtok_r(line, " \t\r\n", &save);
+        if (program_fn == NULL || program_fn[0] == '#') {
+            continue;
+        }
+        if (batch->n_jobs == jobs_cap) {
+            const size_t cap = jobs_cap ? jobs_cap * 2 : 64;
+            batch_job_t *jobs = (batch_job_t *)realloc(batch->jobs,
+                                                       cap * sizeof(*jobs));
+            if (jobs == NULL) {
+                fprintf(stderr, "\nError: Not enough memory for malloc");
+                rc = FAILURE;
+                break;
+            }
+            batch->jobs = jobs;
+            jobs_cap = cap;
+        }
+        job = &batch->jobs[batch->n_jobs];
+        memset(job, 0, sizeof(*job));
+
+        input_fn = strtok_r(NULL, " \t\r\n", &save);
+        output_fn = strtok_r(NULL, " \t\r\n", &save);
+        if (input_fn == NULL || output_fn == NULL ||
+            strtok_r(NULL, " \t\r\n", &save) != NULL) {
+            fprintf(stderr, "\nError: line %u of %s is not"
+                    " <vmc file> <input file> <output file>",
+                    line_num, manifest_fn);
+            rc = FAILURE;
+            break;
+        }
+
+        /* The fields, copied out of the line buffer getline() reuses. */
+        job->line = (char *)malloc(strlen(program_fn) + strlen(input_fn) +
+                                   strlen(output_fn) + 3);
+        if (job->line == NULL) {
+            fprintf(stderr, "\nError: Not enough memory for malloc");
+            rc = FAILURE;
+            break;
+        }
+        job->program_fn = strcpy(job->line, program_fn);
+        job->input_fn = strcpy(job->line + strlen(program_fn) + 1, input_fn);
+        job->output_fn = strcpy((char *)job->input_fn + strlen(input_fn) + 1,
+                                output_fn);
+        batch->n_jobs ++;
+
+        /* Jobs tend to come in runs of the same program. */
+        for (i = batch->n_programs - 1; i >= 0; i --) {
+            if (strcmp(program_fns[i], job->program_fn) == 0) {
+                break;
+            }
+        }
+        if (i < 0) {
+            const char **fns = (const char **)realloc(program_fns,
+                (batch->n_programs + 1) * sizeof(*fns));
+            vm_t **programs = (vm_t **)realloc(batch->programs,
+                (batch->n_programs + 1) * sizeof(*programs));
+            if (fns != NULL) {
+                program_fns = fns;
+            }
+            if (programs != NULL) {
+                batch->programs = programs;
+            }
+            if (fns == NULL || programs == NULL) {
+                fprintf(stderr, "\nError: Not enough memory for malloc");
+                rc = FAILURE;
+                break;
+            }
+            i = batch->n_programs ++;
+            program_fns[i] = job->program_fn;
+            if (vm_create(&programs[i], batch->options) == FAILURE) {
+                programs[i] = NULL;
+            } else if (vm_load_image(programs[i], job->program_fn)
+                       == FAILURE) {
+                vm_destroy(programs[i]);
+                programs[i] = NULL;
+            }
+        }
+        job->program = i;
+    }
+    free(line);
+    free(program_fns);
+    fclose(fp);
+    return rc;
+}
+
+/**
+ * Write the output of a finished job to its output file.
+ *
+ * @return  FAILURE if the file could not be written.
+ */
+static status_t vm_batch_write_output (const batch_job_t *job)
+{
+    FILE *fp = stdout;
+
+    if (strcmp(job->output_fn, "-") != 0) {
+        fp = fopen(job->output_fn, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "\nERROR: could not create output file %s\n",
+                    job->output_fn);
+            return FAILURE;
+        }
+    }
+    if (job->output_len > 0 &&
+        fwrite(job->output, 1, job->output_len, fp) != job->output_len) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n",
+                job->output_fn);
+        if (fp != stdout) {
+            fclose(fp);
+        }
+        return FAILURE;
+    }
+    if (fp != stdout) {
+        return fclose(fp) == 0 ? SUCCESS : FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int vm_batch_compare (const void *a, const void *b)
+{
+    const double x = *(const double *)a,
+                 y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print the throughput and the latency percentiles to stderr.
+ */
+static void vm_batch_print_stats (const batch_t *batch, const double elapsed,
+                                  const size_t n_failed)
+{
+    double *latencies = NULL;
+    const double percentiles[] = {0.5, 0.9, 0.99, 1.0};
+    const char *const names[] = {"p50", "p90", "p99", "max"};
+    size_t i = 0;
+
+    fprintf(stderr, "\n%lu jobs, %lu failed, %d threads, %.3f s,"
+            " %.1f jobs/s\n", (unsigned long)batch->n_jobs,
+            (unsigned long)n_failed, batch->n_threads, elapsed,
+            elapsed > 0 ? batch->n_jobs / elapsed : 0.0);
+
+    latencies = (double *)malloc(batch->n_jobs * sizeof(double));
+    if (batch->n_jobs == 0 || latencies == NULL) {
+        free(latencies);
+        return;
+    }
+    for (i = 0; i < batch->n_jobs; i ++) {
+        latencies[i] = batch->jobs[i].latency;
+    }
+    qsort(latencies, batch->n_jobs, sizeof(double), vm_batch_compare);
+
+    fprintf(stderr, "latency (ms):");
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i ++) {
+        /* Nearest rank. */
+        size_t rank = (size_t)(percentiles[i] * batch->n_jobs + 0.999999);
+        rank = rank ? rank - 1 : 0;
+        fprintf(stderr, " %s %.3f", names[i], latencies[rank] * 1000);
+    }
+    fputc('\n', stderr);
+    free(latencies);
+}
+
+/**
+ * Run every job in a manifest, see batch.h.
+ *
+ * @param  manifest_fn
+ * @param  options         How to run every program.
+ * @param  n_threads       0 for one per core.
+ *
+ * @return                 FAILURE if any job failed.
+ */
+status_t vm_run_batch (const char *manifest_fn, const vm_options_t *options,
+                       int n_threads)
+{
+    batch_t batch;
+    batch_worker_t *workers = NULL;
+    size_t n_failed = 0,
+           i = 0;
+    double start = 0;
+    int t = 0,
+        n_started = 0;
+    status_t rc = SUCCESS;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.options = options;
+    if (vm_batch_parse(&batch, manifest_fn) == FAILURE) {
+        rc = FAILURE;
+        goto done;
+    }
+
+    if (n_threads <= 0) {
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if ((size_t)n_threads > batch.n_jobs) {
+        n_threads = (int)batch.n_jobs;
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    batch.n_threads = n_threads;
+    batch.queues = (batch_queue_t *)calloc(n_threads, sizeof(batch_queue_t));
+    workers = (batch_worker_t *)calloc(n_threads, sizeof(batch_worker_t));
+    if (batch.queues == NULL || workers == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        rc = FAILURE;
+        goto done;
+    }
+    for (t = 0; t < n_threads; t ++) {
+        pthread_mutex_init(&batch.queues[t].lock, NULL);
+        batch.queues[t].next = batch.n_jobs * t / n_threads;
+        batch.queues[t].end = batch.n_jobs * (t + 1) / n_threads;
+    }
+    pthread_mutex_init(&batch.done_lock, NULL);
+    pthread_cond_init(&batch.done_cond, NULL);
+
+    start = vm_batch_now();
+    for (t = 0; t < n_threads; t ++) {
+        workers[t].batch = &batch;
+        workers[t].id = t;
+        if (pthread_create(&workers[t].thread, NULL, vm_batch_worker,
+                           &workers[t]) != 0) {
+            break;
+        }
+        n_started ++;
+    }
+    if (n_started == 0) {
+        /* Run everything on this thread instead. */
+        vm_batch_worker(&workers[0]);
+    }
+
+    for (i = 0; i < batch.n_jobs; i ++) {
+        batch_job_t *job = &batch.jobs[i];
+
+        pthread_mutex_lock(&batch.done_lock);
+        while (!job->done) {
+            pthread_cond_wait(&batch.done_cond, &batch.done_lock);
+        }
+        pthread_mutex_unlock(&batch.done_lock);
+
+        if (vm_batch_write_output(job) == FAILURE) {
+            job->status = FAILURE;
+        }
+        if (job->status == FAILURE) {
+            n_failed ++;
+        }
+        free(job->output);
+        job->output = NULL;
+    }
+    fflush(stdout);
+
+    for (t = 0; t < n_started; t ++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    vm_batch_print_stats(&batch, vm_batch_now() - start, n_failed);
+    for (t = 0; t < n_threads; t ++) {
+        pthread_mutex_destroy(&batch.queues[t].lock);
+    }
+    pthread_mutex_destroy(&batch.done_lock);
+    pthread_cond_destroy(&batch.done_cond);
+    if (n_failed > 0) {
+        rc = FAILURE;
+    }
+
+done:
+    for (i = 0; i < batch.n_jobs; i ++) {
+        free(batch.jobs[i].line);
+        free(batch.jobs[i].output);
+    }
+    for (t = 0; t < batch.n_programs; t ++) {
+        vm_destroy(batch.programs[t]);
+    }
+    free(batch.jobs);
+    free(batch.programs);
+    free(batch.queues);
+    free(workers);
+    return rc;
+}
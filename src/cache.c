@@ -0,0 +1,352 @@
+/**
+ * cache.c
+ * Purpose: The compilation cache of compiler --cache.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "headers/cache.h"
+#include "headers/vmc.h"
+
+#define VM_CACHE_COPY_LEN  65536
+
+/**
+ * FNV-1a hash of len bytes, continuing from hash.
+ */
+static uint64_t vm_cache_hash (uint64_t hash, const char *bytes,
+                               const size_t len)
+{
+    size_t i = 0;
+
+    for (i = 0; i < len; i ++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * The key of a source in the cache. Sources that differ in length never
+ * share a key, and the hash covers everything that changes the image
+ * compiled from the source.
+ *
+ * @param[out]  key       VM_CACHE_KEY_LEN bytes, gets the key.
+ * @param[in]   text      The source.
+ * @param[in]   len       The length of text.
+ * @param[in]   optimize  Whether it is compiled with -O1.
+ */
+void vm_cache_key (char *key, const char *text, const size_t len,
+                   const int optimize)
+{
+    char salt[64];
+    uint64_t hash = 14695981039346656037ull;
+
+    assert(key != NULL);
+    assert(text != NULL || len == 0);
+
+    snprintf(salt, sizeof(salt), "compiler %d vmc %d O%d\n",
+             VM_COMPILER_VERSION, VMC_VERSION, optimize);
+    hash = vm_cache_hash(hash, salt, strlen(salt));
+    hash = vm_cache_hash(hash, text, len);
+    snprintf(key, VM_CACHE_KEY_LEN, "%016llx-%llx", (unsigned long long)hash,
+             (unsigned long long)len);
+}
+
+/**
+ * The path of a file in the cache.
+ *
+ * @return  dir/name followed by suffix, or just name and suffix if dir
+ *          is NULL, to be freed, NULL if out of memory.
+ */
+static char *vm_cache_path (const char *dir, const char *name,
+                            const char *suffix)
+{
+    const size_t len = (dir ? strlen(dir) : 0) + strlen(name) +
+                       strlen(suffix) + 2;
+    char *path = (char *)malloc(len);
+
+    if (path == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return NULL;
+    }
+    if (dir != NULL) {
+        snprintf(path, len, "%s/%s%s", dir, name, suffix);
+    } else {
+        snprintf(path, len, "%s%s", name, suffix);
+    }
+    return path;
+}
+
+/**
+ * Copy a file through a temporary file renamed to the copy, so that
+ * nobody reading the copy ever sees part of it.
+ *
+ * @param  from
+ * @param  to
+ *
+ * @return  FAILURE if from cannot be opened, silently, or if the copy
+ *          cannot be written.
+ */
+static status_t vm_cache_copy (const char *from, const char *to)
+{
+    char buf[VM_CACHE_COPY_LEN];
+    char *tmp_fn = NULL;
+    FILE *in = NULL,
+         *out = NULL;
+    size_t n = 0;
+    int ok = 1;
+
+    in = fopen(from, "rb");
+    if (in == NULL) {
+        return FAILURE;
+    }
+    tmp_fn = (char *)malloc(strlen(to) + 32);
+    if (tmp_fn == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        fclose(in);
+        return FAILURE;
+    }
+    /* Unique to this process, as other compilers may copy to the same
+     * entry at once. */
+    sprintf(tmp_fn, "%s.tmp.%ld", to, (long)getpid());
+    out = fopen(tmp_fn, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "\nERROR: could not create output file %s\n", to);
+        fclose(in);
+        free(tmp_fn);
+        return FAILURE;
+    }
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ok = fwrite(buf, 1, n, out) == n;
+    }
+    ok = !ferror(in) && ok;
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_fn, to) != 0) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n", to);
+        remove(tmp_fn);
+        free(tmp_fn);
+        return FAILURE;
+    }
+    free(tmp_fn);
+    return SUCCESS;
+}
+
+/**
+ * Copy the cached image of a key to a .vmc file, and its labels to the
+ * .sym file if debug_info is set.
+ *
+ * @param  dir         The cache.
+ * @param  key         From vm_cache_key().
+ * @param  vmc_fn      The .vmc file to write.
+ * @param  debug_info  Whether the .sym file is wanted too.
+ *
+ * @return             1 on a hit, 0 if the entry is not in the cache or
+ *                     could not be copied.
+ */
+int vm_cache_fetch (const char *dir, const char *key, const char *vmc_fn,
+                    const int debug_info)
+{
+    char *entry = NULL,
+         *sym_fn = NULL;
+    int hit = 0;
+
+    assert(dir != NULL);
+    assert(key != NULL);
+    assert(vmc_fn != NULL);
+
+    entry = vm_cache_path(dir, key, debug_info ? ".vmc.sym" : ".vmc");
+    if (entry == NULL) {
+        return 0;
+    }
+    if (debug_info) {
+        sym_fn = vm_cache_path(NULL, vmc_fn, ".sym");
+        hit = sym_fn != NULL && vm_cache_copy(entry, sym_fn) == SUCCESS;
+        free(sym_fn);
+        free(entry);
+        entry = hit ? vm_cache_path(dir, key, ".vmc") : NULL;
+        if (entry == NULL) {
+            return 0;
+        }
+    }
+    hit = vm_cache_copy(entry, vmc_fn) == SUCCESS;
+    free(entry);
+    return hit;
+}
+
+/**
+ * Store a freshly compiled .vmc file, and its .sym file if debug_info is
+ * set, as the entry of a key. Creates the cache if it does not exist.
+ *
+ * @param  dir         The cache.
+ * @param  key         From vm_cache_key().
+ * @param  vmc_fn      The .vmc file written by the compiler.
+ * @param  debug_info  Whether there is a .sym file to store too.
+ *
+ * @return             The error status.
+ */
+status_t vm_cache_store (const char *dir, const char *key, const char *vmc_fn,
+                         const int debug_info)
+{
+    char *entry = NULL,
+         *sym_fn = NULL;
+    status_t rc = FAILURE;
+
+    assert(dir != NULL);
+    assert(key != NULL);
+    assert(vmc_fn != NULL);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "\nERROR: could not create cache %s\n", dir);
+        return FAILURE;
+    }
+    if (debug_info) {
+        entry = vm_cache_path(dir, key, ".vmc.sym");
+        sym_fn = vm_cache_path(NULL, vmc_fn, ".sym");
+        rc = entry != NULL && sym_fn != NULL &&
+             vm_cache_copy(sym_fn, entry) == SUCCESS ? SUCCESS : FAILURE;
+        free(entry);
+        free(sym_fn);
+        if (rc == FAILURE) {
+            return FAILURE;
+        }
+    }
+    entry = vm_cache_path(dir, key, ".vmc");
+    rc = entry != NULL && vm_cache_copy(vmc_fn, entry) == SUCCESS ?
+         SUCCESS : FAILURE;
+    free(entry);
+    return rc;
+}
+
+/**
+ * Read the counts of a stats file.
+ */
+static void vm_cache_read_stats (FILE *fp, unsigned long long *hits,
+                                 unsigned long long *misses)
+{
+    *hits = 0;
+    *misses = 0;
+    if (fscanf(fp, "hits %llu misses %llu", hits, misses) != 2) {
+        *hits = 0;
+        *misses = 0;
+    }
+}
+
+/**
+ * Count a hit or a miss in the stats file of a cache. The file is locked
+ * while it is updated, so concurrent compilers lose no counts. Counting
+ * is best effort: a cache whose stats cannot be written still works.
+ *
+ * @param  dir
+ * @param  hit  1 for a hit, 0 for a miss.
+ */
+void vm_cache_count (const char *dir, const int hit)
+{
+    char *stats_fn = NULL;
+    unsigned long long hits = 0,
+                       misses = 0;
+    FILE *fp = NULL;
+    int fd = -1;
+
+    assert(dir != NULL);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        return;
+    }
+    stats_fn = vm_cache_path(dir, "stats", "");
+    if (stats_fn == NULL) {
+        return;
+    }
+    fd = open(stats_fn, O_RDWR | O_CREAT, 0666);
+    free(stats_fn);
+    if (fd < 0) {
+        return;
+    }
+    fp = fdopen(fd, "r+");
+    if (fp == NULL) {
+        close(fd);
+        return;
+    }
+    if (flock(fd, LOCK_EX) == 0) {
+        vm_cache_read_stats(fp, &hits, &misses);
+        if (hit) {
+            hits ++;
+        } else {
+            misses ++;
+        }
+        rewind(fp);
+        fprintf(fp, "hits %llu misses %llu\n", hits, misses);
+        fflush(fp);
+    }
+    fclose(fp);     /* Unlocks it. */
+}
+
+/**
+ * Print the hits and misses of a cache and the number and size of its
+ * entries to stdout.
+ *
+ * @param  dir
+ *
+ * @return  FAILURE if dir cannot be read.
+ */
+status_t vm_cache_print_stats (const char *dir)
+{
+    char *stats_fn = NULL;
+    unsigned long long hits = 0,
+                       misses = 0,
+                       bytes = 0;
+    unsigned long entries = 0;
+    struct dirent *ent = NULL;
+    struct stat st;
+    DIR *dp = NULL;
+    FILE *fp = NULL;
+
+    assert(dir != NULL);
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        fprintf(stderr, "\nERROR: could not open cache %s\n", dir);
+        return FAILURE;
+    }
+    while ((ent = readdir(dp)) != NULL) {
+        const size_t len = strlen(ent->d_name);
+        char *path = NULL;
+
+        if (len < 4 || strcmp(ent->d_name + len - 4, ".vmc") != 0) {
+            continue;
+        }
+        path = vm_cache_path(dir, ent->d_name, "");
+        if (path != NULL && stat(path, &st) == 0) {
+            entries ++;
+            bytes += st.st_size;
+        }
+        free(path);
+    }
+    closedir(dp);
+
+    stats_fn = vm_cache_path(dir, "stats", "");
+    fp = stats_fn != NULL ? fopen(stats_fn, "r") : NULL;
+    if (fp != NULL) {
+        flock(fileno(fp), LOCK_SH);
+        vm_cache_read_stats(fp, &hits, &misses);
+        fclose(fp);
+    }
+    free(stats_fn);
+
+    printf("Cache %s: %llu hits, %llu misses, %.1f%% hit rate, %lu entries,"
+           " %llu bytes\n", dir, hits, misses,
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0, entries,
+           bytes);
+    return SUCCESS;
+}
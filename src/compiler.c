@@ -9,129 +9,101 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <time.h>
 
+#include "headers/cache.h"
 #include "headers/constants.h"
 #include "headers/enums.h"
 #include "headers/lexer.h"
+#include "headers/optimize.h"
+#include "headers/symtab.h"
+#include "headers/vmc.h"
 
-typedef struct LABEL_T {
-    char label[LABEL_LEN];
-    bytecode_t line_num;
-    bytecode_t pc;
-    bytecode_t id;
-} label_t;
+/* Offsets of the PUSH &label instructions, compiled to IND and the
+ * label id until every label is known. */
+struct FIXUP_LIST {
+    uint32_t *offsets;
+    int       len;
+    int       capacity;
+};
+
+typedef struct FIXUP_LIST fixup_list_t;
 
 /**
- * Search for a label_t struct in label_table of length len given a string key.
- *
- * @param  key         The label string to be searched for.
- * @param  label_table Array of labels in the code.
- * @param  len         Length of the label_table.
+ * Remember the offset of an IND to patch once its label is defined.
  *
- * @return             The label struct if found else NULL.
+ * @return  The error status.
  */
-const label_t* vm_search_label_table (const char *key, 
-                                      const label_t *label_table, const int len) 
+static status_t vm_add_fixup (fixup_list_t *fixups, const uint32_t offset)
 {
-    int i = 0;
-    const label_t *this_label = NULL;
-
-    assert(key != NULL);
-    assert(label_table != NULL);
-
-    for (i = 0; i < len; i ++) {
-        this_label = &label_table[i];
-        if (strcmp(key, this_label->label) == 0) {
-            return this_label;
+    if (fixups->len == fixups->capacity) {
+        const int capacity = fixups->capacity ? 2 * fixups->capacity : 256;
+        uint32_t *grown = (uint32_t *)realloc(fixups->offsets,
+                                              capacity * sizeof(uint32_t));
+        if (grown == NULL) {
+            fprintf(stderr, "\nError: Not enough memory for malloc");
+            return FAILURE;
         }
+        fixups->offsets = grown;
+        fixups->capacity = capacity;
     }
-    return NULL;
+    fixups->offsets[fixups->len++] = offset;
+    return SUCCESS;
 }
 
 /**
- * Perform a one pass through the token list and build label table.
- *
- * @param[out] label_table  The table to be populated from file.
- * @param[out] len          The length of the table after being populated.
- * @param[in]  tok_list        
+ * Define the label of a ':' token.
  *
- * @return                  Returns a status_t.
+ * @return  The label, NULL if it has no name or is already defined.
  */
-status_t vm_build_label_table (label_t *label_table, int *len, 
-                               const token_t *tok_list)
+static label_t *vm_define_label (symtab_t *tab, const vm_source_t *src,
+                                 const token_t *tok)
 {
-    assert(label_table != NULL);
-    assert(len != NULL);
-    assert(tok_list != NULL);
-
-    const char *token = NULL;
-    int line_num = 0;
-
-    bytecode_t label_count = 0;
-
-    *len = 0;
-
-    while (tok_list != NULL) {
-
-        token = tok_list->token;
-        line_num = tok_list->line_num;
-
-        if (token[0] == ':') {
-            token++; /* forget the ':' */
-            if (strlen(token) == 0) {
-                fprintf(stderr, 
-                        "\nERROR: unnamed label in line number %d\n", 
-                        line_num);
-                return FAILURE;
-            }
+    label_t *label = NULL;
 
-            label_t *this_lbl = &label_table[label_count];
-            const label_t *found_label = vm_search_label_table(token, 
-                                                               label_table, 
-                                                               label_count);
-            if (found_label != NULL) {
-                fprintf(stderr, 
-                        "\nERROR: Label redefined in line number %d, "
-                        "earlier definition was here %d\n", 
-                        line_num, found_label->line_num);
-                return FAILURE;
-            }
-            memset(this_lbl->label, 0, LABEL_LEN);
-            strncpy(this_lbl->label, token, LABEL_LEN);
-            this_lbl->line_num = line_num;
-            this_lbl->id = label_count;
-            label_count++;
-        }
-        tok_list = tok_list->next_tk;
-    } 
-    *len = label_count;
-    return SUCCESS;
+    if (tok->len == 1) {
+        fprintf(stderr, 
+                "\nERROR: unnamed label in line number %d\n", 
+                tok->line_num);
+        return NULL;
+    }
+    /* forget the ':' */
+    if (vm_symtab_define(tab, vm_token_text(src, tok) + 1, tok->len - 1,
+                         tok->line_num, &label) == FAILURE) {
+        return NULL;
+    }
+    return label;
 }
 
 /**
- * Get the argument given to push. Assumes token is valid.
+ * Get the argument given to push.
  *
  * @param[out]  arg        The integer argument to push.
- * @param[in]   token      The valid token from which to parse.
+ * @param[in]   token      The token from which to parse, need not be NUL
+ *                         terminated.
+ * @param[in]   len        The length of the token.
  *
  * @return                 The error status.
  */
-status_t vm_get_coded_arg (int *arg, const char *token) {
+status_t vm_get_coded_arg (int *arg, const char *token, const size_t len) {
 
     assert(arg != NULL);
     assert(token != NULL);
 
+    char scan_token[MAX_LINE_LEN];
     int rc = 0;
 
-    const int len = strlen(token);
+    if (len == 0 || len >= MAX_LINE_LEN) {
+        return FAILURE;
+    }
+    memcpy(scan_token, token, len);
+    scan_token[len] = '\0';
     if (token[0] == '\'') {
         if (len != 3 || token[2] != '\'') {
             return FAILURE;
         } 
         *arg = (int)token[1];
     } else if (token[len - 1] == 'h') {
-        char scan_token[MAX_LINE_LEN];
-        strncpy(scan_token, token, len);
         scan_token[len - 1] = '\0';
         rc = sscanf(scan_token, "%x", arg);
         if (rc != 1) {
@@ -141,7 +113,7 @@ status_t vm_get_coded_arg (int *arg, const char *token) {
             return FAILURE;
         }
     } else {
-        rc = sscanf(token, "%d", arg);
+        rc = sscanf(scan_token, "%d", arg);
         if (rc != 1) {
             fprintf(stderr, 
                     "\nError: Unable to read decimal value given"
@@ -153,178 +125,293 @@ status_t vm_get_coded_arg (int *arg, const char *token) {
 }
 
 /**
- * Performs a one pass through the file and compiles to bytecode, but does not 
- * resolve labels and labelled jumps to GOTO's. Labels and jumps are only 
- * compiled to intermediate code. They will be replaced for proper bytecode
- * in a different pass of compilation. Label table should be built before 
- * calling this function.
+ * Make room for n more bytes at the end of a growing code buffer.
  *
- * @param[out] compiled_code   The compiled bytecode array.
+ * @param[in,out]  compiled_code   The buffer, reallocated when full.
+ * @param[in,out]  capacity        Its size.
+ * @param[in]      len             The number of bytes in use.
+ * @param[in]      n
+ *
+ * @return                         The error status.
+ */
+static status_t vm_reserve_code (bytecode_t **compiled_code, size_t *capacity,
+                                 const size_t len, const size_t n)
+{
+    bytecode_t *grown = NULL;
+    size_t new_capacity = *capacity ? *capacity : 256;
+
+    if (len + n <= *capacity) {
+        return SUCCESS;
+    }
+    while (new_capacity < len + n) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > VMC_MAX_LEN) {
+        fprintf(stderr, "\nError: Program is larger than %u bytes",
+                VMC_MAX_LEN);
+        return FAILURE;
+    }
+    grown = (bytecode_t *)realloc(*compiled_code, new_capacity);
+    if (grown == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    *compiled_code = grown;
+    *capacity = new_capacity;
+    return SUCCESS;
+}
+
+/**
+ * Compile a source in one pass, as its tokens are read. The data segment,
+ * the numbers before __CODE__, is compiled to little endian words of its
+ * own and labels in it take no space. Labels in the code compile to a
+ * NOP. Every label is defined in the label table with its offset in its
+ * segment. A PUSH &label compiles to IND and the label id, which may not
+ * be defined yet, and its offset goes on the fixup list. Every label
+ * named must be defined by the end of the source.
+ *
+ * @param[out] data            The compiled data segment, to be freed.
+ * @param[out] data_len        The number of bytes in the data array.
+ * @param[out] compiled_code   The compiled code segment, to be freed.
  * @param[out] len             The number of bytes in the compiled_code array.
- * @param[out] code_start      The offset at which the code segment starts.
- * @param[in]  fp              The source file.
- * @param[in]  label_table     
- * @param[in]  lt_len          The length of the label table.
+ * @param[in]  src             The source file, read to its end.
+ * @param[out] tab             Gets every label, free with vm_symtab_free().
+ * @param[out] fixups          Gets the offset of every IND, to be freed.
  *
  * @return                     Returns a status_t.
  */
-status_t vm_compile_first_pass (bytecode_t *compiled_code, int *len, 
-                                int *code_start, token_t *tok_list, 
-                                const label_t *label_table, const int lt_len)
+status_t vm_compile (bytecode_t **data, int *data_len,
+                     bytecode_t **compiled_code, int *len, 
+                     vm_source_t *src, symtab_t *tab, fixup_list_t *fixups)
 {
+    assert(data          != NULL);
+    assert(data_len      != NULL);
     assert(compiled_code != NULL);
     assert(len           != NULL);
-    assert(tok_list      != NULL);
-    assert(code_start    != NULL);
+    assert(src           != NULL);
+    assert(tab           != NULL);
+    assert(fixups        != NULL);
 
+    token_t tok;
     const char *token = NULL;
-    const char delim[] = " \n";
 
-    bytecode_t pc = 0;
+    bytecode_t *code = NULL,
+               *words = NULL;
+    size_t pc = 0,
+           capacity = 0,
+           n_bytes = 0,
+           words_capacity = 0;
     unsigned int line_num = 0;
+    label_t *label = NULL;
+    int i = 0;
 
     bool_flag_t  code_flag    = FALSE;
 
-    tok_list = tok_list->next_tk; /* Ignore the dummy token */
+    *data = NULL;
+    *compiled_code = NULL;
+    fixups->offsets = NULL;
+    fixups->len = 0;
+    fixups->capacity = 0;
+    if (vm_symtab_init(tab) == FAILURE) {
+        return FAILURE;
+    }
 
-    while (tok_list && !code_flag) {
-        line_num = tok_list->line_num;
-        token = tok_list->token;
+    while (!code_flag && vm_next_token(src, &tok)) {
+        line_num = tok.line_num;
+        token = vm_token_text(src, &tok);
         if (token[0] == ':') {
-            /* 
-             * The following will be replaced by NOP once the labels are 
-             * resolved.
-             */
-            compiled_code[pc++] = INST_SET[LAB].bytecode;
-        } else if (strcmp(token, "__CODE__") == 0) {
+            label = vm_define_label(tab, src, &tok);
+            if (label == NULL) {
+                free(words);
+                return FAILURE;
+            }
+            label->pc = n_bytes;
+        } else if (vm_token_is(src, &tok, "__CODE__")) {
             code_flag = TRUE;
         } else {
             int arg = 0;
-            if (vm_get_coded_arg(&arg, token) == FAILURE) {
+            if (vm_get_coded_arg(&arg, token, tok.len) == FAILURE) {
                 fprintf(stderr, 
                         "\nError: Syntax error in push argument in "
                         "line number %d.", line_num);
+                free(words);
                 return FAILURE;
             }
-            vm_put_integer_to_bytecode(&compiled_code[pc], arg);
-            pc += 4;
+            if (vm_reserve_code(&words, &words_capacity, n_bytes,
+                                4) == FAILURE) {
+                free(words);
+                return FAILURE;
+            }
+            vm_put_integer_to_bytecode(&words[n_bytes], arg);
+            n_bytes += 4;
         }
-        tok_list = tok_list->next_tk;
     }
 
     if (!code_flag) {
         fprintf(stderr, "\nError: Code segment not declared!");
+        free(words);
         return FAILURE;
     }
-    *code_start = pc;
 
-    while (tok_list) {
-        line_num = tok_list->line_num;
-        token = tok_list->token;
+    while (vm_next_token(src, &tok)) {
+        bytecode_t bc = 0;
+
+        line_num = tok.line_num;
+        token = vm_token_text(src, &tok);
+        if (vm_reserve_code(&code, &capacity, pc, INST_LEN) == FAILURE) {
+            free(code);
+            free(words);
+            return FAILURE;
+        }
         if (token[0] == ':') {
-            /* 
-             * The following will be replaced by NOP once the labels are 
-             * resolved.
-             */
-            compiled_code[pc++] = INST_SET[LAB].bytecode;
-        } else if (strcmp(token, "PUSH") == 0) {
+            label = vm_define_label(tab, src, &tok);
+            if (label == NULL) {
+                free(code);
+                free(words);
+                return FAILURE;
+            }
+            code[pc++] = INST_SET[NOP].bytecode;
+            label->in_code = 1;
+            label->pc = pc;
+            continue;
+        }
+        bc = get_bytecode_n(token, tok.len);
+        if (bc == INST_SET[PUSH].bytecode) {
             int arg = 0;
-            tok_list = tok_list->next_tk;
-            line_num = tok_list->line_num;
-            token = tok_list->token;
+            if (!vm_next_token(src, &tok)) {
+                fprintf(stderr, "\nError: PUSH without an argument in "
+                        "line number %d.", line_num);
+                free(code);
+                free(words);
+                return FAILURE;
+            }
+            line_num = tok.line_num;
+            token = vm_token_text(src, &tok);
 
             if (token[0] == '&') {
-                token++;
-                const label_t *found_label = vm_search_label_table(token, 
-                                                                   label_table,
-                                                                   lt_len);
-                if (found_label == NULL) {
-                    fprintf(stderr, "\nError: Label given to PUSH not declared "
-                            " in line number %d", line_num);
+                if (vm_symtab_reference(tab, token + 1, tok.len - 1, line_num,
+                                        &label) == FAILURE ||
+                    vm_add_fixup(fixups, pc) == FAILURE) {
+                    free(code);
+                    free(words);
                     return FAILURE;
                 }
-                compiled_code[pc] = INST_SET[IND].bytecode;
-                arg = found_label->id;
-            } else if (vm_get_coded_arg(&arg, token) == FAILURE) {
+                code[pc] = INST_SET[IND].bytecode;
+                arg = label->id;
+            } else if (vm_get_coded_arg(&arg, token, tok.len) == FAILURE) {
                 fprintf(stderr, 
                         "\nError: Syntax error in push argument in "
                         "line number %d.", line_num);
+                free(code);
+                free(words);
                 return FAILURE;
             } else {
-                compiled_code[pc] = INST_SET[PUSH].bytecode;
+                code[pc] = INST_SET[PUSH].bytecode;
             }
             pc++;
-            vm_put_integer_to_bytecode(&compiled_code[pc], arg);
+            vm_put_integer_to_bytecode(&code[pc], arg);
             pc += 4;
+        } else if (bc == INST_SET[ERR].bytecode) {
+            fprintf(stderr, "\nERROR: unrecognized instruction %.*s in"
+                    " line number %d\n", (int)tok.len, token, line_num);
+            free(code);
+            free(words);
+            return FAILURE;
         } else {
-            bytecode_t bc = get_bytecode(token);
-            if (bc == INST_SET[ERR].bytecode) {
-                fprintf(stderr, "\nERROR: unrecognized instruction %s in"
-                        " line number %d\n", token, line_num);
-                return FAILURE;
-            }
-            compiled_code[pc++] = bc;
+            code[pc++] = bc;
+        }
+    }
+
+    for (i = 0; i < tab->len; i ++) {
+        if (tab->labels[i].line_num == 0) {
+            fprintf(stderr, "\nError: Label %s given to PUSH not"
+                    " declared in line number %d", tab->labels[i].label,
+                    tab->labels[i].ref_line);
+            free(code);
+            free(words);
+            return FAILURE;
         }
-        tok_list = tok_list->next_tk;
     }
 
-    compiled_code[pc++] = INST_SET[END].bytecode; /* This is required when there
-                                                   * is label at the very end
-                                                   * because the pc will go to
-                                                   * the instruction after that
-                                                   * label.
-                                                   */
+    if (vm_reserve_code(&code, &capacity, pc, 1) == FAILURE) {
+        free(code);
+        free(words);
+        return FAILURE;
+    }
+    code[pc++] = INST_SET[END].bytecode; /* This is required when there
+                                          * is label at the very end
+                                          * because the pc will go to
+                                          * the instruction after that
+                                          * label.
+                                          */
+    *data = words;
+    *data_len = n_bytes;
+    *compiled_code = code;
     *len = pc;
     return SUCCESS;
 }
 
 /**
- * A second pass of compilation, replace LAB with a NOP, 
- * replace IND and label id with PUSH <pc> GOTO.
+ * Replace the IND and label id at every offset on the fixup list with
+ * PUSH <pc>, once all labels are defined.
+ *
+ * @param  compiled_code      Compiled code from vm_compile().
+ * @param  fixups             The offsets of its INDs.
+ * @param  label_table
+ */
+void vm_apply_fixups (bytecode_t *compiled_code, const fixup_list_t *fixups,
+                      const label_t *label_table)
+{
+    int label_id = 0;
+    int i = 0;
+
+    assert(compiled_code != NULL);
+    assert(fixups != NULL);
+
+    for (i = 0; i < fixups->len; i ++) {
+        bytecode_t *at = &compiled_code[fixups->offsets[i]];
+
+        assert(*at == INST_SET[IND].bytecode);
+        *at = INST_SET[PUSH].bytecode;
+        vm_get_integer_from_bytecode(at + 1, &label_id);
+        vm_put_integer_to_bytecode(at + 1, label_table[label_id].pc);
+    }
+}
+
+/**
+ * A second pass of compilation, replace IND and label id with PUSH <pc>.
+ * Only needed after vm_optimize(), which moves the INDs, otherwise
+ * vm_apply_fixups() patches them without a scan.
  *
  * @param  compiled_code      Compiled code from first pass.
  * @param  len                Length of the compiled code.
- * @param  code_start         The offset where the code starts.
  * @param  label_table
  * @param  lt_len             Length of label_table.
  * 
  * @return                    Returns a status_t.
  */
 status_t vm_compile_second_pass (bytecode_t *compiled_code, const int code_len,
-                                 const int code_start,
-                                 label_t *label_table, const int lt_len)
+                                 const label_t *label_table, const int lt_len)
 {
     int i = 0;
-    int label_count = 0;
+    int label_id = 0;
 
     assert(compiled_code != NULL);
-    assert(label_table != NULL);
+    assert(label_table != NULL || lt_len == 0);
 
     for (i = 0; i < code_len; i++) {
-        if (compiled_code[i] == INST_SET[PUSH].bytecode) {
-            i += 4; /* Skip the argument to PUSH. */
-        }
-        else if (compiled_code[i] == INST_SET[LAB].bytecode) {
-            compiled_code[i] = INST_SET[NOP].bytecode;
-
-            assert(label_count < lt_len);
-            label_table[label_count].pc = (bytecode_t)(i + 1);
-            label_count++;
-            i++;
-        } 
-    }
-
-    for (i = code_start; i < code_len; i++) {
         if (compiled_code[i] == INST_SET[PUSH].bytecode) {
             i += 4; /* Skip the argument to PUSH. */
         }
         else if (compiled_code[i] == INST_SET[IND].bytecode) {
             compiled_code[i++] = INST_SET[PUSH].bytecode;
-            assert(i < code_len);
-            assert(compiled_code[i] < lt_len);
-            compiled_code[i] = label_table[compiled_code[i]].pc;
-            i += 3;  /* +3 because stack elem is 4 byts and in above
-                      * line we have already added 1 byte of pc, 
+            assert(i + 4 <= code_len);
+            vm_get_integer_from_bytecode(&compiled_code[i], &label_id);
+            assert(label_id >= 0 && label_id < lt_len);
+            vm_put_integer_to_bytecode(&compiled_code[i],
+                                       label_table[label_id].pc);
+            i += 3;  /* +3 because stack elem is 4 byts and the loop
+                      * adds the last one.
                       */ 
         }
     }
@@ -332,71 +419,246 @@ status_t vm_compile_second_pass (bytecode_t *compiled_code, const int code_len,
     return SUCCESS;
 }
 
-int main (int argc, char *argv[]) 
+/**
+ * Order labels by where they are defined, as the symbol file lists them.
+ */
+static int vm_cmp_label_lines (const void *a, const void *b)
 {
-    if (argc != 2 && argc != 3) {
-        fprintf(stderr, "\nUSAGE: interpreter <vm file>\n");
-        exit(EXIT_FAILURE);
+    const label_t *la = *(const label_t * const *)a,
+                  *lb = *(const label_t * const *)b;
+
+    if (la->line_num != lb->line_num) {
+        return la->line_num < lb->line_num ? -1 : 1;
     }
+    return la->id - lb->id;
+}
+
+/**
+ * Write the label table to the symbol file of a .vmc file, fn.sym, in
+ * the order the labels are defined.
+ *
+ * @param  vmc_fn             The .vmc file.
+ * @param  label_table
+ * @param  lt_len             Length of label_table.
+ *
+ * @return                    Returns a status_t.
+ */
+status_t vm_write_label_table (const char *vmc_fn, const label_t *label_table,
+                               const int lt_len)
+{
+    vmc_symbol_t *symbols = NULL;
+    const label_t **order = NULL;
+    char *sym_fn = NULL;
+    status_t rc = FAILURE;
+    int i = 0;
 
-    FILE *fp = fopen(argv[1], "r");
+    assert(vmc_fn != NULL);
+    assert(label_table != NULL || lt_len == 0);
 
-    if (fp == NULL) {
-        fprintf(stderr, "\nERROR: could not open file %s\n", argv[1]);
+    symbols = (vmc_symbol_t *)malloc((lt_len + 1) * sizeof(vmc_symbol_t));
+    order = (const label_t **)malloc((lt_len + 1) * sizeof(label_t *));
+    sym_fn = (char *)malloc(strlen(vmc_fn) + 5);
+    if (symbols != NULL && order != NULL && sym_fn != NULL) {
+        for (i = 0; i < lt_len; i ++) {
+            order[i] = &label_table[i];
+        }
+        qsort(order, lt_len, sizeof(label_t *), vm_cmp_label_lines);
+        for (i = 0; i < lt_len; i ++) {
+            symbols[i].name = order[i]->label;
+            symbols[i].offset = order[i]->pc;
+            symbols[i].in_code = order[i]->in_code;
+        }
+        strcpy(sym_fn, vmc_fn);
+        strcat(sym_fn, ".sym");
+        rc = vm_write_symbols(sym_fn, symbols, lt_len);
+    } else {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+    }
+    free(symbols);
+    free(order);
+    free(sym_fn);
+    return rc;
+}
+
+/**
+ * Seconds on a monotonic clock, for compiler -t.
+ */
+static double vm_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read every token of a source once, without compiling, to time the
+ * lexer alone for compiler -t.
+ */
+static void vm_time_lexer (vm_source_t *src)
+{
+    token_t tok;
+    size_t n_tokens = 0;
+    const double start = vm_now();
+    double secs = 0.0;
+
+    while (vm_next_token(src, &tok)) {
+        n_tokens ++;
+    }
+    secs = vm_now() - start;
+    vm_rewind_source(src);
+    fprintf(stderr, "-t: lexed %zu bytes, %zu tokens in %.3f ms,"
+            " %.1f MB/s\n", src->len, n_tokens, secs * 1e3,
+            secs > 0.0 ? src->len / secs / 1e6 : 0.0);
+}
+
+int main (int argc, char *argv[]) 
+{
+    int debug_info = 0,
+        optimize = 0,
+        timing = 0,
+        arg = 1;
+    const char *cache_dir = NULL;
+    char cache_key[VM_CACHE_KEY_LEN];
+    double start = 0.0,
+           compiled = 0.0,
+           optimized = 0.0,
+           resolved = 0.0;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg ++) {
+        if (strcmp(argv[arg], "-g") == 0) {
+            debug_info = 1;
+        } else if (strcmp(argv[arg], "-O1") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[arg], "-O0") == 0) {
+            optimize = 0;
+        } else if (strcmp(argv[arg], "-t") == 0) {
+            timing = 1;
+        } else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc) {
+            cache_dir = argv[++arg];
+        } else if (strcmp(argv[arg], "--cache-stats") == 0 &&
+                   arg + 2 == argc) {
+            exit(vm_cache_print_stats(argv[arg + 1]) == SUCCESS ?
+                 EXIT_SUCCESS : EXIT_FAILURE);
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 1 && argc - arg != 2) {
+        fprintf(stderr, "\nUSAGE: compiler [-g] [-O0|-O1] [-t] [--cache dir]"
+                " <vm file> [vmc file]\n"
+                "       compiler --cache-stats dir\n");
         exit(EXIT_FAILURE);
     }
 
-    token_t *tok_list = NULL;
-    bytecode_t compiled_code[MAX_CODE_LEN];
-    label_t label_table[N_LABELS];    
+    vm_source_t src;
+    bytecode_t *compiled_code = NULL,
+               *data = NULL;
+    symtab_t labels;
+    fixup_list_t fixups;
     int code_len = 0, 
-        code_start = 0,
-        label_count = 0;
+        data_len = 0;
 
-    memset(compiled_code, MAX_CODE_LEN, sizeof(bytecode_t));
-    memset(label_table, N_LABELS, sizeof(label_t));
+    char *vmc_fn = NULL;
+    if (argc - arg == 2) {
+        vmc_fn = strdup(argv[arg + 1]);
+    } else {
+        vmc_fn = (char *)malloc(strlen(argv[arg]) + 2);
+        if (vmc_fn != NULL) {
+            strcpy(vmc_fn, argv[arg]);
+            strcat(vmc_fn, "c");
+        }
+    }
+    if (vmc_fn == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        exit(EXIT_FAILURE);
+    }
 
-    if (vm_get_token_list(fp, &tok_list) == FAILURE) {
+    if (vm_open_source(&src, argv[arg]) == FAILURE) {
         fprintf(stderr, "\nERROR: Failed to tokenize.");
         exit(EXIT_FAILURE);
     }
+    if (cache_dir != NULL) {
+        start = vm_now();
+        vm_cache_key(cache_key, src.text, src.len, optimize);
+        if (vm_cache_fetch(cache_dir, cache_key, vmc_fn, debug_info)) {
+            vm_cache_count(cache_dir, 1);
+            if (timing) {
+                fprintf(stderr, "-t: cache hit %s in %.3f ms\n", cache_key,
+                        (vm_now() - start) * 1e3);
+            }
+            vm_free_source(&src);
+            free(vmc_fn);
+            exit(EXIT_SUCCESS);
+        }
+        vm_cache_count(cache_dir, 0);
+        if (timing) {
+            fprintf(stderr, "-t: cache miss %s\n", cache_key);
+        }
+    }
+    if (timing) {
+        vm_time_lexer(&src);
+    }
 
-    if (vm_build_label_table(label_table, &label_count, tok_list) == FAILURE) {
-        fprintf(stderr, "\nERROR: Failed to build label table.");
+    start = vm_now();
+    if (vm_compile(&data, &data_len, &compiled_code, &code_len, &src,
+                   &labels, &fixups) == FAILURE) {
+        fprintf(stderr, "\nERROR: Compilation failed.");
         exit(EXIT_FAILURE);
     }
+    vm_free_source(&src);
+    compiled = vm_now();
 
-    rewind(fp);
-    if (vm_compile_first_pass(compiled_code, &code_len, &code_start,
-                              tok_list, label_table, label_count) == FAILURE) {
-        fprintf(stderr, "\nERROR: Compilation failed in first pass.");
-        exit(EXIT_FAILURE);
+    if (optimize) {
+        vm_opt_stats_t stats;
+
+        if (vm_optimize(compiled_code, &code_len, labels.labels, labels.len,
+                        &stats) == FAILURE) {
+            fprintf(stderr, "\nERROR: Optimization failed.");
+            exit(EXIT_FAILURE);
+        }
+        printf("-O1: %d bytes of code, %d before, %d saved: %d constants"
+               " folded, %d jumps threaded, %d unreachable instructions"
+               " and %d label NOPs removed\n", stats.len_after,
+               stats.len_before, stats.len_before - stats.len_after,
+               stats.folded, stats.threaded, stats.unreachable,
+               stats.label_nops);
     }
-    fclose(fp);
-    vm_free_token_list(tok_list);
+    optimized = vm_now();
 
-    if (vm_compile_second_pass(compiled_code, code_len, code_start, label_table,
-                               label_count) == FAILURE) {
+    if (!optimize) {
+        vm_apply_fixups(compiled_code, &fixups, labels.labels);
+    } else if (vm_compile_second_pass(compiled_code, code_len, labels.labels,
+                                      labels.len) == FAILURE) {
         fprintf(stderr, "\nERROR: Compilation failed in second pass.");
         exit(EXIT_FAILURE);
     }
+    free(fixups.offsets);
+    resolved = vm_now();
 
-    char vmc_fn[20];
-    if (argc == 3) {
-        strcpy(vmc_fn, argv[2]);
-    } else {
-        strcpy(vmc_fn, argv[1]);
-        strcat(vmc_fn, "c");
+    if (vm_write_image(vmc_fn, data, data_len, compiled_code,
+                       code_len) == FAILURE) {
+        exit(EXIT_FAILURE);
     }
-    fp = fopen(vmc_fn, "wb");
-    if (fp == NULL) {
-        fprintf(stderr, "\nERROR: could not create output file %s\n", vmc_fn);
+    if (debug_info && vm_write_label_table(vmc_fn, labels.labels,
+                                           labels.len) == FAILURE) {
         exit(EXIT_FAILURE);
     }
-    fwrite(&code_start, sizeof (bytecode_t), 1, fp);
-    fwrite(&code_len, sizeof (bytecode_t), 1, fp);
-    fwrite(compiled_code, sizeof (bytecode_t), code_len, fp);
-    fclose(fp);  
+    if (cache_dir != NULL &&
+        vm_cache_store(cache_dir, cache_key, vmc_fn, debug_info) == FAILURE) {
+        fprintf(stderr, "\nERROR: Failed to store %s in cache %s.\n",
+                vmc_fn, cache_dir);
+    }
+    if (timing) {
+        fprintf(stderr, "-t: compile %.3f ms, optimizer %.3f ms, labels"
+                " resolved %.3f ms, write %.3f ms\n",
+                (compiled - start) * 1e3, (optimized - compiled) * 1e3,
+                (resolved - optimized) * 1e3, (vm_now() - resolved) * 1e3);
+    }
+    vm_symtab_free(&labels);
+    free(vmc_fn);
+    free(data);
+    free(compiled_code);
 
     exit(EXIT_SUCCESS);
 }
@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "headers/constants.h"
 #include "headers/enums.h"
@@ -23,82 +24,99 @@ const INS INST_SET[] = {
  * @return               The instruction enum.
  */
 symbol_t get_inst (const bytecode_t bytecode) {
-    int i;
-    for (i = 0; i < N_INST; i ++) {
-        if (INST_SET[i].bytecode == bytecode) {
-            return (symbol_t)i;
-        }
+    /* INST_SET is generated from BYTECODE_DEF, so bytecode == enum value. */
+    if (bytecode < N_INST) {
+        return (symbol_t)bytecode;
     }
     return ERR;
 }
 
+/* Slots of the perfect hash of mnemonics, a power of 2. */
+#define MNEMONIC_SLOTS 128
+
+/* Symbol in each slot, or -1, and the seed that spreads INST_SET over
+ * them without a collision. Found once, at the first lookup. */
+static signed char mnemonic_slot[MNEMONIC_SLOTS];
+static uint32_t mnemonic_seed = 0;
+static int mnemonic_ready = 0;
+
+static uint32_t vm_mnemonic_hash (const uint32_t seed, const char *inst,
+                                  const size_t len)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    size_t i = 0;
+
+    for (i = 0; i < len; i ++) {
+        hash ^= (unsigned char)inst[i];
+        hash *= 16777619u;
+    }
+    return (hash ^ hash >> 16) & (MNEMONIC_SLOTS - 1);
+}
+
 /**
- * Get the bytecode from the instruction's string representation.
- *
- * @param  inst          The string representation of the instruction.
- *
- * @return               The instruction bytecode.
+ * Search for a seed under which every mnemonic has a slot of its own.
+ * Adding instructions needs no table to be generated again.
  */
-bytecode_t get_bytecode (const char *inst) {
-    int i;
+static void vm_build_mnemonic_hash (void)
+{
+    uint32_t seed = 0;
+    int i = 0;
 
-    assert(inst != NULL);
-    for (i = 0; i < N_INST; i ++) {
-        if (strcmp(INST_SET[i].name, inst) == 0) {
-            return INST_SET[i].bytecode;
+    for (seed = 0; ; seed ++) {
+        memset(mnemonic_slot, -1, sizeof(mnemonic_slot));
+        for (i = 0; i < N_INST; i ++) {
+            const char *name = INST_SET[i].name;
+            const uint32_t slot = vm_mnemonic_hash(seed, name, strlen(name));
+
+            if (mnemonic_slot[slot] >= 0) {
+                break;
+            }
+            mnemonic_slot[slot] = (signed char)i;
+        }
+        if (i == N_INST) {
+            break;
         }
     }
-    return INST_SET[ERR].bytecode;
+    mnemonic_seed = seed;
+    mnemonic_ready = 1;
 }
 
 /**
- * Get an integer from the compiled code array
+ * Get the bytecode from the instruction's string representation, which
+ * need not be NUL terminated. A perfect hash gives the only instruction
+ * it can be, one compare confirms it.
  *
- * @param[in]       compiled_code_ptr   Pointer to the place in the 
- *                                      compiled code array from where the
- *                                      integer is to be read from.
- * @param[out]      int_val             The integer made from the 4 bytes of 
- *                                      compiled_code.
+ * @param  inst          The string representation of the instruction.
+ * @param  len           Its length.
  *
- * @return                              status_t
+ * @return               The instruction bytecode.
  */
-status_t vm_get_integer_from_bytecode (const bytecode_t *compiled_code_ptr,
-                                       int *int_val)
-{
-    int value = 0;
-    assert(compiled_code_ptr != NULL);
-    assert(int_val != NULL);
-
-    value = compiled_code_ptr[0];
-    value |= compiled_code_ptr[1] << 8;
-    value |= compiled_code_ptr[2] << 16;
-    value |= compiled_code_ptr[3] << 24;
+bytecode_t get_bytecode_n (const char *inst, const size_t len) {
+    int i = 0;
 
-    *int_val = value;
-    return SUCCESS;
+    assert(inst != NULL);
+    if (!mnemonic_ready) {
+        vm_build_mnemonic_hash();
+    }
+    if (len == 0 || len >= sizeof(INST_SET[0].name)) {
+        return INST_SET[ERR].bytecode;
+    }
+    i = mnemonic_slot[vm_mnemonic_hash(mnemonic_seed, inst, len)];
+    if (i >= 0 && memcmp(INST_SET[i].name, inst, len) == 0 &&
+        INST_SET[i].name[len] == '\0') {
+        return INST_SET[i].bytecode;
+    }
+    return INST_SET[ERR].bytecode;
 }
 
 /**
- * Put an integer to the compiled code array
+ * Get the bytecode from the instruction's string representation.
  *
- * @param[out]      compiled_code_ptr   Pointer to the place in compiled code
- *                                      where an integer is to be put.
- * @param[in]       int_val             The integer to be inserted to the 
- *                                      compiled code array.
+ * @param  inst          The string representation of the instruction.
  *
- * @return                              status_t
+ * @return               The instruction bytecode.
  */
-status_t vm_put_integer_to_bytecode (bytecode_t *compiled_code_ptr,
-                                     const int int_val)
-{
-    int value = 0;
-    assert(compiled_code_ptr != NULL);
-
-    compiled_code_ptr[0] = (bytecode_t)int_val;
-    compiled_code_ptr[1] = (bytecode_t)(int_val >> 8);
-    compiled_code_ptr[2] = (bytecode_t)(int_val >> 16);
-    compiled_code_ptr[3] = (bytecode_t)(int_val >> 24);
-
-    return SUCCESS;
+bytecode_t get_bytecode (const char *inst) {
+    assert(inst != NULL);
+    return get_bytecode_n(inst, strlen(inst));
 }
-                                       
@@ -0,0 +1,246 @@
+/**
+ * decode.c
+ * Purpose: Load time pre-decoding of bytecode into decoded_inst_t's.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "headers/decode.h"
+#include "headers/constants.h"
+#include "headers/enums.h"
+
+#define get_name_macro(symbol) #symbol
+
+static const char *const FUSED_NAMES[N_FUSED] = {
+    FUSED_DEF(get_name_macro)
+};
+
+struct FUSION_PATTERN {
+    fused_symbol_t fused;
+    int            len;
+    symbol_t       seq[3];
+    int            push_at;  /* Index of the PUSH &label providing the
+                              * jump target, -1 if there is no jump. */
+};
+
+typedef struct FUSION_PATTERN fusion_pattern_t;
+
+/* The idioms the compiler emits for loops, conditionals and calls. */
+static const fusion_pattern_t FUSION_PATTERNS[] = {
+    {PUSH_GOTO,     2, {PUSH, GOTO},       0},
+    {PUSH_GOIF,     2, {PUSH, GOIF},       0},
+    {PUSH_GOUN,     2, {PUSH, GOUN},       0},
+    {PUSH_ADD,      2, {PUSH, ADD},       -1},
+    {DUP_WRTD,      2, {DUP, WRTD},       -1},
+    {EQU_PUSH_GOIF, 3, {EQU, PUSH, GOIF},  1},
+    {EQU_PUSH_GOUN, 3, {EQU, PUSH, GOUN},  1},
+};
+
+#define N_FUSION_PATTERNS \
+    (sizeof(FUSION_PATTERNS) / sizeof(FUSION_PATTERNS[0]))
+
+/**
+ * Fill in a decoded instruction.
+ *
+ * @param[out]  inst       The entry to fill.
+ * @param[in]   op         The instruction.
+ * @param[in]   arg        Its immediate, 0 if it has none.
+ * @param[in]   pc         Its byte offset.
+ * @param[in]   handlers   Handler addresses indexed by symbol_t, may be NULL.
+ */
+static void vm_set_decoded_inst (decoded_inst_t *inst, const symbol_t op,
+                                 const int32_t arg, const int pc,
+                                 const void *const *handlers)
+{
+    inst->op = op;
+    inst->arg = arg;
+    inst->target = -1;
+    inst->pc = pc;
+    inst->handler = handlers ? handlers[op] : NULL;
+}
+
+/**
+ * Replace the first instruction of every known idiom by its superinstruction.
+ * The other instructions of the idiom keep their own handlers, so jumping
+ * into the middle of a fused sequence still works.
+ *
+ * @param[in,out]  prog       A decoded program.
+ * @param[in]      handlers   Handler addresses indexed by symbol, may be NULL.
+ */
+static void vm_fuse_superinstructions (decoded_prog_t *prog,
+                                       const void *const *handlers)
+{
+    decoded_inst_t *insts = prog->insts;
+    int i = 0,
+        j = 0,
+        k = 0;
+
+    for (i = 0; i < prog->n_insts; i ++) {
+        for (j = 0; j < N_FUSION_PATTERNS; j ++) {
+            const fusion_pattern_t *pattern = &FUSION_PATTERNS[j];
+            int32_t target = -1;
+
+            if (i + pattern->len > prog->n_insts) {
+                continue;
+            }
+            for (k = 0; k < pattern->len; k ++) {
+                if (insts[i + k].op != pattern->seq[k]) {
+                    break;
+                }
+            }
+            if (k != pattern->len) {
+                continue;
+            }
+            if (pattern->push_at >= 0) {
+                target = vm_decoded_index(prog,
+                                          insts[i + pattern->push_at].arg);
+                if (target < 0) {
+                    /* Leave the bad jump to report itself at run time. */
+                    continue;
+                }
+            }
+            insts[i].op = pattern->fused;
+            insts[i].target = target;
+            insts[i].handler = handlers ? handlers[pattern->fused] : NULL;
+            prog->n_fused[pattern->fused - N_INST]++;
+            break;
+        }
+    }
+}
+
+/**
+ * Decode the code segment of a program. Data segment bytes before
+ * code_start are not decoded; jumping there is an error.
+ *
+ * @param[out]  prog         The decoded program.
+ * @param[in]   image        The image, as it is now. Decode it again if
+ *                           the program rewrites its code.
+ * @param[in]   handlers     Handler addresses indexed by symbol, or NULL
+ *                           for switch dispatch.
+ * @param[in]   fuse         Whether to form superinstructions.
+ * @param[in]   snap         Whether SNAP takes a snapshot. If not it is
+ *                           decoded as a NOP, which every engine runs.
+ *
+ * @return                   The error status.
+ */
+status_t vm_decode_program (decoded_prog_t *prog, const vmc_image_t *image,
+                            const void *const *handlers, const int fuse,
+                            const int snap)
+{
+    const bytecode_t *code = image->code;
+    const int code_start = image->code_start,
+              code_len   = image->code_len;
+    decoded_inst_t *insts = NULL;
+    int pc = 0,
+        n  = 0;
+
+    assert(prog != NULL);
+    assert(code != NULL);
+    assert(code_start <= code_len);
+
+    prog->code_start = code_start;
+    prog->code_len = code_len;
+    prog->has_data = image->data != NULL;
+    prog->data_words = image->data_len / 4;
+    prog->byte_addresses = image->version == 1;
+    prog->fused = fuse;
+    prog->n_insts = 0;
+    memset(prog->n_fused, 0, sizeof(prog->n_fused));
+    /* Every instruction is at least one byte, +1 for the END sentinel. */
+    prog->insts = (decoded_inst_t *)malloc((code_len - code_start + 1) *
+                                           sizeof(decoded_inst_t));
+    prog->index_of = (int32_t *)malloc((code_len + 1) * sizeof(int32_t));
+    if (prog->insts == NULL || prog->index_of == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        vm_free_decoded_program(prog);
+        return FAILURE;
+    }
+
+    for (pc = 0; pc <= code_len; pc ++) {
+        prog->index_of[pc] = -1;
+    }
+
+    for (pc = code_start; pc < code_len; pc ++) {
+        symbol_t inst = get_inst(code[pc]);
+        int32_t arg = 0;
+
+        prog->index_of[pc] = n;
+        if (inst == PUSH) {
+            if (pc + INST_LEN > code_len) {
+                fprintf(stderr, "\nError: Truncated PUSH instruction"
+                        " in byte number %d", pc);
+                vm_free_decoded_program(prog);
+                return FAILURE;
+            }
+            vm_get_integer_from_bytecode(&code[pc + 1], &arg);
+            vm_set_decoded_inst(&prog->insts[n++], PUSH, arg, pc, handlers);
+            pc += 4;
+        } else if (inst == LAB || inst == IND) {
+            /* Compiler hints never make it into a valid .vmc file. */
+            vm_set_decoded_inst(&prog->insts[n++], ERR, 0, pc, handlers);
+        } else if (inst == SNAP && !snap) {
+            vm_set_decoded_inst(&prog->insts[n++], NOP, 0, pc, handlers);
+        } else {
+            vm_set_decoded_inst(&prog->insts[n++], inst, 0, pc, handlers);
+        }
+    }
+
+    vm_set_decoded_inst(&prog->insts[n], END, 0, code_len, handlers);
+    prog->index_of[code_len] = n;
+    prog->n_insts = n;
+
+    /* Give back what PUSHes did not use, sizeable for large programs. */
+    insts = (decoded_inst_t *)realloc(prog->insts,
+                                      (n + 1) * sizeof(decoded_inst_t));
+    if (insts != NULL) {
+        prog->insts = insts;
+    }
+
+    if (fuse) {
+        vm_fuse_superinstructions(prog, handlers);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Free the memory held by a decoded program.
+ *
+ * @param  prog
+ */
+void vm_free_decoded_program (decoded_prog_t *prog)
+{
+    assert(prog != NULL);
+
+    free(prog->insts);
+    free(prog->index_of);
+    prog->insts = NULL;
+    prog->index_of = NULL;
+    prog->n_insts = 0;
+}
+
+/**
+ * Print how many superinstructions of each kind the loader formed.
+ *
+ * @param  fp
+ * @param  prog
+ */
+void vm_print_fusion_stats (FILE *fp, const decoded_prog_t *prog)
+{
+    int i = 0;
+    unsigned int total = 0;
+
+    assert(fp != NULL);
+    assert(prog != NULL);
+
+    for (i = 0; i < N_FUSED; i ++) {
+        fprintf(fp, "%-16s %u\n", FUSED_NAMES[i], prog->n_fused[i]);
+        total += prog->n_fused[i];
+    }
+    fprintf(fp, "%-16s %u of %d instructions\n", "fused", total,
+            prog->n_insts);
+}
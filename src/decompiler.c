@@ -3,98 +3,292 @@
  * Purpose: Convert the bytecode in a .vmc file to their equivalent string
  *          representation.
  *
+ * The image is mapped and the listing is written as the code is walked,
+ * through a buffer of fixed size, so memory does not grow with the image.
+ *
  * @author Nishanth H. Kottary
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 #include "headers/constants.h"
+#include "headers/vmc.h"
+
+/* Bytes buffered before a write. */
+#define WRITER_LEN  65536
+
+struct WRITER {
+    FILE   *fp;
+    size_t  len;
+    int     ok;      /* Whether every write so far succeeded. */
+    char    buf[WRITER_LEN];
+};
 
-int main (int argc, char *argv[]) 
-{ 
-    if (argc != 2 && argc != 3) {
-        printf("\nUSAGE: interpreter <vmc file>\n");
-        return 0;
+typedef struct WRITER writer_t;
+
+/**
+ * Write out the buffered bytes.
+ */
+static void vm_flush (writer_t *w)
+{
+    if (w->len > 0 && fwrite(w->buf, 1, w->len, w->fp) != w->len) {
+        w->ok = 0;
     }
+    w->len = 0;
+}
 
-    FILE *fp = fopen(argv[1], "rb");
-    if (fp == NULL) {
-        printf("\nERROR: could not open file %s\n", argv[1]);
-        return 0;
+/**
+ * Make room for n more bytes, n at most WRITER_LEN.
+ */
+static inline char *vm_reserve (writer_t *w, const size_t n)
+{
+    if (WRITER_LEN - w->len < n) {
+        vm_flush(w);
     }
+    return &w->buf[w->len];
+}
+
+static inline void vm_put_str (writer_t *w, const char *str)
+{
+    const size_t n = strlen(str);
 
-    bytecode_t compiled_code[MAX_CODE_LEN],
-               code_len = 0,
-               code_start = 0;
+    memcpy(vm_reserve(w, n), str, n);
+    w->len += n;
+}
 
-    fread(&code_start, sizeof (bytecode_t), 1, fp);
-    fread(&code_len, sizeof (bytecode_t), 1, fp);
-    fread(compiled_code, sizeof (bytecode_t), code_len, fp);
-    fclose(fp);
+/**
+ * Write a word as " %08xh # %d \n", the way PUSH arguments and data are
+ * listed, without the cost of printf.
+ */
+static void vm_put_word (writer_t *w, const int32_t word)
+{
+    static const char hex[] = "0123456789abcdef";
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+    char *out = vm_reserve(w, 32);
+    char digits[10];
+    uint32_t u = (uint32_t)word;
+    int i = 0,
+        n = 10;
 
-    char src[1000];
-    int pc = 0;
+    out[0] = ' ';
+    for (i = 8; i >= 1; i --) {
+        out[i] = hex[u & 0xf];
+        u >>= 4;
+    }
+    memcpy(out + 9, "h # ", 4);
+    out += 13;
+    u = word < 0 ? 0u - (uint32_t)word : (uint32_t)word;
+    if (word < 0) {
+        *out++ = '-';
+    }
+    /* Two digits at a time, from the last. */
+    while (u >= 100) {
+        n -= 2;
+        memcpy(&digits[n], &pairs[2 * (u % 100)], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        n -= 2;
+        memcpy(&digits[n], &pairs[2 * u], 2);
+    } else {
+        digits[--n] = '0' + u;
+    }
+    memcpy(out, &digits[n], 10 - n);
+    out += 10 - n;
+    out[0] = ' ';
+    out[1] = '\n';
+    w->len = out + 2 - w->buf;
+}
 
-    src[0] = '\0';
+/**
+ * Parse --range start:end, byte offsets in the code segment.
+ *
+ * @return  The error status.
+ */
+static status_t vm_parse_range (const char *arg, uint32_t *start,
+                                uint32_t *end)
+{
+    unsigned long s = 0,
+                  e = 0;
+    char *rest = NULL;
 
-    for (pc = 0; pc < code_start; pc ++) {
-        symbol_t inst = get_inst(compiled_code[pc]);
-        if (inst == NOP) {
-            strcat(src, INST_SET[inst].name);
-        } else {
-            char hex_num[20];
-            int push_arg = 0;
-            assert( (pc + 4) < code_len);
-            vm_get_integer_from_bytecode(&compiled_code[pc], &push_arg);
-            pc += 3;
-            strcat(src, " ");
-            sprintf(hex_num, "%08xh # %d \n", push_arg, push_arg);
-            strcat(src, hex_num);
-        }
-        strcat(src, "\n");
+    s = strtoul(arg, &rest, 10);
+    if (rest == arg || *rest != ':') {
+        return FAILURE;
     }
+    arg = rest + 1;
+    e = strtoul(arg, &rest, 10);
+    if (rest == arg || *rest != '\0' || e < s || e > UINT32_MAX) {
+        return FAILURE;
+    }
+    *start = (uint32_t)s;
+    *end = (uint32_t)e;
+    return SUCCESS;
+}
+
+/**
+ * List the instructions in [start, end) of the code segment, from the
+ * first instruction that starts at or after start.
+ *
+ * @return  The error status.
+ */
+static status_t vm_decompile_code (writer_t *w, const vmc_image_t *image,
+                                   uint32_t start, uint32_t end)
+{
+    const bytecode_t *compiled_code = image->code;
+    const uint32_t n_code = image->code_len - image->code_start;
 
-    strcat(src, "__CODE__\n");
+    start = (start > n_code ? n_code : start) + image->code_start;
+    end = (end > n_code ? n_code : end) + image->code_start;
+    uint32_t pc = image->code_start;
 
-    for (pc = code_start; pc < code_len; pc ++) {
+    /* Only the lengths of the instructions before the range are needed
+     * to find where one starts. */
+    while (pc < start && pc < end) {
+        pc += compiled_code[pc] == INST_SET[PUSH].bytecode ? 5 : 1;
+    }
+    for (; pc < end; pc ++) {
         symbol_t inst = get_inst(compiled_code[pc]);
         if (inst == ERR) {
-            printf("\nERROR: unrecognizable byte code at"
-                   "byte number %d", pc);
-            return 0;
+            vm_flush(w);
+            fprintf(stderr, "\nERROR: unrecognizable byte code at"
+                    " byte number %u\n", pc);
+            return FAILURE;
         }
-        strcat(src, INST_SET[inst].name);
+        vm_put_str(w, INST_SET[inst].name);
         if (inst == PUSH) {
-            char hex_num[20];
             int push_arg = 0;
-            assert( (pc + 4) < code_len);
+            if (pc + 4 >= image->code_len) {
+                vm_flush(w);
+                fprintf(stderr, "\nERROR: PUSH without an argument at"
+                        " byte number %u\n", pc);
+                return FAILURE;
+            }
             vm_get_integer_from_bytecode(&compiled_code[pc + 1], &push_arg);
             pc += 4;
-            strcat(src, " ");
-            sprintf(hex_num, "%08xh # %d \n", push_arg, push_arg);
-            strcat(src, hex_num);
+            vm_put_word(w, push_arg);
         } else {
-            strcat(src, "\n");
+            vm_put_str(w, "\n");
         }
     }
+    return SUCCESS;
+}
 
-    char vm_fn[20];
-    if (argc == 3) {
-        strcpy(vm_fn, argv[2]);
-    } else {
-        strcpy(vm_fn, argv[1]);
-        vm_fn[strlen(argv[1]) - 1] = '\0';
+/**
+ * List the data segment and the code of an image, as a .vm file.
+ *
+ * @return  The error status.
+ */
+static status_t vm_decompile (writer_t *w, const vmc_image_t *image)
+{
+    const bytecode_t *compiled_code = image->code;
+    uint32_t pc = 0;
+
+    for (pc = 0; pc < image->data_len / 4; pc ++) {
+        vm_put_word(w, image->data[pc]);
+        vm_put_str(w, "\n");
     }
-    fp = fopen(vm_fn, "w");
-    if (fp == NULL) {
-        printf("\nERROR: could not create output file %s\n", vm_fn);
-        return 0;
+
+    /* Older images keep their data in front of the code. */
+    for (pc = 0; pc < image->code_start; pc ++) {
+        symbol_t inst = get_inst(compiled_code[pc]);
+        if (inst == NOP) {
+            vm_put_str(w, INST_SET[inst].name);
+        } else {
+            int push_arg = 0;
+            assert( (pc + 4) <= image->code_start);
+            vm_get_integer_from_bytecode(&compiled_code[pc], &push_arg);
+            pc += 3;
+            vm_put_word(w, push_arg);
+        }
+        vm_put_str(w, "\n");
     }
-    fprintf(fp, "%s", src);
-    fclose(fp);  
 
-    return 0;
+    vm_put_str(w, "__CODE__\n");
+    return vm_decompile_code(w, image, 0, image->code_len);
 }
 
+int main (int argc, char *argv[])
+{
+    uint32_t start = 0,
+             end = 0;
+    int range = 0,
+        arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--range") == 0) {
+        if (vm_parse_range(argv[2], &start, &end) == FAILURE) {
+            fprintf(stderr, "\nERROR: --range takes start:end, byte"
+                    " offsets in the code\n");
+            exit(EXIT_FAILURE);
+        }
+        range = 1;
+        arg = 3;
+    }
+    if (argc - arg != 1 && argc - arg != 2) {
+        fprintf(stderr, "\nUSAGE: decompiler [--range start:end] <vmc file>"
+                " [vm file]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vmc_image_t image;
+    if (vm_map_image(&image, argv[arg]) == FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+
+    char *vm_fn = NULL;
+    if (argc - arg == 2) {
+        vm_fn = strdup(argv[arg + 1]);
+    } else {
+        vm_fn = strdup(argv[arg]);
+        if (vm_fn != NULL) {
+            vm_fn[strlen(argv[arg]) - 1] = '\0';
+        }
+    }
+    writer_t *w = (writer_t *)malloc(sizeof(writer_t));
+    if (vm_fn == NULL || w == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        free(vm_fn);
+        vm_free_image(&image);
+        exit(EXIT_FAILURE);
+    }
+    w->fp = strcmp(vm_fn, "-") == 0 ? stdout : fopen(vm_fn, "w");
+    w->len = 0;
+    w->ok = 1;
+    if (w->fp == NULL) {
+        fprintf(stderr, "\nERROR: could not create output file %s\n", vm_fn);
+        free(w);
+        free(vm_fn);
+        vm_free_image(&image);
+        exit(EXIT_FAILURE);
+    }
+
+    status_t rc = FAILURE;
+    if (range) {
+        fprintf(w->fp, "# code bytes %u to %u of %s\n", start, end,
+                argv[arg]);
+        rc = vm_decompile_code(w, &image, start, end);
+    } else {
+        rc = vm_decompile(w, &image);
+    }
+    vm_flush(w);
+    if (w->fp != stdout) {
+        w->ok = fclose(w->fp) == 0 && w->ok;
+    } else {
+        w->ok = fflush(stdout) == 0 && w->ok;
+    }
+    if (!w->ok) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n", vm_fn);
+        rc = FAILURE;
+    }
+    free(w);
+    free(vm_fn);
+    vm_free_image(&image);
+
+    exit(rc == SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
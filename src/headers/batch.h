@@ -0,0 +1,23 @@
+/**
+ * batch.h
+ * Purpose: Run many jobs, each a program with an input and an output
+ *          file, on a pool of threads.
+ *
+ * A manifest has one job per line: the .vmc file, the input file and the
+ * output file, separated by whitespace. An input of - means no input and
+ * an output of - means stdout. Blank lines and lines starting with # are
+ * skipped.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "enums.h"
+#include "libvm.h"
+
+status_t vm_run_batch (const char *manifest_fn, const vm_options_t *options,
+                       int n_threads);
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * cache.h
+ * Purpose: The compilation cache of compiler --cache.
+ *
+ * A cache is a directory of compiled images named by a key: a 64 bit
+ * FNV-1a hash of the compiler version, the .vmc version, the
+ * optimization level and the bytes of the source, and the length of
+ * the source. An entry is <key>.vmc, with <key>.vmc.sym next to it once
+ * a compile with -g has stored it. Entries are written to a temporary
+ * file and renamed into place, so compilers sharing a cache never see
+ * half an entry. The counts of hits and misses are kept in the file
+ * stats, updated under a lock.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+#include "enums.h"
+
+/* Bump when the compiler writes different code for the same source, so
+ * that a cache does not hand out the images of an older compiler. */
+#define VM_COMPILER_VERSION  1
+
+/* Hex digits of the hash, '-', hex digits of the length and NUL. */
+#define VM_CACHE_KEY_LEN     (16 + 1 + 16 + 1)
+
+void vm_cache_key (char *key, const char *text, const size_t len,
+                   const int optimize);
+int vm_cache_fetch (const char *dir, const char *key, const char *vmc_fn,
+                    const int debug_info);
+status_t vm_cache_store (const char *dir, const char *key, const char *vmc_fn,
+                         const int debug_info);
+void vm_cache_count (const char *dir, const int hit);
+status_t vm_cache_print_stats (const char *dir);
+
+#endif
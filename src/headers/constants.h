@@ -8,12 +8,13 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "enums.h"
 
-#define MAX_CODE_LEN 1000
 #define INST_LEN       5
-#define N_LABELS      10
-#define LABEL_LEN     10
 #define MAX_LINE_LEN  80
 
 typedef unsigned char bytecode_t;
@@ -48,7 +49,12 @@ typedef unsigned char bytecode_t;
         list_macro(IND),                                  \
 /*******************************************************/ \
         list_macro(GET),                                  \
-        list_macro(PUT),
+        list_macro(PUT),                                  \
+        list_macro(READN),                                \
+        list_macro(SNAP),                                 \
+        list_macro(WRTS),                                 \
+        list_macro(MCPY),                                 \
+        list_macro(MSET),
 
 #define get_symbol_macro(symbol) symbol
 #define get_ins_tuple_macro(symbol) {#symbol, symbol}
@@ -59,7 +65,7 @@ typedef enum {
 } symbol_t;
 
 struct INS {
-    char name[5];
+    char name[6];
     bytecode_t bytecode;
 };
 
@@ -70,13 +76,62 @@ typedef enum {
 
 typedef struct INS INS;
 
-const INS INST_SET[N_INST];
+extern const INS INST_SET[N_INST];
 
 symbol_t get_inst (const bytecode_t bc);
 bytecode_t get_bytecode (const char *inst);
-status_t vm_get_integer_from_bytecode (const bytecode_t *compiled_code_ptr,
-                                       int *int_val);
-status_t vm_put_integer_to_bytecode (bytecode_t *compiled_code_ptr,
-                                     const int int_val);
+bytecode_t get_bytecode_n (const char *inst, const size_t len);
+
+/* Inline, GET and PUT are on the hot path of every engine. */
+
+/**
+ * Get an integer from the compiled code array
+ *
+ * @param[in]       compiled_code_ptr   Pointer to the place in the 
+ *                                      compiled code array from where the
+ *                                      integer is to be read from.
+ * @param[out]      int_val             The integer made from the 4 bytes of 
+ *                                      compiled_code.
+ *
+ * @return                              status_t
+ */
+static inline status_t vm_get_integer_from_bytecode (
+        const bytecode_t *compiled_code_ptr, int *int_val)
+{
+    int value = 0;
+    assert(compiled_code_ptr != NULL);
+    assert(int_val != NULL);
+
+    value = compiled_code_ptr[0];
+    value |= compiled_code_ptr[1] << 8;
+    value |= compiled_code_ptr[2] << 16;
+    value |= compiled_code_ptr[3] << 24;
+
+    *int_val = value;
+    return SUCCESS;
+}
+
+/**
+ * Put an integer to the compiled code array
+ *
+ * @param[out]      compiled_code_ptr   Pointer to the place in compiled code
+ *                                      where an integer is to be put.
+ * @param[in]       int_val             The integer to be inserted to the 
+ *                                      compiled code array.
+ *
+ * @return                              status_t
+ */
+static inline status_t vm_put_integer_to_bytecode (
+        bytecode_t *compiled_code_ptr, const int int_val)
+{
+    assert(compiled_code_ptr != NULL);
+
+    compiled_code_ptr[0] = (bytecode_t)int_val;
+    compiled_code_ptr[1] = (bytecode_t)(int_val >> 8);
+    compiled_code_ptr[2] = (bytecode_t)(int_val >> 16);
+    compiled_code_ptr[3] = (bytecode_t)(int_val >> 24);
+
+    return SUCCESS;
+}
 
 #endif
@@ -0,0 +1,211 @@
+/**
+ * decode.h
+ * Purpose: Translate the bytecode of a .vmc file once, at load time, into
+ *          an array of fixed size pre-decoded instructions.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "constants.h"
+#include "enums.h"
+#include "vmc.h"
+
+/*
+ * Superinstructions. The loader replaces the first instruction of each of
+ * these idioms with a single handler doing the work of the whole
+ * sequence, e.g. PUSH_GOTO for PUSH &label GOTO. They share the symbol_t
+ * numbering space and continue after N_INST.
+ */
+#define FUSED_DEF(list_macro) list_macro(PUSH_GOTO),              \
+        list_macro(PUSH_GOIF),                                    \
+        list_macro(PUSH_GOUN),                                    \
+        list_macro(PUSH_ADD),                                     \
+        list_macro(DUP_WRTD),                                     \
+        list_macro(EQU_PUSH_GOIF),                                \
+        list_macro(EQU_PUSH_GOUN),
+
+typedef enum {
+    FUSED_BEFORE_FIRST = N_INST - 1,
+    FUSED_DEF(get_symbol_macro)
+    N_OPS
+} fused_symbol_t;
+
+#define N_FUSED (N_OPS - N_INST)
+
+/*
+ * One entry per instruction of the code segment. The entries of a program
+ * are followed by an END sentinel, so running off the end of the code
+ * stops the interpreter just like the byte loop used to.
+ */
+struct DECODED_INST {
+    const void *handler;  /* Handler address, used by threaded dispatch. */
+    int32_t     arg;      /* The immediate of PUSH, already decoded.     */
+    int32_t     target;   /* Validated jump target index of a fused
+                           * PUSH &label jump, otherwise unused.          */
+    uint32_t    pc;       /* Byte offset of the instruction.              */
+    uint16_t    op;       /* The symbol_t of the instruction.             */
+};
+
+typedef struct DECODED_INST decoded_inst_t;
+
+struct DECODED_PROG {
+    decoded_inst_t *insts;      /* n_insts entries plus the END sentinel.  */
+    int32_t        *index_of;   /* Byte offset -> index in insts, or -1 if
+                                 * no instruction starts at that offset.   */
+    int             n_insts;
+    int             code_start;
+    int             code_len;
+    int             has_data;          /* Whether it is a v3 image, with a
+                                        * data segment. Otherwise GET and
+                                        * PUT address the image itself.
+                                        * Every run has its own copy of
+                                        * the data, see vm_state_t.        */
+    uint32_t        data_words;        /* Words of data, 0 without any.    */
+    int             fused;             /* Decoded with superinstructions.  */
+    int             byte_addresses;    /* GET and PUT of v1 images only use
+                                        * the low byte of the address.     */
+    unsigned int    n_fused[N_FUSED];  /* Superinstructions per kind. */
+};
+
+typedef struct DECODED_PROG decoded_prog_t;
+
+status_t vm_decode_program (decoded_prog_t *prog, const vmc_image_t *image,
+                            const void *const *handlers, const int fuse,
+                            const int snap);
+void vm_free_decoded_program (decoded_prog_t *prog);
+void vm_print_fusion_stats (FILE *fp, const decoded_prog_t *prog);
+
+/**
+ * Translate a jump target given as a byte offset into an index in the
+ * decoded instruction array.
+ *
+ * @return  The index, or -1 if target is not the start of an instruction
+ *          of the code segment.
+ */
+static inline int32_t vm_decoded_index (const decoded_prog_t *prog,
+                                        const int32_t target)
+{
+    if ((uint32_t)target >= (uint32_t)prog->code_len) {
+        return -1;
+    }
+    return prog->index_of[target];
+}
+
+/**
+ * Translate the operand of GET or PUT into a word index in the data
+ * segment. The low bits of an unaligned address rotate to the top, so a
+ * single compare with data_words rejects it along with any out of bounds
+ * address, and with data_words 0 every address of an older image.
+ */
+static inline uint32_t vm_data_index (const int32_t address)
+{
+    const uint32_t a = (uint32_t)address;
+
+    return a >> 2 | a << 30;
+}
+
+/**
+ * Translate the operand of GET or PUT into a byte offset in the data
+ * segment, or in the image for v1 and v2 images.
+ *
+ * @return  The offset of the 4 byte value, or -1 if it is out of bounds
+ *          or, in a data segment, not aligned.
+ */
+static inline int32_t vm_data_address (const decoded_prog_t *prog,
+                                       const int32_t address)
+{
+    if (prog->has_data) {
+        return vm_data_index(address) < prog->data_words ? address : -1;
+    }
+    if (prog->byte_addresses) {
+        return (bytecode_t)address;
+    }
+    if (prog->code_len < 4 ||
+        (uint32_t)address > (uint32_t)(prog->code_len - 4)) {
+        return -1;
+    }
+    return address;
+}
+
+/**
+ * Translate the operands of READN into a word index in the data segment.
+ *
+ * @return  The index of the first of n words, or -1 if they are not all
+ *          in the data segment.
+ */
+static inline int32_t vm_data_range (const decoded_prog_t *prog,
+                                     const int32_t address, const int32_t n)
+{
+    const uint32_t index = vm_data_index(address);
+
+    if (!prog->has_data || n < 0 || index > prog->data_words ||
+        (uint32_t)n > prog->data_words - index) {
+        return -1;
+    }
+    return (int32_t)index;
+}
+
+/**
+ * Find the zero terminated run of words WRTS writes.
+ *
+ * @param  prog
+ * @param  data     The data segment of the run.
+ * @param  address
+ *
+ * @return  The number of words before the zero, or -1 if the address is
+ *          not in the data segment or no zero follows it there.
+ */
+static inline int32_t vm_data_string (const decoded_prog_t *prog,
+                                      const int32_t *data,
+                                      const int32_t address)
+{
+    const uint32_t index = vm_data_index(address);
+    const int32_t *p = NULL;
+
+    if (index >= prog->data_words) {
+        return -1;
+    }
+    for (p = &data[index]; p < &data[prog->data_words]; p ++) {
+        if (*p == 0) {
+            return (int32_t)(p - &data[index]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * MSET n words already checked with vm_data_range().
+ */
+static inline void vm_data_fill (int32_t *words, const int32_t n,
+                                 const int32_t value)
+{
+    int32_t i = 0;
+
+    if (value == 0) {
+        memset(words, 0, (size_t)n * sizeof(int32_t));
+        return;
+    }
+    for (i = 0; i < n; i ++) {
+        words[i] = value;
+    }
+}
+
+/**
+ * Whether a 4 byte PUT at this offset overwrites code, which only older
+ * images without a separate data segment allow.
+ */
+static inline int vm_hits_code (const decoded_prog_t *prog,
+                                const int32_t address)
+{
+    return !prog->has_data &&
+           address + 4 > prog->code_start && address < prog->code_len;
+}
+
+#endif
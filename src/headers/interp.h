@@ -0,0 +1,28 @@
+/**
+ * interp.h
+ * Purpose: The interpreter, which every program ends up running on.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "decode.h"
+#include "enums.h"
+#include "vm.h"
+#include "vmc.h"
+
+const void *const *vm_interpret_handlers (void);
+const void *const *vm_interpret_profiled_handlers (void);
+const void *const *vm_interpret_traced_handlers (void);
+
+status_t vm_interpret (const decoded_prog_t *prog, vmc_image_t *image,
+                       const int show_stats, vm_state_t *state);
+status_t vm_interpret_profiled (const decoded_prog_t *prog,
+                                vmc_image_t *image, const int show_stats,
+                                vm_state_t *state);
+status_t vm_interpret_traced (const decoded_prog_t *prog, vmc_image_t *image,
+                              const int show_stats, vm_state_t *state);
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * jit.h
+ * Purpose: Baseline template JIT translating decoded bytecode to x86-64.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "constants.h"
+#include "decode.h"
+#include "enums.h"
+#include "vm.h"
+
+typedef struct JIT_CODE jit_code_t;
+
+status_t vm_jit_compile (jit_code_t **jit, const decoded_prog_t *prog);
+vm_exit_t vm_jit_run (const jit_code_t *jit, vm_state_t *state);
+void vm_jit_free (jit_code_t *jit);
+
+#endif
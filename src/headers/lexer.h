@@ -2,23 +2,69 @@
  * lexer.h
  * Purpose: Lexical analysis and token generation.
  *
+ * The source file is mapped, or read whole when it cannot be, and tokens
+ * are read from it one at a time as slices of it: an offset, a length
+ * and a line number. Tokens are not NUL terminated. Lines may be of any
+ * length, and a token starting with '#' comments out the rest of its
+ * line.
+ *
  * @author Nishanth H. Kottary
  */
 
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "constants.h"
 
-struct _token_t{
-    char token[MAX_LINE_LEN];
-    unsigned int line_num;
-    struct _token_t *next_tk;
+struct _token_t {
+    uint32_t offset;     /* In the text of the source. */
+    uint32_t len;
+    uint32_t line_num;
 };
 
 typedef struct _token_t token_t;
 
-status_t vm_get_token_list (FILE *fp, token_t **tok_list);
-status_t vm_free_token_list (token_t *tok_list);
+struct VM_SOURCE {
+    const char *text;
+    size_t      len;
+    int         mapped;      /* Whether text is a mapping of the file.  */
+    size_t      pos;         /* Where the next token is looked for.     */
+    uint32_t    line_num;    /* The line of pos.                        */
+};
+
+typedef struct VM_SOURCE vm_source_t;
+
+status_t vm_open_source (vm_source_t *src, const char *fn);
+int vm_next_token (vm_source_t *src, token_t *tok);
+void vm_rewind_source (vm_source_t *src);
+void vm_free_source (vm_source_t *src);
+
+/**
+ * The first character of a token in its source.
+ */
+static inline const char *vm_token_text (const vm_source_t *src,
+                                         const token_t *tok)
+{
+    return src->text + tok->offset;
+}
+
+/**
+ * Whether a token is the string str.
+ */
+static inline int vm_token_is (const vm_source_t *src, const token_t *tok,
+                               const char *str)
+{
+    size_t i = 0;
+
+    for (i = 0; i < tok->len; i ++) {
+        if (str[i] != src->text[tok->offset + i]) {
+            return 0;
+        }
+    }
+    return str[i] == '\0';
+}
 
 #endif
@@ -0,0 +1,115 @@
+/**
+ * libvm.h
+ * Purpose: Run .vmc programs from inside another program.
+ *
+ * A vm_t holds everything one program needs: the options it runs with,
+ * the loaded image and its decoded and jitted code, and its stack and
+ * I/O buffers while it runs. A host can run many programs back to back
+ * on one vm_t, or concurrently on one vm_t per thread. Such a vm_t may
+ * borrow the program of another with vm_share_image(): the image and
+ * the decoded and jitted code are then shared read-only, and only the
+ * copy of the data a run writes to is its own. The source vm_t must keep
+ * the program loaded until every vm_t borrowing it is destroyed or has
+ * loaded another one.
+ *
+ *     vm_t *vm = NULL;
+ *     if (vm_create(&vm, NULL) == SUCCESS &&
+ *         vm_load_image(vm, "prog.vmc") == SUCCESS) {
+ *         vm_run(vm, NULL);
+ *     }
+ *     vm_destroy(vm);
+ *
+ * Run time errors are reported on stderr, as by the vm command.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef LIBVM_H
+#define LIBVM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "enums.h"
+
+typedef struct VM vm_t;
+
+/*
+ * What the runs of a program executed: how often each instruction ran,
+ * how often each GOIF and GOUN jumped and how deep the stack got. One
+ * profile counts for one vm_t at a time.
+ */
+typedef struct VM_PROFILE vm_profile_t;
+
+/*
+ * The last instructions a program executed, kept in a ring buffer so that
+ * they can be dumped when it fails, hangs or exits. One trace records for
+ * one vm_t at a time.
+ */
+typedef struct VM_TRACE vm_trace_t;
+
+/*
+ * Where a program reads its input from and writes its output to. The
+ * program reads input first, then calls read whenever it needs more; read
+ * returns the number of bytes it stored in buf, 0 at the end of input.
+ * write gets the output in batches, or at once when unbuffered. Either
+ * callback may be NULL: no more input, or output dropped.
+ */
+struct VM_IO {
+    size_t      (*read) (void *ctx, char *buf, size_t len);
+    void        (*write) (void *ctx, const char *buf, size_t len);
+    void         *ctx;        /* Passed to read and write.            */
+    const char   *input;      /* Input already in memory, or NULL.    */
+    size_t        input_len;
+};
+
+typedef struct VM_IO vm_io_t;
+
+typedef enum {
+    VM_ENGINE_INTERP,  /* The interpreter.                              */
+    VM_ENGINE_JIT,     /* x86-64 native code, else the interpreter.     */
+    VM_ENGINE_REG      /* The register IR engine.                       */
+} vm_engine_t;
+
+struct VM_OPTIONS {
+    vm_engine_t engine;
+    int         fuse;        /* Form superinstructions.                 */
+    int         use_mmap;    /* Map images rather than read them.       */
+    int         unbuffered;  /* Write every character out at once.      */
+    int         show_stats;  /* Print engine counts to stderr.          */
+    int         verify;      /* Verify images as they are loaded,
+                              * rejecting invalid ones and interpreting
+                              * verified ones without run time checks. */
+    const char *snapshot_fn; /* Where SNAP writes a snapshot of the
+                              * program, NULL to ignore SNAP.           */
+    vm_profile_t *profile;   /* Counts what every run executes, NULL
+                              * not to. Profiled runs are interpreted,
+                              * without superinstructions.             */
+    vm_trace_t  *trace;      /* Records what every run executes, NULL
+                              * not to. Traced runs are interpreted,
+                              * unless profiled.                       */
+};
+
+typedef struct VM_OPTIONS vm_options_t;
+
+void vm_default_options (vm_options_t *options);
+status_t vm_create (vm_t **vm, const vm_options_t *options);
+status_t vm_load_image (vm_t *vm, const char *fn);
+status_t vm_share_image (vm_t *vm, const vm_t *source);
+int vm_is_snapshot (const vm_t *vm);
+status_t vm_run (vm_t *vm, const vm_io_t *io);
+void vm_destroy (vm_t *vm);
+
+status_t vm_profile_create (vm_profile_t **profile);
+status_t vm_profile_report (const vm_profile_t *profile, const char *vmc_fn,
+                            const char *json_fn);
+void vm_profile_destroy (vm_profile_t *profile);
+
+status_t vm_trace_create (vm_trace_t **trace, uint32_t n_records);
+status_t vm_trace_dump (const vm_trace_t *trace, const char *fn);
+void vm_trace_destroy (vm_trace_t *trace);
+
+size_t vm_stdin_read (void *ctx, char *buf, size_t len);
+void vm_stdout_write (void *ctx, const char *buf, size_t len);
+
+#endif
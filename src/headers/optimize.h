@@ -0,0 +1,33 @@
+/**
+ * optimize.h
+ * Purpose: The optimizing pass of compiler -O1, run on the code of the
+ *          first pass before labels are resolved.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdint.h>
+
+#include "constants.h"
+#include "enums.h"
+#include "symtab.h"
+
+/* What vm_optimize() did, for the compiler to report. */
+struct VM_OPT_STATS {
+    int len_before;       /* Bytes of code before and after. */
+    int len_after;
+    int folded;           /* PUSH PUSH ADD, SUB or MUL made one PUSH.   */
+    int threaded;         /* Jumps retargeted past a PUSH &label GOTO.  */
+    int unreachable;      /* Instructions removed after GOTO and END.   */
+    int label_nops;       /* NOPs of code labels removed.               */
+};
+
+typedef struct VM_OPT_STATS vm_opt_stats_t;
+
+status_t vm_optimize (bytecode_t *code, int *code_len, label_t *label_table,
+                      const int lt_len, vm_opt_stats_t *stats);
+
+#endif
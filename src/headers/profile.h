@@ -0,0 +1,48 @@
+/**
+ * profile.h
+ * Purpose: Count what a program executes, for vm --profile.
+ *
+ * The interpreter is built a second time with VM_PROFILING defined, as
+ * vm_interpret_profiled(). That build counts every instruction it
+ * dispatches and every GOIF and GOUN it takes in per instruction
+ * counters, and tracks the depth of the stack. The counters belong to
+ * the decoded program, so they are collected into a list keyed by pc
+ * whenever the program ends or is decoded again. The normal build has no
+ * counters at all.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "decode.h"
+#include "enums.h"
+#include "libvm.h"
+
+/* The counts of one instruction. */
+struct VM_PROFILE_ENTRY {
+    uint64_t hits;
+    uint64_t taken;     /* Jumps taken, by GOIF and GOUN only. */
+    uint32_t pc;
+    uint16_t op;
+};
+
+typedef struct VM_PROFILE_ENTRY vm_profile_entry_t;
+
+struct VM_PROFILE {
+    uint64_t           *hits;       /* Per decoded instruction of the    */
+    uint64_t           *taken;      /* program running now.              */
+    int                 n_counters;
+    int                 max_depth;
+    vm_profile_entry_t *entries;    /* Collected counts, ordered by pc.  */
+    int                 n_entries;
+};
+
+status_t vm_profile_start (vm_profile_t *profile, const decoded_prog_t *prog);
+void vm_profile_collect (vm_profile_t *profile, const decoded_prog_t *prog,
+                         const int max_depth);
+
+#endif
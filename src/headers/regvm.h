@@ -0,0 +1,26 @@
+/**
+ * regvm.h
+ * Purpose: Register based execution engine. Basic blocks of stack bytecode
+ *          are translated into a three address IR over virtual registers.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <stdio.h>
+
+#include "constants.h"
+#include "decode.h"
+#include "enums.h"
+#include "vm.h"
+
+typedef struct REG_PROG reg_prog_t;
+
+status_t vm_reg_create (reg_prog_t **rp, const decoded_prog_t *prog);
+vm_exit_t vm_reg_run (reg_prog_t *rp, vm_state_t *state);
+void vm_reg_print_stats (FILE *fp, const reg_prog_t *rp);
+void vm_reg_free (reg_prog_t *rp);
+
+#endif
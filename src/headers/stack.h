@@ -1,9 +1,17 @@
 /**
  * stack.h
+ * Purpose: Fixed size operand stack of unboxed 32 bit integers.
+ *
+ * The elements live in a flat array inside the Stack struct, so a Stack
+ * declared as a local variable needs no heap memory at all. All operations
+ * are inline since they sit on the interpreter's hot path.
  *
  * @author Nishanth H. Kottary
  */
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include "enums.h"
 
 #ifndef STACK_H
@@ -11,19 +19,82 @@
 
 #define MAX_STACK 100
 
+typedef int32_t stack_elem_t;
+
 struct STACK {
-    void* elems[MAX_STACK];
+    stack_elem_t elems[MAX_STACK];
     int top;
 };
 
 typedef struct STACK Stack;
 
-Stack *newStack (void);
-int isEmpty (Stack *stk);
-int isFull (Stack *stk);
-status_t push (Stack *stk, void *key);
-void *pop (Stack *stk);
-void *top (Stack *stk);
-void freeStack(Stack *stk);
+static inline void initStack (Stack *s)
+{
+    s->top = -1;
+}
+
+static inline int isEmpty (const Stack *s)
+{
+    return s->top == -1;
+}
+
+static inline int isFull (const Stack *s)
+{
+    return s->top >= MAX_STACK - 1;
+}
+
+/**
+ * Number of elements currently on the stack.
+ */
+static inline int stackSize (const Stack *s)
+{
+    return s->top + 1;
+}
+
+static inline status_t push (Stack *s, const stack_elem_t key)
+{
+    if (isFull(s)) {
+        return FAILURE;
+    }
+    s->elems[++s->top] = key;
+    return SUCCESS;
+}
+
+/**
+ * Pop the topmost element.
+ *
+ * @param[in,out]  s     The stack.
+ * @param[out]     key   Receives the popped element, may be NULL.
+ *
+ * @return               FAILURE if the stack was empty.
+ */
+static inline status_t pop (Stack *s, stack_elem_t *key)
+{
+    if (isEmpty(s)) {
+        return FAILURE;
+    }
+    if (key != NULL) {
+        *key = s->elems[s->top];
+    }
+    s->top--;
+    return SUCCESS;
+}
+
+/**
+ * Pointer to the n-th element from the top (0 is the topmost), or NULL if
+ * the stack does not hold that many elements.
+ */
+static inline stack_elem_t *peek (Stack *s, const int n)
+{
+    if (s->top - n < 0) {
+        return NULL;
+    }
+    return &s->elems[s->top - n];
+}
+
+static inline stack_elem_t *top (Stack *s)
+{
+    return peek(s, 0);
+}
 
 #endif
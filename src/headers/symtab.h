@@ -0,0 +1,52 @@
+/**
+ * symtab.h
+ * Purpose: The label table of the compiler, hashed by name.
+ *
+ * Labels get ids in the order they are first met, defined or referenced,
+ * so a PUSH &label can come before its label. Names are interned, copied
+ * once into blocks that live as long as the table.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "enums.h"
+
+typedef struct LABEL_T {
+    char         *label;     /* Interned, owned by the table.            */
+    unsigned int  line_num;  /* Where it is defined, 0 if not yet.       */
+    unsigned int  ref_line;  /* Where it was first referenced, or 0.     */
+    uint32_t      pc;
+    int           id;        /* Its index in the table.                  */
+    int           in_code;
+} label_t;
+
+struct NAME_BLOCK;
+
+struct SYMTAB {
+    label_t           *labels;     /* Indexed by id.                      */
+    int                len;
+    int                capacity;
+    int32_t           *buckets;    /* Open addressing, label ids or -1.   */
+    uint32_t           n_buckets;  /* A power of 2, more than 2 * len.    */
+    struct NAME_BLOCK *names;      /* The interned names, newest first.   */
+};
+
+typedef struct SYMTAB symtab_t;
+
+status_t vm_symtab_init (symtab_t *tab);
+void vm_symtab_free (symtab_t *tab);
+label_t *vm_symtab_find (const symtab_t *tab, const char *name,
+                         const size_t len);
+status_t vm_symtab_define (symtab_t *tab, const char *name, const size_t len,
+                           const unsigned int line_num, label_t **label);
+status_t vm_symtab_reference (symtab_t *tab, const char *name,
+                              const size_t len, const unsigned int line_num,
+                              label_t **label);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * trace.h
+ * Purpose: Record the last instructions a program executed, for vm --trace
+ *          and vmtrace.
+ *
+ * The interpreter is built a third time with VM_TRACING defined, as
+ * vm_interpret_traced(). Before dispatching an instruction it stores a
+ * fixed size record of it in a ring buffer, overwriting the oldest.
+ *
+ * A dump of the ring starts with the magic "VMT", a version byte, the
+ * size of a record, the number of instructions executed and the number
+ * of records that follow, oldest first, as little endian integers:
+ *
+ *     0   "VMT" VM_TRACE_VERSION
+ *     4   record_len  (uint32)
+ *     8   n_executed  (uint64)
+ *    16   n_records   (uint64)
+ *    24   records: pc (uint32), tos (int32), op (uint16), depth (uint16)
+ *
+ * op is a symbol_t, or a superinstruction of decode.h, and tos is only
+ * meaningful when depth > 0. Both are as they were before the
+ * instruction ran.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "enums.h"
+#include "libvm.h"
+
+#define VM_TRACE_VERSION      1
+#define VM_TRACE_HEADER_LEN  24
+#define VM_TRACE_RECORD_LEN  12
+
+/* The default ring, the last 1M instructions in 12MB. */
+#define VM_TRACE_DEFAULT_RECORDS  (1u << 20)
+
+struct VM_TRACE_RECORD {
+    uint32_t pc;
+    int32_t  tos;
+    uint16_t op;
+    uint16_t depth;
+};
+
+typedef struct VM_TRACE_RECORD vm_trace_record_t;
+
+struct VM_TRACE {
+    vm_trace_record_t *ring;
+    uint64_t           mask;   /* The number of records in ring, less 1. */
+    volatile uint64_t  n;      /* Records ever written. Read by signal
+                                * handlers, so never cached.             */
+};
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * unchecked.h
+ * Purpose: The interpreter loop for programs that passed the verifier,
+ *          without the stack and jump checks of the interpreter.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef UNCHECKED_H
+#define UNCHECKED_H
+
+#include "decode.h"
+#include "enums.h"
+#include "vm.h"
+#include "vmc.h"
+
+const void *const *vm_unchecked_handlers (void);
+vm_exit_t vm_run_unchecked (const decoded_prog_t *prog, vmc_image_t *image,
+                            const int show_stats, vm_state_t *state);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * verify.h
+ * Purpose: Load time verification of a decoded program, so that programs
+ *          proven safe can run without the checks of the interpreter.
+ *
+ * The verifier follows every path from the first instruction, tracking
+ * the depth of the stack and, when it is a constant from a PUSH, the top
+ * of the stack. A program verifies when every instruction it can reach
+ * is always run with the same stack depth, never underflows or
+ * overflows the stack, and only jumps to constant addresses of
+ * instructions. Jumps to computed addresses, e.g. the return of a
+ * subroutine, and stack depths that differ between paths cannot be
+ * proven, so such programs run on the checked interpreter. So do those
+ * that may underflow or overflow the stack, or jump to a constant that
+ * is not an instruction: the verifier follows both arms of every
+ * conditional jump, even one the program never takes. Only an image
+ * whose first instruction is not one is invalid. One without any
+ * instructions, starting at the end of its code, ends right away and
+ * verifies.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+#include "decode.h"
+#include "enums.h"
+
+typedef enum {
+    VM_VERIFIED,       /* Safe to run without checks.                  */
+    VM_UNVERIFIABLE,   /* Run with the checks of the interpreter.      */
+    VM_INVALID         /* Rejected, it cannot start.                   */
+} vm_verdict_t;
+
+struct VM_VERIFY_RESULT {
+    vm_verdict_t verdict;
+    uint32_t     pc;          /* Where it could not be verified or was
+                               * found invalid.                           */
+    const char  *reason;      /* Why, NULL if verified.                   */
+    int          max_depth;   /* Deepest stack of a verified program.     */
+    int          reached;     /* Instructions reachable from the start.   */
+};
+
+typedef struct VM_VERIFY_RESULT vm_verify_result_t;
+
+status_t vm_verify_program (const decoded_prog_t *prog,
+                            const uint32_t start_pc, const int start_depth,
+                            vm_verify_result_t *result);
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * vm.h
+ * Purpose: The run state of a program, shared by the execution engines.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include "constants.h"
+#include "stack.h"
+
+/*
+ * Everything an engine needs to pick up a program where another engine
+ * left it, e.g. when the JIT hands a program over to the interpreter.
+ */
+struct VM_STATE {
+    Stack        stack;
+    bool_flag_t  bool_flag;
+    int          input;   /* Last value read. REAC only overwrites its
+                           * lowest byte, like scanf("%c") always did. */
+    int          pc;      /* Byte offset of the next instruction.      */
+    int32_t      *data;   /* The data segment of this run, NULL for
+                           * images without one.                      */
+    bytecode_t   *code;   /* The code of this run, which GET and PUT of
+                           * images without a data segment address.   */
+    struct VM_OUT *out;   /* Where WRTC, WRTD and WRTH write to, and   */
+    struct VM_IN  *in;    /* REAC, READ, REAH and READN read from.     */
+    const char   *snapshot_fn;  /* Where SNAP writes a snapshot, NULL if
+                                 * SNAP is a NOP.                          */
+    struct VM_PROFILE *profile; /* Where vm_interpret_profiled() counts. */
+    struct VM_TRACE   *trace;   /* Where vm_interpret_traced() records.  */
+};
+
+typedef struct VM_STATE vm_state_t;
+
+/* How an alternative engine (JIT, register VM) stopped running a program. */
+typedef enum {
+    VM_EXIT_END,       /* The program executed END.                        */
+    VM_EXIT_HANDOFF    /* Continue in the interpreter at state->pc, e.g. to
+                        * report a run time error or after self-modifying
+                        * code.                                            */
+} vm_exit_t;
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * vmc.h
+ * Purpose: Reading and writing .vmc files.
+ *
+ * Version 3 files start with the magic "VMC" and a version byte, followed
+ * by data_len and code_len as 32 bit little endian integers, data_len
+ * bytes of little endian data words and code_len bytes of code. GET and
+ * PUT address the data segment with aligned byte offsets; jumps address
+ * the code segment, which is never written.
+ *
+ * A version 4 file is a snapshot: a version 3 image, with the data
+ * segment as it was when SNAP ran, followed by the state to resume from,
+ * as 32 bit little endian integers: pc, the boolean flag, the last value
+ * read, the stack depth and the stack from the bottom up.
+ *
+ * Older files keep the data in front of the code in a single image that
+ * GET and PUT address directly, so PUT can rewrite code. Version 1 files
+ * start with two bytes, code_start and code_len, followed by code_len
+ * bytes. Version 2 files have the same header as version 3 with
+ * code_start in place of data_len. A v1 header always has code_start <=
+ * code_len, while 'V' > 'M', so they can never be confused.
+ *
+ * The compiler can also list the labels of a program in a symbol file
+ * next to it, hw.vmc.sym for hw.vmc, one per line: "code" or "data",
+ * the offset of the label in that segment and its name.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef VMC_H
+#define VMC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "enums.h"
+#include "stack.h"
+
+#define VMC_VERSION           3
+#define VMC_SNAPSHOT_VERSION  4
+#define VMC_HEADER_LEN       12
+
+/* pc, bool_flag, input and depth, before the stack. */
+#define VMC_STATE_LEN        16
+
+/* Largest image the VM accepts. Offsets must fit in an int32_t. */
+#define VMC_MAX_LEN     (1u << 30)
+
+/* The run state a snapshot resumes from. */
+struct VMC_STATE {
+    uint32_t pc;
+    int32_t  bool_flag;
+    int32_t  input;
+    uint32_t depth;
+    int32_t  stack[MAX_STACK];
+};
+
+typedef struct VMC_STATE vmc_state_t;
+
+struct VMC_IMAGE {
+    bytecode_t *code;        /* The code segment, preceded by the data
+                              * segment in v1 and v2 images.               */
+    uint32_t    code_start;  /* Offset of the first instruction.           */
+    uint32_t    code_len;    /* Bytes in code.                             */
+    int32_t    *data;        /* The data segment of a v3 or v4 image, else
+                              * NULL.                                      */
+    uint32_t    data_len;    /* Bytes in data, a multiple of 4.            */
+    int         version;
+    void       *mapping;     /* The whole file, when mapped rather than    */
+    size_t      mapped_len;  /* read by vm_map_image().                    */
+    vmc_state_t *state;      /* Where a snapshot resumes, else NULL.       */
+};
+
+typedef struct VMC_IMAGE vmc_image_t;
+
+/* A label, as listed in a symbol file. */
+struct VMC_SYMBOL {
+    char     *name;
+    uint32_t  offset;   /* Offset in its segment.                         */
+    int       in_code;  /* Whether it is in the code or the data segment. */
+};
+
+typedef struct VMC_SYMBOL vmc_symbol_t;
+
+status_t vm_read_image (vmc_image_t *image, const char *fn);
+status_t vm_map_image (vmc_image_t *image, const char *fn);
+size_t vm_image_code_size (const vmc_image_t *image);
+status_t vm_write_image (const char *fn, const bytecode_t *data,
+                         const uint32_t data_len, const bytecode_t *code,
+                         const uint32_t code_len);
+status_t vm_write_snapshot (const char *fn, const vmc_image_t *image,
+                            const vmc_state_t *state);
+void vm_free_image (vmc_image_t *image);
+status_t vm_write_symbols (const char *fn, const vmc_symbol_t *symbols,
+                           const int n);
+status_t vm_read_symbols (const char *fn, vmc_symbol_t **symbols, int *n);
+void vm_free_symbols (vmc_symbol_t *symbols, const int n);
+
+#endif
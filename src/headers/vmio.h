@@ -0,0 +1,143 @@
+/**
+ * vmio.h
+ * Purpose: Buffered program input and output. WRTC, WRTD, WRTH and WRTS
+ *          format straight into a buffer that is handed to the write
+ *          callback of a vm_io_t in large batches. REAC, READ, REAH and
+ *          READN parse straight out of the input the caller supplied in
+ *          memory, then out of a buffer filled by the read callback.
+ *
+ * Every running program has its own pair of streams. The output buffer is
+ * flushed when it fills up, before every read, so a prompt is always
+ * visible, and when the program stops. When unbuffered, every write is
+ * flushed at once.
+ *
+ * The parsers match scanf("%c"), scanf("%d") and scanf("%08x"): on a
+ * failed read the value is left as it was.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#ifndef VMIO_H
+#define VMIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "enums.h"
+#include "libvm.h"
+
+#define VM_OUT_BUF_LEN  (1 << 16)
+#define VM_IN_BUF_LEN   (1 << 16)
+
+/* Room for the longest single write, a negative decimal. */
+#define VM_OUT_MAX_ITEM 16
+
+struct VM_OUT {
+    size_t len;    /* Bytes waiting in buf.                   */
+    size_t limit;  /* Flush once len reaches this.            */
+    void (*write) (void *ctx, const char *buf, size_t len);
+    void  *ctx;
+    char   buf[VM_OUT_BUF_LEN];
+};
+
+struct VM_IN {
+    const char *p;           /* Next unread byte.                         */
+    const char *end;         /* End of the bytes read so far.             */
+    size_t (*read) (void *ctx, char *buf, size_t len);
+    void       *ctx;
+    char        buf[VM_IN_BUF_LEN];
+};
+
+typedef struct VM_OUT vm_out_t;
+typedef struct VM_IN vm_in_t;
+
+void vm_out_init (vm_out_t *out, const vm_io_t *io, const int unbuffered);
+void vm_out_flush (vm_out_t *out);
+
+void vm_in_init (vm_in_t *in, const vm_io_t *io);
+status_t vm_in_read_char (vm_in_t *in, char *value);
+status_t vm_in_read_dec (vm_in_t *in, int32_t *value);
+status_t vm_in_read_hex (vm_in_t *in, int32_t *value);
+int32_t vm_in_read_words (vm_in_t *in, int32_t *words, const int32_t n);
+
+/*
+ * len stays below limit between writes, and limit is at most
+ * VM_OUT_BUF_LEN - VM_OUT_MAX_ITEM, so every write below fits.
+ */
+static inline void vm_out_end_item (vm_out_t *out)
+{
+    if (out->len >= out->limit) {
+        vm_out_flush(out);
+    }
+}
+
+static inline void vm_out_char (vm_out_t *out, const int32_t value)
+{
+    out->buf[out->len++] = (char)value;
+    vm_out_end_item(out);
+}
+
+/**
+ * Write the low byte of each of n words, as WRTC would one at a time.
+ */
+static inline void vm_out_words (vm_out_t *out, const int32_t *words,
+                                 size_t n)
+{
+    while (n > 0) {
+        char *p = &out->buf[out->len];
+        size_t chunk = VM_OUT_BUF_LEN - out->len,
+               i = 0;
+
+        if (chunk > n) {
+            chunk = n;
+        }
+        for (i = 0; i < chunk; i ++) {
+            p[i] = (char)words[i];
+        }
+        out->len += chunk;
+        words += chunk;
+        n -= chunk;
+        vm_out_end_item(out);
+    }
+}
+
+/**
+ * Same as printf("%d", value).
+ */
+static inline void vm_out_dec (vm_out_t *out, const int32_t value)
+{
+    char digits[VM_OUT_MAX_ITEM];
+    char *p = &digits[VM_OUT_MAX_ITEM];
+    uint32_t u = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    memcpy(&out->buf[out->len], p, &digits[VM_OUT_MAX_ITEM] - p);
+    out->len += &digits[VM_OUT_MAX_ITEM] - p;
+    vm_out_end_item(out);
+}
+
+/**
+ * Same as printf("%08x", value).
+ */
+static inline void vm_out_hex (vm_out_t *out, const int32_t value)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    const uint32_t u = (uint32_t)value;
+    char *p = &out->buf[out->len];
+    int i = 0;
+
+    for (i = 0; i < 8; i ++) {
+        p[i] = hex_digits[(u >> (28 - 4 * i)) & 0xF];
+    }
+    out->len += 8;
+    vm_out_end_item(out);
+}
+
+#endif
@@ -0,0 +1,767 @@
+/**
+ * interp.c
+ * Purpose: Interpret a decoded program.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "headers/constants.h"
+#include "headers/stack.h"
+#include "headers/decode.h"
+#include "headers/interp.h"
+#include "headers/profile.h"
+#include "headers/trace.h"
+#include "headers/vmio.h"
+#include "headers/enums.h"
+
+/*
+ * Two dispatch engines share the interpreter loop below. Both run over the
+ * decoded_inst_t array built by vm_decode_program() when the program is
+ * loaded. By default every instruction goes through a switch on its
+ * symbol. Building with VM_THREADED_DISPATCH on a GNU compatible compiler
+ * instead stores the address of each handler in the decoded instruction
+ * and jumps straight from one handler to the next (computed goto), so each
+ * handler gets its own indirect branch. The label table is generated from
+ * BYTECODE_DEF and FUSED_DEF.
+ *
+ * A superinstruction only takes its fast path when the stack is known to
+ * hold what the whole sequence needs. Otherwise it falls back to the
+ * handler of its first instruction, which is always labelled do_<symbol>,
+ * so the sequence runs unfused with the usual diagnostics.
+ *
+ * Building with VM_PROFILING gives vm_interpret_profiled() instead, which
+ * counts every instruction as it is dispatched, see profile.h, and with
+ * VM_TRACING vm_interpret_traced(), which records it in a ring buffer,
+ * see trace.h. VM_RECORD() does either before every dispatch.
+ */
+#if defined(VM_THREADED_DISPATCH) && defined(__GNUC__)
+#define VM_USE_COMPUTED_GOTO
+#endif
+
+#ifdef VM_PROFILING
+#define VM_INTERPRET    vm_interpret_profiled
+#define VM_HANDLERS     vm_interpret_profiled_handlers
+#define VM_RECORD()     { hits[ip - prog->insts] ++;                    \
+                          if (stk->top >= max_depth) {                 \
+                              max_depth = stk->top + 1;                \
+                          } }
+#define VM_RECORD_TAKEN() taken[ip - prog->insts] ++
+#define VM_COLLECT()    vm_profile_collect(state->profile, prog, max_depth)
+#elif defined(VM_TRACING)
+#define VM_INTERPRET    vm_interpret_traced
+#define VM_HANDLERS     vm_interpret_traced_handlers
+#define VM_RECORD()     { vm_trace_record_t *rec;                      \
+                          rec = &ring[n_traced & ring_mask];           \
+                          rec->pc = ip->pc;                            \
+                          rec->op = ip->op;                            \
+                          rec->depth = (uint16_t)(stk->top + 1);       \
+                          rec->tos = stk->top < 0                      \
+                                     ? 0 : stk->elems[stk->top];       \
+                          *trace_n = ++ n_traced; }
+#define VM_RECORD_TAKEN()
+#define VM_COLLECT()
+#else
+#define VM_INTERPRET    vm_interpret
+#define VM_HANDLERS     vm_interpret_handlers
+#define VM_RECORD()
+#define VM_RECORD_TAKEN()
+#define VM_COLLECT()
+#endif
+
+#ifdef VM_USE_COMPUTED_GOTO
+#define get_dispatch_label_macro(symbol) [symbol] = &&do_##symbol
+#define VM_CASE(symbol) do_##symbol
+#define VM_DISPATCH()   { VM_RECORD(); goto *ip->handler; }
+#else
+#define VM_CASE(symbol) case symbol: do_##symbol
+#define VM_DISPATCH()   continue
+#endif
+
+/* Not wrapped in do { } while (0), a continue in there would not loop. */
+#define VM_NEXT()       { ip ++; VM_DISPATCH(); }
+#define VM_SKIP(n)      { ip += (n); VM_DISPATCH(); }
+#define VM_JUMP(index)  { ip = &prog->insts[index]; VM_DISPATCH(); }
+#define VM_ERROR()      goto error
+
+/**
+ * Write the state of a program that executed SNAP to state->snapshot_fn.
+ *
+ * @param  image           The image, with its data segment as it is now.
+ * @param  state           The state, with the bool flag up to date.
+ * @param  pc              Where to resume, after the SNAP.
+ *
+ * @return                 The error status.
+ */
+static status_t vm_take_snapshot (const vmc_image_t *image,
+                                  const vm_state_t *state, const uint32_t pc)
+{
+    vmc_state_t snap;
+
+    snap.pc = pc;
+    snap.bool_flag = state->bool_flag;
+    snap.input = state->input;
+    snap.depth = state->stack.top + 1;
+    memcpy(snap.stack, state->stack.elems, snap.depth * sizeof(int32_t));
+    return vm_write_snapshot(state->snapshot_fn, image, &snap);
+}
+
+#ifdef VM_USE_COMPUTED_GOTO
+/* Set by VM_INTERPRET(NULL, ...), label addresses only exist in there. */
+static const void *const *vm_dispatch_table = NULL;
+#endif
+
+/**
+ * The handler addresses a program must be decoded with to run on
+ * VM_INTERPRET().
+ *
+ * @return                 The table, NULL for switch dispatch.
+ */
+const void *const *VM_HANDLERS (void)
+{
+#ifdef VM_USE_COMPUTED_GOTO
+    VM_INTERPRET(NULL, NULL, 0, NULL);
+    return vm_dispatch_table;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Run a decoded program, starting from the given state.
+ *
+ * @param  prog            The program, decoded with VM_HANDLERS(). Only
+ *                         read, any number of runs may share it.
+ * @param  image           The image of this run. PUT writes to its data
+ *                         segment, or to the image itself if it has none,
+ *                         and the program is then decoded again if that
+ *                         rewrote its code.
+ * @param  show_stats      Print the superinstruction counts to stderr.
+ * @param  state           The stack, flag and pc to start from.
+ *
+ * @return                 FAILURE if the program hit a run time error.
+ */
+status_t VM_INTERPRET (const decoded_prog_t *prog, vmc_image_t *image,
+                       const int show_stats, vm_state_t *state)
+{
+    bytecode_t *compiled_code = NULL;
+    int32_t *data = NULL;
+    uint32_t data_words = 0;
+    decoded_prog_t own,
+                   fresh;
+    const decoded_inst_t *ip = NULL;
+    Stack *stk = NULL;
+    vm_out_t *out = NULL;
+    vm_in_t *in = NULL;
+    bool_flag_t bool_flag = FALSE;
+    int32_t target = 0;
+    int32_t address = 0,
+            source  = 0,
+            length  = 0;
+    uint32_t index = 0;
+    int next_pc = 0;
+    stack_elem_t stack_val = 0,
+                 *num1     = NULL,
+                 *num2     = NULL,
+                 *num3     = NULL;
+#ifdef VM_PROFILING
+    uint64_t *hits = NULL,
+             *taken = NULL;
+    int max_depth = 0;
+#endif
+#ifdef VM_TRACING
+    vm_trace_record_t *ring = NULL;
+    uint64_t ring_mask = 0;
+    volatile uint64_t *trace_n = NULL;
+    uint64_t n_traced = 0;
+#endif
+
+#ifdef VM_USE_COMPUTED_GOTO
+    static const void *const dispatch_table[N_OPS] = {
+        BYTECODE_DEF(get_dispatch_label_macro)
+        FUSED_DEF(get_dispatch_label_macro)
+    };
+    const void *const *handlers = dispatch_table;
+
+    if (prog == NULL) {
+        vm_dispatch_table = dispatch_table;
+        return SUCCESS;
+    }
+#else
+    const void *const *handlers = NULL;
+#endif
+
+    assert(prog != NULL);
+    compiled_code = image->code;
+    data = image->data;
+    data_words = image->data_len / 4;
+    stk = &state->stack;
+    out = state->out;
+    in = state->in;
+    bool_flag = state->bool_flag;
+#ifdef VM_TRACING
+    ring = state->trace->ring;
+    ring_mask = state->trace->mask;
+    trace_n = &state->trace->n;
+    n_traced = *trace_n;
+#endif
+
+#ifdef VM_PROFILING
+    if (vm_profile_start(state->profile, prog) == FAILURE) {
+        return FAILURE;
+    }
+    hits = state->profile->hits;
+    taken = state->profile->taken;
+#endif
+    if (show_stats) {
+        vm_print_fusion_stats(stderr, prog);
+    }
+    /* An image without instructions starts at its END sentinel. */
+    target = state->pc == prog->code_len ? prog->n_insts
+                                         : vm_decoded_index(prog, state->pc);
+    if (target < 0) {
+        fprintf(stderr, "\nError: cannot start at byte number %d", state->pc);
+        VM_ERROR();
+    }
+    ip = &prog->insts[target];
+
+#ifdef VM_USE_COMPUTED_GOTO
+    VM_DISPATCH();
+    {
+        {
+#else
+    while (1) {
+        VM_RECORD();
+        switch (ip->op) {
+#endif
+        VM_CASE(REAH):
+            vm_out_flush(out);
+            vm_in_read_hex(in, &state->input);
+            if (push(stk, state->input) == FAILURE) {
+                fprintf(stderr, "\nError: Stack overflow error."
+                        " in byte number %d, instruction REAH", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(READ):
+            vm_out_flush(out);
+            vm_in_read_dec(in, &state->input);
+            if (push(stk, state->input) == FAILURE) {
+                fprintf(stderr, "\nError: Stack overflow error."
+                        " in byte number %d, instruction READ", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(REAC):
+            vm_out_flush(out);
+            vm_in_read_char(in, (char *)&state->input);
+            if (push(stk, state->input) == FAILURE) {
+                fprintf(stderr, "\nError: Stack overflow error."
+                        " in byte number %d, instruction REAC", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(WRTH):
+            if (pop(stk, &stack_val) == SUCCESS) {
+                vm_out_hex(out, stack_val);
+            } else {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction WRTH", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(WRTD):
+            if (pop(stk, &stack_val) == SUCCESS) {
+                vm_out_dec(out, stack_val);
+            } else {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction WRTD", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(WRTC):
+            if (pop(stk, &stack_val) == SUCCESS) {
+                vm_out_char(out, stack_val);
+            } else {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction WRTC", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(ADD):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction ADD", ip->pc);
+                VM_ERROR();
+            } else {
+                *num2 = (*num1) + (*num2);
+                pop(stk, NULL);
+            }
+            VM_NEXT();
+
+        VM_CASE(SUB):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction SUB", ip->pc);
+                VM_ERROR();
+            } else {
+                *num2 = (*num1) - (*num2);
+                pop(stk, NULL);
+            }
+            VM_NEXT();
+
+        VM_CASE(MUL):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction MUL", ip->pc);
+                VM_ERROR();
+            } else {
+                *num2 = (*num1) * (*num2);
+                pop(stk, NULL);
+            }
+            VM_NEXT();
+
+        VM_CASE(DIV):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction DIV", ip->pc);
+                VM_ERROR();
+            } else {
+                stack_elem_t _num1, _num2;
+                _num1 = *num1;
+                _num2 = *num2;
+                *num1 = _num1 / _num2;
+                *num2 = _num1 % _num2;
+            }
+            VM_NEXT();
+
+        VM_CASE(POP):
+            if (pop(stk, NULL) == FAILURE) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction POP", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(EQU):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction EQU", ip->pc);
+                VM_ERROR();
+            } else {
+                if (*num1 == *num2) {
+                    bool_flag = TRUE;
+                } else {
+                    bool_flag = FALSE;
+                }
+            }
+            VM_NEXT();
+
+        VM_CASE(GRT):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction GRT", ip->pc);
+                VM_ERROR();
+            } else {
+                if (*num1 > *num2) {
+                    bool_flag = TRUE;
+                } else {
+                    bool_flag = FALSE;
+                }
+            }
+            VM_NEXT();
+
+        VM_CASE(LST):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction LST", ip->pc);
+                VM_ERROR();
+            } else {
+                if (*num1 < *num2) {
+                    bool_flag = TRUE;
+                } else {
+                    bool_flag = FALSE;
+                }
+            }
+            VM_NEXT();
+
+        VM_CASE(GOTO):
+            if (pop(stk, &stack_val) == FAILURE) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction GOTO", ip->pc);
+                VM_ERROR();
+            }
+            target = vm_decoded_index(prog, stack_val);
+            if (target < 0) {
+                fprintf(stderr, "\nError: GOTO instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            VM_JUMP(target);
+
+        VM_CASE(GOIF):
+            if (pop(stk, &stack_val) == FAILURE) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction GOIF", ip->pc);
+                VM_ERROR();
+            }
+            target = vm_decoded_index(prog, stack_val);
+            if (target < 0) {
+                fprintf(stderr, "\nError: GOIF instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            if (bool_flag == TRUE) {
+                VM_RECORD_TAKEN();
+                VM_JUMP(target);
+            }
+            VM_NEXT();
+
+        VM_CASE(GOUN):
+            if (pop(stk, &stack_val) == FAILURE) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction GOUN", ip->pc);
+                VM_ERROR();
+            }
+            target = vm_decoded_index(prog, stack_val);
+            if (target < 0) {
+                fprintf(stderr, "\nError: GOUN instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            if (bool_flag == FALSE) {
+                VM_RECORD_TAKEN();
+                VM_JUMP(target);
+            }
+            VM_NEXT();
+
+        VM_CASE(END):
+            state->bool_flag = bool_flag;
+            state->pc = ip->pc;
+            VM_COLLECT();
+            if (prog == &own) {
+                vm_free_decoded_program(&own);
+            }
+            return SUCCESS;
+
+        VM_CASE(DUP):
+            num1 = top(stk);
+            if (num1 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction DUP", ip->pc);
+                VM_ERROR();
+            } else if (push(stk, *num1) == FAILURE) {
+                fprintf(stderr, "\nError: Stack overflow error."
+                        " in byte number %d, instruction DUP", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(FLIP):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction FLIP", ip->pc);
+                VM_ERROR();
+            } else {
+                stack_val = *num1;
+                *num1 = *num2;
+                *num2 = stack_val;
+            }
+            VM_NEXT();
+
+        VM_CASE(PUSH):
+            if (push(stk, ip->arg) == FAILURE) {
+                fprintf(stderr, "\nError: Stack overflow error."
+                        " in byte number %d, instruction PUSH", ip->pc);
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(GET):
+            num1 = top(stk);
+            if (num1 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction GET", ip->pc);
+                VM_ERROR();
+            }
+            index = vm_data_index(*num1);
+            if (index < data_words) {
+                *num1 = data[index];
+                VM_NEXT();
+            }
+            /* Out of bounds, or an image without a data segment. */
+            address = vm_data_address(prog, *num1);
+            if (address < 0) {
+                fprintf(stderr, "\nError: GET instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            vm_get_integer_from_bytecode(&compiled_code[address], num1);
+            VM_NEXT();
+
+        VM_CASE(PUT):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction PUT", ip->pc);
+                VM_ERROR();
+            }
+            index = vm_data_index(*num1);
+            if (index < data_words) {
+                data[index] = *num2;
+                pop(stk, NULL);
+                pop(stk, NULL);
+                VM_NEXT();
+            }
+            address = vm_data_address(prog, *num1);
+            if (address < 0) {
+                fprintf(stderr, "\nError: PUT instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            vm_put_integer_to_bytecode(&compiled_code[address], *num2);
+            pop(stk, NULL);
+            pop(stk, NULL);
+            if (vm_hits_code(prog, address)) {
+                /*
+                 * The program rewrote its own code, decode it again for
+                 * the rest of this run and continue after the PUT.
+                 */
+                next_pc = ip->pc + 1;
+                if (vm_decode_program(&fresh, image, handlers, prog->fused,
+                                      state->snapshot_fn != NULL)
+                    == FAILURE) {
+                    VM_ERROR();
+                }
+                VM_COLLECT();
+                if (prog == &own) {
+                    vm_free_decoded_program(&own);
+                }
+                own = fresh;
+                prog = &own;
+#ifdef VM_PROFILING
+                if (vm_profile_start(state->profile, prog) == FAILURE) {
+                    ip = NULL;
+                    VM_ERROR();
+                }
+                hits = state->profile->hits;
+                taken = state->profile->taken;
+#endif
+                target = prog->index_of[next_pc];
+                if (target < 0) {
+                    fprintf(stderr, "\nError: PUT overwrote the instruction"
+                            " following byte number %d", next_pc - 1);
+                    VM_ERROR();
+                }
+                VM_JUMP(target);
+            }
+            VM_NEXT();
+
+        VM_CASE(READN):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction READN", ip->pc);
+                VM_ERROR();
+            }
+            address = vm_data_range(prog, *num1, *num2);
+            if (address < 0) {
+                fprintf(stderr, "\nError: READN instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            vm_out_flush(out);
+            *num2 = vm_in_read_words(in, &data[address], *num2);
+            pop(stk, NULL);
+            VM_NEXT();
+
+        VM_CASE(WRTS):
+            num1 = top(stk);
+            if (num1 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction WRTS", ip->pc);
+                VM_ERROR();
+            }
+            length = vm_data_string(prog, data, *num1);
+            if (length < 0) {
+                fprintf(stderr, "\nError: WRTS instruction given an address"
+                        " without a zero terminated string in the data"
+                        " segment in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            vm_out_words(out, &data[vm_data_index(*num1)], length);
+            pop(stk, NULL);
+            VM_NEXT();
+
+        VM_CASE(MCPY):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            num3 = peek(stk, 2);
+            if (num1 == NULL || num2 == NULL || num3 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction MCPY", ip->pc);
+                VM_ERROR();
+            }
+            address = vm_data_range(prog, *num1, *num2);
+            source = vm_data_range(prog, *num3, *num2);
+            if (address < 0 || source < 0) {
+                fprintf(stderr, "\nError: MCPY instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            memmove(&data[address], &data[source],
+                    (size_t)*num2 * sizeof(int32_t));
+            pop(stk, NULL);
+            pop(stk, NULL);
+            pop(stk, NULL);
+            VM_NEXT();
+
+        VM_CASE(MSET):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            num3 = peek(stk, 2);
+            if (num1 == NULL || num2 == NULL || num3 == NULL) {
+                fprintf(stderr, "\nError: Stack underflow error."
+                        " in byte number %d, instruction MSET", ip->pc);
+                VM_ERROR();
+            }
+            address = vm_data_range(prog, *num1, *num2);
+            if (address < 0) {
+                fprintf(stderr, "\nError: MSET instruction given"
+                        " out of bounds address in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            vm_data_fill(&data[address], *num2, *num3);
+            pop(stk, NULL);
+            pop(stk, NULL);
+            pop(stk, NULL);
+            VM_NEXT();
+
+        VM_CASE(SNAP):
+            if (data == NULL) {
+                fprintf(stderr, "\nError: SNAP needs a version 3 image"
+                        " in byte number %d", ip->pc);
+                VM_ERROR();
+            }
+            state->bool_flag = bool_flag;
+            if (vm_take_snapshot(image, state, ip->pc + 1) == FAILURE) {
+                VM_ERROR();
+            }
+            VM_NEXT();
+
+        VM_CASE(NOP):
+            VM_NEXT();
+
+        VM_CASE(PUSH_GOTO):
+            if (isFull(stk)) {
+                goto do_PUSH;
+            }
+            VM_JUMP(ip->target);
+
+        VM_CASE(PUSH_GOIF):
+            if (isFull(stk)) {
+                goto do_PUSH;
+            }
+            if (bool_flag == TRUE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(2);
+
+        VM_CASE(PUSH_GOUN):
+            if (isFull(stk)) {
+                goto do_PUSH;
+            }
+            if (bool_flag == FALSE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(2);
+
+        VM_CASE(PUSH_ADD):
+            num1 = top(stk);
+            if (num1 == NULL || isFull(stk)) {
+                goto do_PUSH;
+            }
+            *num1 += ip->arg;
+            VM_SKIP(2);
+
+        VM_CASE(DUP_WRTD):
+            num1 = top(stk);
+            if (num1 == NULL || isFull(stk)) {
+                goto do_DUP;
+            }
+            vm_out_dec(out, *num1);
+            VM_SKIP(2);
+
+        VM_CASE(EQU_PUSH_GOIF):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL || isFull(stk)) {
+                goto do_EQU;
+            }
+            bool_flag = (*num1 == *num2) ? TRUE : FALSE;
+            if (bool_flag == TRUE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(3);
+
+        VM_CASE(EQU_PUSH_GOUN):
+            num1 = peek(stk, 0);
+            num2 = peek(stk, 1);
+            if (num1 == NULL || num2 == NULL || isFull(stk)) {
+                goto do_EQU;
+            }
+            bool_flag = (*num1 == *num2) ? TRUE : FALSE;
+            if (bool_flag == FALSE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(3);
+
+        VM_CASE(ERR):
+        VM_CASE(LAB):
+        VM_CASE(IND):
+#ifndef VM_USE_COMPUTED_GOTO
+        default:
+#endif
+            fprintf(stderr, "\n Unexpected or invalid byte code at"
+                    " instruction %d .. exiting\n", ip->pc);
+            VM_ERROR();
+        }
+    }
+
+error:
+    state->bool_flag = bool_flag;
+    state->pc = ip ? ip->pc : state->pc;
+    VM_COLLECT();
+    if (prog == &own) {
+        vm_free_decoded_program(&own);
+    }
+    return FAILURE;
+}
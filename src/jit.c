@@ -0,0 +1,902 @@
+/**
+ * jit.c
+ * Purpose: Baseline template JIT. Every decoded instruction is translated
+ *          into a fixed x86-64 machine code template in an mmap'd buffer.
+ *
+ * Register assignment inside jitted code:
+ *
+ *   rbx   base of state->stack.elems
+ *   r12   state->stack.top (-1 when empty), kept sign extended
+ *   r13d  state->bool_flag
+ *   r14   state
+ *
+ * Jumps whose target is a constant (the fused PUSH &label GOTO/GOIF/GOUN
+ * superinstructions) are emitted as direct branches and patched once all
+ * code is laid out. Computed jumps look the target up in a byte offset to
+ * native address table. Whenever a template cannot continue (stack
+ * underflow or overflow, a bad jump target, an invalid opcode, or a PUT
+ * into the code segment), the jitted code stores the stack and flag back
+ * into the state and hands the program to the interpreter at the failing
+ * instruction. The interpreter then reports the error, or carries on, with
+ * exactly its usual behaviour.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "headers/jit.h"
+#include "headers/decode.h"
+#include "headers/constants.h"
+#include "headers/enums.h"
+#include "headers/stack.h"
+#include "headers/vm.h"
+#include "headers/vmio.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define VM_JIT_SUPPORTED
+#endif
+
+typedef int (*jit_entry_t) (vm_state_t *state, const void *native_pc);
+
+struct JIT_CODE {
+    uint8_t        *code;        /* The executable buffer.               */
+    size_t          size;
+    const uint8_t **native_of;   /* Byte offset -> native code, or NULL.  */
+    int             code_len;
+    jit_entry_t     entry;
+};
+
+#ifdef VM_JIT_SUPPORTED
+
+/* Upper bound on the size of a single template, slow path stub included. */
+#define JIT_MAX_TEMPLATE 128
+
+/* x86-64 register numbers. */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define ESI 6
+#define EDI 7
+
+/* Condition codes of the two byte jcc rel32 encoding (0F 8x). */
+#define CC_B   0x82
+#define CC_AE  0x83
+#define CC_Z   0x84
+#define CC_NZ  0x85
+#define CC_A   0x87
+#define CC_S   0x88
+#define CC_L   0x8C
+#define CC_GE  0x8D
+
+/* Condition codes of setcc (0F 9x). */
+#define SET_E  0x94
+#define SET_L  0x9C
+#define SET_G  0x9F
+
+/* Displacements of stack slots relative to the top of stack. */
+#define TOS     0
+#define SECOND -4
+#define THIRD  -8
+#define ABOVE   4
+
+struct JIT_PATCH {
+    size_t pos;     /* Offset of the rel32 to patch. */
+    int    index;   /* Instruction index it refers to. */
+};
+
+typedef struct JIT_PATCH jit_patch_t;
+
+struct JIT_ASM {
+    uint8_t     *buf;
+    size_t       len;
+    jit_patch_t *branches;     /* Jumps to the code of an instruction.    */
+    int          n_branches;
+    jit_patch_t *slow;         /* Jumps to the hand-off stub of an inst.  */
+    int          n_slow;
+    int          cur;          /* Instruction being translated.           */
+};
+
+typedef struct JIT_ASM jit_asm_t;
+
+#define EMIT(as, ...)                                               \
+    do {                                                            \
+        const uint8_t emit_bytes_[] = {__VA_ARGS__};                \
+        memcpy(&(as)->buf[(as)->len], emit_bytes_,                  \
+               sizeof(emit_bytes_));                                \
+        (as)->len += sizeof(emit_bytes_);                           \
+    } while (0)
+
+static void emit32 (jit_asm_t *as, const uint32_t value)
+{
+    memcpy(&as->buf[as->len], &value, sizeof(value));
+    as->len += sizeof(value);
+}
+
+static void emit64 (jit_asm_t *as, const uint64_t value)
+{
+    memcpy(&as->buf[as->len], &value, sizeof(value));
+    as->len += sizeof(value);
+}
+
+/**
+ * Emit "op reg, [rbx + r12 * 4 + disp]" (or the reverse direction,
+ * depending on op).
+ */
+static void emit_slot (jit_asm_t *as, const uint8_t op, const int reg,
+                       const int disp)
+{
+    EMIT(as, 0x42, op, 0x44 | (reg << 3), 0xA3, (uint8_t)disp);
+}
+
+/**
+ * Same as emit_slot() for two byte (0F xx) opcodes.
+ */
+static void emit_slot2 (jit_asm_t *as, const uint8_t op, const int reg,
+                        const int disp)
+{
+    EMIT(as, 0x42, 0x0F, op, 0x44 | (reg << 3), 0xA3, (uint8_t)disp);
+}
+
+static void emit_call (jit_asm_t *as, const void *fn)
+{
+    EMIT(as, 0x48, 0xB8);                   /* mov rax, imm64 */
+    emit64(as, (uint64_t)(uintptr_t)fn);
+    EMIT(as, 0xFF, 0xD0);                   /* call rax       */
+}
+
+/**
+ * Emit a conditional jump to the hand-off stub of the current instruction.
+ */
+static void emit_jcc_slow (jit_asm_t *as, const uint8_t cc)
+{
+    EMIT(as, 0x0F, cc);
+    as->slow[as->n_slow].pos = as->len;
+    as->slow[as->n_slow].index = as->cur;
+    as->n_slow++;
+    emit32(as, 0);
+}
+
+static void emit_jmp_slow (jit_asm_t *as)
+{
+    EMIT(as, 0xE9);
+    as->slow[as->n_slow].pos = as->len;
+    as->slow[as->n_slow].index = as->cur;
+    as->n_slow++;
+    emit32(as, 0);
+}
+
+static void emit_branch_patch (jit_asm_t *as, const int index)
+{
+    as->branches[as->n_branches].pos = as->len;
+    as->branches[as->n_branches].index = index;
+    as->n_branches++;
+    emit32(as, 0);
+}
+
+/**
+ * Emit a conditional jump to the code of instruction index.
+ */
+static void emit_jcc_to (jit_asm_t *as, const uint8_t cc, const int index)
+{
+    EMIT(as, 0x0F, cc);
+    emit_branch_patch(as, index);
+}
+
+static void emit_jmp_to (jit_asm_t *as, const int index)
+{
+    EMIT(as, 0xE9);
+    emit_branch_patch(as, index);
+}
+
+/**
+ * Hand off unless the stack holds at least n elements.
+ */
+static void emit_check_depth (jit_asm_t *as, const int n)
+{
+    EMIT(as, 0x49, 0x83, 0xFC, (uint8_t)(n - 1));   /* cmp r12, n - 1 */
+    emit_jcc_slow(as, CC_L);
+}
+
+/**
+ * Hand off unless there is room for one more element.
+ */
+static void emit_check_room (jit_asm_t *as)
+{
+    EMIT(as, 0x49, 0x81, 0xFC);                     /* cmp r12, MAX-1 */
+    emit32(as, MAX_STACK - 1);
+    emit_jcc_slow(as, CC_GE);
+}
+
+static void emit_inc_sp (jit_asm_t *as)
+{
+    EMIT(as, 0x49, 0xFF, 0xC4);                     /* inc r12 */
+}
+
+static void emit_dec_sp (jit_asm_t *as)
+{
+    EMIT(as, 0x49, 0xFF, 0xCC);                     /* dec r12 */
+}
+
+/**
+ * Compare the two topmost elements and set the flag with setcc.
+ */
+static void emit_compare (jit_asm_t *as, const uint8_t setcc)
+{
+    emit_slot(as, 0x8B, EAX, TOS);                  /* mov eax, [tos]    */
+    emit_slot(as, 0x3B, EAX, SECOND);               /* cmp eax, [second] */
+    EMIT(as, 0x0F, setcc, 0xC0);                    /* setcc al          */
+    EMIT(as, 0x44, 0x0F, 0xB6, 0xE8);               /* movzx r13d, al    */
+}
+
+static void emit_test_flag (jit_asm_t *as)
+{
+    EMIT(as, 0x45, 0x85, 0xED);                     /* test r13d, r13d */
+}
+
+/**
+ * Pop a byte offset and jump to it through the native_of table. The
+ * stack is left untouched when the target is invalid, so the interpreter
+ * can report the error. skip_cc is the condition under which the jump
+ * is not taken: CC_Z for GOIF, CC_NZ for GOUN, 0 for GOTO.
+ */
+static void emit_computed_jump (jit_asm_t *as, const jit_code_t *jit,
+                                const uint8_t skip_cc)
+{
+    emit_check_depth(as, 1);
+    emit_slot(as, 0x8B, EAX, TOS);                  /* mov eax, [tos]       */
+    EMIT(as, 0x3D);                                 /* cmp eax, code_len    */
+    emit32(as, (uint32_t)jit->code_len);
+    emit_jcc_slow(as, CC_AE);
+    EMIT(as, 0x48, 0xB9);                           /* mov rcx, native_of   */
+    emit64(as, (uint64_t)(uintptr_t)jit->native_of);
+    EMIT(as, 0x48, 0x8B, 0x0C, 0xC1);               /* mov rcx, [rcx+rax*8] */
+    EMIT(as, 0x48, 0x85, 0xC9);                     /* test rcx, rcx        */
+    emit_jcc_slow(as, CC_Z);
+    emit_dec_sp(as);
+    if (skip_cc) {
+        emit_test_flag(as);
+        EMIT(as, skip_cc - 0x10, 0x02);             /* jz/jnz rel8 +2       */
+    }
+    EMIT(as, 0xFF, 0xE1);                           /* jmp rcx              */
+}
+
+static void vm_jit_wrth (vm_state_t *state, const int value)
+{
+    vm_out_hex(state->out, value);
+}
+
+static void vm_jit_wrtd (vm_state_t *state, const int value)
+{
+    vm_out_dec(state->out, value);
+}
+
+static void vm_jit_wrtc (vm_state_t *state, const int value)
+{
+    vm_out_char(state->out, value);
+}
+
+static int vm_jit_reah (vm_state_t *state)
+{
+    vm_out_flush(state->out);
+    vm_in_read_hex(state->in, &state->input);
+    return state->input;
+}
+
+static int vm_jit_read (vm_state_t *state)
+{
+    vm_out_flush(state->out);
+    vm_in_read_dec(state->in, &state->input);
+    return state->input;
+}
+
+static int vm_jit_reac (vm_state_t *state)
+{
+    vm_out_flush(state->out);
+    vm_in_read_char(state->in, (char *)&state->input);
+    return state->input;
+}
+
+/**
+ * READN, or -1 without reading anything if the words do not fit in the
+ * data segment.
+ */
+static int vm_jit_readn (const decoded_prog_t *prog, const int32_t address,
+                         const int32_t n, vm_state_t *state)
+{
+    const int32_t index = vm_data_range(prog, address, n);
+
+    if (index < 0) {
+        return -1;
+    }
+    vm_out_flush(state->out);
+    return vm_in_read_words(state->in, &state->data[index], n);
+}
+
+/**
+ * WRTS, or -1 without writing anything if there is no zero terminated
+ * string at the address.
+ */
+static int vm_jit_wrts (const decoded_prog_t *prog, const int32_t address,
+                        vm_state_t *state)
+{
+    const int32_t length = vm_data_string(prog, state->data, address);
+
+    if (length < 0) {
+        return -1;
+    }
+    vm_out_words(state->out, &state->data[vm_data_index(address)], length);
+    return 0;
+}
+
+/**
+ * MCPY, or -1 without copying anything if either block is not in the
+ * data segment.
+ */
+static int vm_jit_mcpy (const decoded_prog_t *prog, const int32_t address,
+                        const int32_t n, const int32_t source,
+                        vm_state_t *state)
+{
+    const int32_t to = vm_data_range(prog, address, n),
+                  from = vm_data_range(prog, source, n);
+
+    if (to < 0 || from < 0) {
+        return -1;
+    }
+    memmove(&state->data[to], &state->data[from],
+            (size_t)n * sizeof(int32_t));
+    return 0;
+}
+
+/**
+ * MSET, or -1 without writing anything if the block is not in the data
+ * segment.
+ */
+static int vm_jit_mset (const decoded_prog_t *prog, const int32_t address,
+                        const int32_t n, const int32_t value,
+                        vm_state_t *state)
+{
+    const int32_t index = vm_data_range(prog, address, n);
+
+    if (index < 0) {
+        return -1;
+    }
+    vm_data_fill(&state->data[index], n, value);
+    return 0;
+}
+
+/**
+ * Load the operand of GET or PUT from the top of stack into rax as a word
+ * index in the data segment, see vm_data_index(), or as a byte offset in
+ * the image of an older program, handing off if it is out of bounds or
+ * unaligned.
+ */
+static void emit_data_address (jit_asm_t *as, const decoded_prog_t *prog)
+{
+    if (prog->has_data) {
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        EMIT(as, 0xC1, 0xC8, 0x02);                 /* ror eax, 2          */
+        EMIT(as, 0x3D);                             /* cmp eax, words      */
+        emit32(as, prog->data_words);
+        emit_jcc_slow(as, CC_AE);
+    } else if (prog->byte_addresses) {
+        emit_slot2(as, 0xB6, EAX, TOS);             /* movzx eax, byte [tos] */
+    } else if (prog->code_len < 4) {
+        emit_jmp_slow(as);
+    } else {
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        EMIT(as, 0x3D);                             /* cmp eax, len - 4    */
+        emit32(as, (uint32_t)(prog->code_len - 4));
+        emit_jcc_slow(as, CC_A);
+    }
+}
+
+static void emit_write (jit_asm_t *as, const void *fn)
+{
+    emit_check_depth(as, 1);
+    EMIT(as, 0x4C, 0x89, 0xF7);                     /* mov rdi, r14   */
+    emit_slot(as, 0x8B, ESI, TOS);                  /* mov esi, [tos] */
+    emit_dec_sp(as);
+    emit_call(as, fn);
+}
+
+static void emit_read (jit_asm_t *as, const void *fn)
+{
+    emit_check_room(as);
+    EMIT(as, 0x4C, 0x89, 0xF7);                     /* mov rdi, r14   */
+    emit_call(as, fn);
+    emit_inc_sp(as);
+    emit_slot(as, 0x89, EAX, TOS);                  /* mov [tos], eax */
+}
+
+/**
+ * Translate one decoded instruction.
+ *
+ * @param  as              The assembler state, as->cur is its index.
+ * @param  jit
+ * @param  prog
+ */
+static void vm_jit_emit_inst (jit_asm_t *as, const jit_code_t *jit,
+                              const decoded_prog_t *prog)
+{
+    const decoded_inst_t *inst = &prog->insts[as->cur];
+    /* GET and PUT address the data of the run, or its code without one. */
+    const uint32_t base = prog->has_data ? offsetof(vm_state_t, data)
+                                         : offsetof(vm_state_t, code);
+    const int i = as->cur;
+    int32_t lo = 0;
+
+    switch (inst->op) {
+    case REAH:
+        emit_read(as, (const void *)vm_jit_reah);
+        break;
+
+    case READ:
+        emit_read(as, (const void *)vm_jit_read);
+        break;
+
+    case REAC:
+        emit_read(as, (const void *)vm_jit_reac);
+        break;
+
+    case WRTH:
+        emit_write(as, (const void *)vm_jit_wrth);
+        break;
+
+    case WRTD:
+        emit_write(as, (const void *)vm_jit_wrtd);
+        break;
+
+    case WRTC:
+        emit_write(as, (const void *)vm_jit_wrtc);
+        break;
+
+    case ADD:
+        emit_check_depth(as, 2);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        emit_slot(as, 0x01, EAX, SECOND);           /* add [second], eax   */
+        emit_dec_sp(as);
+        break;
+
+    case SUB:
+        emit_check_depth(as, 2);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        emit_slot(as, 0x2B, EAX, SECOND);           /* sub eax, [second]   */
+        emit_slot(as, 0x89, EAX, SECOND);           /* mov [second], eax   */
+        emit_dec_sp(as);
+        break;
+
+    case MUL:
+        emit_check_depth(as, 2);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        emit_slot2(as, 0xAF, EAX, SECOND);          /* imul eax, [second]  */
+        emit_slot(as, 0x89, EAX, SECOND);           /* mov [second], eax   */
+        emit_dec_sp(as);
+        break;
+
+    case DIV:
+        emit_check_depth(as, 2);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        EMIT(as, 0x99);                             /* cdq                 */
+        emit_slot(as, 0xF7, 7, SECOND);             /* idiv [second]       */
+        emit_slot(as, 0x89, EAX, TOS);              /* mov [tos], eax      */
+        emit_slot(as, 0x89, EDX, SECOND);           /* mov [second], edx   */
+        break;
+
+    case POP:
+        emit_check_depth(as, 1);
+        emit_dec_sp(as);
+        break;
+
+    case EQU:
+        emit_check_depth(as, 2);
+        emit_compare(as, SET_E);
+        break;
+
+    case GRT:
+        emit_check_depth(as, 2);
+        emit_compare(as, SET_G);
+        break;
+
+    case LST:
+        emit_check_depth(as, 2);
+        emit_compare(as, SET_L);
+        break;
+
+    case GOTO:
+        emit_computed_jump(as, jit, 0);
+        break;
+
+    case GOIF:
+        emit_computed_jump(as, jit, CC_Z);
+        break;
+
+    case GOUN:
+        emit_computed_jump(as, jit, CC_NZ);
+        break;
+
+    case END:
+        EMIT(as, 0xBE);                             /* mov esi, pc         */
+        emit32(as, inst->pc);
+        EMIT(as, 0xB8);                             /* mov eax, VM_EXIT_END    */
+        emit32(as, VM_EXIT_END);
+        EMIT(as, 0xE9);                             /* jmp exit            */
+        as->slow[as->n_slow].pos = as->len;
+        as->slow[as->n_slow].index = -1;
+        as->n_slow++;
+        emit32(as, 0);
+        break;
+
+    case DUP:
+        emit_check_depth(as, 1);
+        emit_check_room(as);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        emit_slot(as, 0x89, EAX, ABOVE);            /* mov [tos + 4], eax  */
+        emit_inc_sp(as);
+        break;
+
+    case FLIP:
+        emit_check_depth(as, 2);
+        emit_slot(as, 0x8B, EAX, TOS);              /* mov eax, [tos]      */
+        emit_slot(as, 0x8B, ECX, SECOND);           /* mov ecx, [second]   */
+        emit_slot(as, 0x89, ECX, TOS);              /* mov [tos], ecx      */
+        emit_slot(as, 0x89, EAX, SECOND);           /* mov [second], eax   */
+        break;
+
+    case PUSH:
+        emit_check_room(as);
+        emit_inc_sp(as);
+        emit_slot(as, 0xC7, 0, TOS);                /* mov dword [tos], k  */
+        emit32(as, (uint32_t)inst->arg);
+        break;
+
+    case GET:
+        emit_check_depth(as, 1);
+        emit_data_address(as, prog);
+        EMIT(as, 0x49, 0x8B, 0x8E);                 /* mov rcx, [r14+base] */
+        emit32(as, base);
+        /* mov eax, [rcx+rax*4] or [rcx+rax] */
+        EMIT(as, 0x8B, 0x04, prog->has_data ? 0x81 : 0x01);
+        emit_slot(as, 0x89, EAX, TOS);              /* mov [tos], eax      */
+        break;
+
+    case PUT:
+        /* Writes overlapping the code segment are left to the interpreter,
+         * which decodes the program again. */
+        lo = prog->code_start - 3;
+        emit_check_depth(as, 2);
+        emit_data_address(as, prog);
+        if (!prog->has_data) {
+            EMIT(as, 0x89, 0xC1);                   /* mov ecx, eax        */
+            EMIT(as, 0x81, 0xE9);                   /* sub ecx, lo         */
+            emit32(as, (uint32_t)lo);
+            EMIT(as, 0x81, 0xF9);                   /* cmp ecx, len - lo   */
+            emit32(as, (uint32_t)(prog->code_len - lo));
+            emit_jcc_slow(as, CC_B);
+        }
+        emit_slot(as, 0x8B, ECX, SECOND);           /* mov ecx, [second]   */
+        EMIT(as, 0x49, 0x8B, 0x96);                 /* mov rdx, [r14+base] */
+        emit32(as, base);
+        /* mov [rdx+rax*4], ecx or [rdx+rax], ecx */
+        EMIT(as, 0x89, 0x0C, prog->has_data ? 0x82 : 0x02);
+        EMIT(as, 0x49, 0x83, 0xEC, 0x02);           /* sub r12, 2          */
+        break;
+
+    case READN:
+        emit_check_depth(as, 2);
+        EMIT(as, 0x48, 0xBF);                       /* mov rdi, prog       */
+        emit64(as, (uint64_t)(uintptr_t)prog);
+        emit_slot(as, 0x8B, ESI, TOS);              /* mov esi, [tos]      */
+        emit_slot(as, 0x8B, EDX, SECOND);           /* mov edx, [second]   */
+        EMIT(as, 0x4C, 0x89, 0xF1);                 /* mov rcx, r14        */
+        emit_call(as, (const void *)vm_jit_readn);
+        EMIT(as, 0x85, 0xC0);                       /* test eax, eax       */
+        emit_jcc_slow(as, CC_S);
+        emit_dec_sp(as);
+        emit_slot(as, 0x89, EAX, TOS);              /* mov [tos], eax      */
+        break;
+
+    case WRTS:
+        emit_check_depth(as, 1);
+        EMIT(as, 0x48, 0xBF);                       /* mov rdi, prog       */
+        emit64(as, (uint64_t)(uintptr_t)prog);
+        emit_slot(as, 0x8B, ESI, TOS);              /* mov esi, [tos]      */
+        EMIT(as, 0x4C, 0x89, 0xF2);                 /* mov rdx, r14        */
+        emit_call(as, (const void *)vm_jit_wrts);
+        EMIT(as, 0x85, 0xC0);                       /* test eax, eax       */
+        emit_jcc_slow(as, CC_S);
+        emit_dec_sp(as);
+        break;
+
+    case MCPY:
+    case MSET:
+        emit_check_depth(as, 3);
+        EMIT(as, 0x48, 0xBF);                       /* mov rdi, prog       */
+        emit64(as, (uint64_t)(uintptr_t)prog);
+        emit_slot(as, 0x8B, ESI, TOS);              /* mov esi, [tos]      */
+        emit_slot(as, 0x8B, EDX, SECOND);           /* mov edx, [second]   */
+        emit_slot(as, 0x8B, ECX, THIRD);            /* mov ecx, [third]    */
+        EMIT(as, 0x4D, 0x89, 0xF0);                 /* mov r8, r14         */
+        emit_call(as, inst->op == MCPY ? (const void *)vm_jit_mcpy
+                                       : (const void *)vm_jit_mset);
+        EMIT(as, 0x85, 0xC0);                       /* test eax, eax       */
+        emit_jcc_slow(as, CC_S);
+        EMIT(as, 0x49, 0x83, 0xEC, 0x03);           /* sub r12, 3          */
+        break;
+
+    case NOP:
+        break;
+
+    case PUSH_GOTO:
+        emit_check_room(as);
+        emit_jmp_to(as, inst->target);
+        break;
+
+    case PUSH_GOIF:
+        emit_check_room(as);
+        emit_test_flag(as);
+        emit_jcc_to(as, CC_NZ, inst->target);
+        emit_jmp_to(as, i + 2);
+        break;
+
+    case PUSH_GOUN:
+        emit_check_room(as);
+        emit_test_flag(as);
+        emit_jcc_to(as, CC_Z, inst->target);
+        emit_jmp_to(as, i + 2);
+        break;
+
+    case PUSH_ADD:
+        emit_check_depth(as, 1);
+        emit_check_room(as);
+        emit_slot(as, 0x81, 0, TOS);                /* add dword [tos], k  */
+        emit32(as, (uint32_t)inst->arg);
+        emit_jmp_to(as, i + 2);
+        break;
+
+    case DUP_WRTD:
+        emit_check_depth(as, 1);
+        emit_check_room(as);
+        EMIT(as, 0x4C, 0x89, 0xF7);                 /* mov rdi, r14        */
+        emit_slot(as, 0x8B, ESI, TOS);              /* mov esi, [tos]      */
+        emit_call(as, (const void *)vm_jit_wrtd);
+        emit_jmp_to(as, i + 2);
+        break;
+
+    case EQU_PUSH_GOIF:
+        emit_check_depth(as, 2);
+        emit_check_room(as);
+        emit_compare(as, SET_E);
+        emit_test_flag(as);
+        emit_jcc_to(as, CC_NZ, inst->target);
+        emit_jmp_to(as, i + 3);
+        break;
+
+    case EQU_PUSH_GOUN:
+        emit_check_depth(as, 2);
+        emit_check_room(as);
+        emit_compare(as, SET_E);
+        emit_test_flag(as);
+        emit_jcc_to(as, CC_Z, inst->target);
+        emit_jmp_to(as, i + 3);
+        break;
+
+    default:
+        /* ERR and friends, let the interpreter report them. */
+        emit_jmp_slow(as);
+        break;
+    }
+}
+
+static void patch_rel32 (uint8_t *buf, const size_t pos, const size_t dest)
+{
+    const int32_t rel = (int32_t)((int64_t)dest - (int64_t)(pos + 4));
+    memcpy(&buf[pos], &rel, sizeof(rel));
+}
+
+/**
+ * Translate a decoded program to native code.
+ *
+ * @param[out]  jit             The translated program.
+ * @param[in]   prog            The decoded program, superinstructions
+ *                              included. It must outlive the jitted
+ *                              code, which runs on the data and code of
+ *                              whichever state it is given.
+ *
+ * @return                      FAILURE if the JIT is not available or
+ *                              out of memory.
+ */
+status_t vm_jit_compile (jit_code_t **jit, const decoded_prog_t *prog)
+{
+    const int n = prog->n_insts + 1;   /* END sentinel included. */
+    const size_t state_top = offsetof(vm_state_t, stack) +
+                             offsetof(Stack, top);
+    const size_t state_elems = offsetof(vm_state_t, stack) +
+                               offsetof(Stack, elems);
+    jit_asm_t as;
+    jit_code_t *code = NULL;
+    size_t *native_at = NULL,
+           *stub_at   = NULL,
+           exit_pos   = 0;
+    int i = 0;
+
+    assert(jit != NULL);
+    assert(prog != NULL);
+
+    *jit = NULL;
+    memset(&as, 0, sizeof(as));
+    code = (jit_code_t *)calloc(1, sizeof(jit_code_t));
+    native_at = (size_t *)malloc(n * sizeof(size_t));
+    stub_at = (size_t *)malloc(n * sizeof(size_t));
+    as.branches = (jit_patch_t *)malloc(2 * n * sizeof(jit_patch_t));
+    as.slow = (jit_patch_t *)malloc(4 * n * sizeof(jit_patch_t));
+    if (code == NULL || native_at == NULL || stub_at == NULL ||
+        as.branches == NULL || as.slow == NULL) {
+        goto fail;
+    }
+    code->code_len = prog->code_len;
+    code->native_of = (const uint8_t **)calloc(prog->code_len + 1,
+                                               sizeof(uint8_t *));
+    code->size = (size_t)n * JIT_MAX_TEMPLATE + 4096;
+    code->code = mmap(NULL, code->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code->native_of == NULL || code->code == MAP_FAILED) {
+        code->code = NULL;
+        goto fail;
+    }
+    as.buf = code->code;
+
+    /* Entry: int entry (vm_state_t *state, const void *native_pc) */
+    EMIT(&as, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55,  /* push rbx, rbp, r12  */
+              0x41, 0x56, 0x41, 0x57);              /* push r13, r14, r15  */
+    EMIT(&as, 0x48, 0x83, 0xEC, 0x08);              /* sub rsp, 8          */
+    EMIT(&as, 0x49, 0x89, 0xFE);                    /* mov r14, rdi        */
+    EMIT(&as, 0x49, 0x8D, 0x9E);                    /* lea rbx, [r14+elems] */
+    emit32(&as, (uint32_t)state_elems);
+    EMIT(&as, 0x4D, 0x63, 0xA6);                    /* movsxd r12, [r14+top] */
+    emit32(&as, (uint32_t)state_top);
+    EMIT(&as, 0x45, 0x8B, 0xAE);                    /* mov r13d, [r14+flag] */
+    emit32(&as, (uint32_t)offsetof(vm_state_t, bool_flag));
+    EMIT(&as, 0xFF, 0xE6);                          /* jmp rsi             */
+
+    /* Exit: status in eax, byte offset to resume at in esi. */
+    exit_pos = as.len;
+    EMIT(&as, 0x41, 0x89, 0xB6);                    /* mov [r14+pc], esi   */
+    emit32(&as, (uint32_t)offsetof(vm_state_t, pc));
+    EMIT(&as, 0x45, 0x89, 0xA6);                    /* mov [r14+top], r12d */
+    emit32(&as, (uint32_t)state_top);
+    EMIT(&as, 0x45, 0x89, 0xAE);                    /* mov [r14+flag], r13d */
+    emit32(&as, (uint32_t)offsetof(vm_state_t, bool_flag));
+    EMIT(&as, 0x48, 0x83, 0xC4, 0x08);              /* add rsp, 8          */
+    EMIT(&as, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D,  /* pop r15, r14, r13   */
+              0x41, 0x5C, 0x5D, 0x5B, 0xC3);        /* pop r12, rbp, rbx, ret */
+
+    for (i = 0; i < n; i ++) {
+        int first_slow = as.n_slow;
+
+        as.cur = i;
+        native_at[i] = as.len;
+        vm_jit_emit_inst(&as, code, prog);
+
+        /* Hand-off stub, out of line behind a jump over it. */
+        stub_at[i] = 0;
+        if (as.n_slow > first_slow && as.slow[first_slow].index == i) {
+            EMIT(&as, 0xEB, 15);                    /* jmp short over stub */
+            stub_at[i] = as.len;
+            EMIT(&as, 0xBE);                        /* mov esi, pc         */
+            emit32(&as, prog->insts[i].pc);
+            EMIT(&as, 0xB8);                        /* mov eax, HANDOFF    */
+            emit32(&as, VM_EXIT_HANDOFF);
+            EMIT(&as, 0xE9);                        /* jmp exit            */
+            patch_rel32(as.buf, as.len, exit_pos);
+            as.len += 4;
+        }
+        assert(as.len - native_at[i] <= JIT_MAX_TEMPLATE);
+    }
+
+    for (i = 0; i < as.n_slow; i ++) {
+        const jit_patch_t *patch = &as.slow[i];
+        patch_rel32(as.buf, patch->pos,
+                    patch->index < 0 ? exit_pos : stub_at[patch->index]);
+    }
+    for (i = 0; i < as.n_branches; i ++) {
+        const jit_patch_t *patch = &as.branches[i];
+        assert(patch->index >= 0 && patch->index < n);
+        patch_rel32(as.buf, patch->pos, native_at[patch->index]);
+    }
+    for (i = 0; i < prog->code_len; i ++) {
+        const int32_t index = prog->index_of[i];
+        code->native_of[i] = index < 0 ? NULL : &code->code[native_at[index]];
+    }
+
+    if (mprotect(code->code, code->size, PROT_READ | PROT_EXEC) != 0) {
+        goto fail;
+    }
+    code->entry = (jit_entry_t)(uintptr_t)code->code;
+
+    free(native_at);
+    free(stub_at);
+    free(as.branches);
+    free(as.slow);
+    *jit = code;
+    return SUCCESS;
+
+fail:
+    fprintf(stderr, "\nError: JIT could not allocate memory");
+    free(native_at);
+    free(stub_at);
+    free(as.branches);
+    free(as.slow);
+    vm_jit_free(code);
+    return FAILURE;
+}
+
+/**
+ * Run jitted code from state->pc until END or a hand-off.
+ *
+ * @param  jit
+ * @param  state   The stack, flag and pc to start from. Updated on return.
+ *
+ * @return         VM_EXIT_END, or VM_EXIT_HANDOFF if the interpreter must go on
+ *                 from state->pc.
+ */
+vm_exit_t vm_jit_run (const jit_code_t *jit, vm_state_t *state)
+{
+    const uint8_t *native_pc = NULL;
+
+    assert(jit != NULL);
+    assert(state != NULL);
+
+    if ((unsigned int)state->pc < (unsigned int)jit->code_len) {
+        native_pc = jit->native_of[state->pc];
+    }
+    if (native_pc == NULL) {
+        return VM_EXIT_HANDOFF;
+    }
+    return (vm_exit_t)jit->entry(state, native_pc);
+}
+
+/**
+ * Release jitted code.
+ *
+ * @param  jit     May be NULL.
+ */
+void vm_jit_free (jit_code_t *jit)
+{
+    if (jit == NULL) {
+        return;
+    }
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->size);
+    }
+    free(jit->native_of);
+    free(jit);
+}
+
+#else
+
+status_t vm_jit_compile (jit_code_t **jit, const decoded_prog_t *prog)
+{
+    assert(jit != NULL);
+    *jit = NULL;
+    fprintf(stderr, "\nWarning: JIT not supported on this platform,"
+            " interpreting instead.\n");
+    return FAILURE;
+}
+
+vm_exit_t vm_jit_run (const jit_code_t *jit, vm_state_t *state)
+{
+    return VM_EXIT_HANDOFF;
+}
+
+void vm_jit_free (jit_code_t *jit)
+{
+}
+
+#endif
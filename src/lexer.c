@@ -6,116 +6,210 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
-#include <malloc.h>
 
 #include "headers/lexer.h"
 #include "headers/enums.h"
 #include "headers/constants.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define VM_LEX_MMAP_SUPPORTED
+#endif
+
+/* Offsets of tokens are 32 bit. */
+#define VM_MAX_SOURCE_LEN  0xffffffffu
+
 /**
- * Initialize a token_t node with string token, line number and a NULL next_tk
- * pointer.
- *
- * @param[out]   tk_node     A pointer to the token_t pointer to be initialized.
- * @param[in]    token       The token string.
- * @param[in]    line_num    The line number.
+ * Whether a character separates tokens. NUL does too, so a token never
+ * holds one.
+ */
+static inline int vm_is_space (const char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\0' ||
+           c == '\v' || c == '\f';
+}
+
+/**
+ * Read a whole file into memory, for files that cannot be mapped.
  *
- * @return                   The error status.
+ * @return  The error status.
  */
-static status_t vm_init_token_node (token_t **tk_node, const char *token, 
-                                    const unsigned int line_num) {
-    assert(token != NULL);
-    assert(tk_node != NULL);
-
-    *tk_node = (token_t *)malloc(sizeof(token_t));
-    token_t *node = *tk_node;
-    if (node == NULL) {
+static status_t vm_read_source (vm_source_t *src, const char *fn)
+{
+    FILE *fp = NULL;
+    char *text = NULL;
+    size_t len = 0,
+           capacity = 0,
+           n = 0;
+
+    fp = fopen(fn, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", fn);
+        return FAILURE;
+    }
+    do {
+        if (len == capacity) {
+            char *grown = NULL;
+
+            capacity = capacity ? 2 * capacity : 65536;
+            grown = (char *)realloc(text, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "\nError: Not enough memory for malloc");
+                free(text);
+                fclose(fp);
+                return FAILURE;
+            }
+            text = grown;
+        }
+        n = fread(text + len, 1, capacity - len, fp);
+        len += n;
+    } while (n > 0);
+    if (ferror(fp)) {
+        fprintf(stderr, "\nERROR: could not read file %s\n", fn);
+        free(text);
+        fclose(fp);
         return FAILURE;
     }
-    
-    strncpy(node->token, token, MAX_LINE_LEN - 1);
-    node->line_num = line_num;
-    node->next_tk = NULL;
+    fclose(fp);
+    src->text = text;
+    src->len = len;
+    src->mapped = 0;
     return SUCCESS;
 }
 
 /**
- * Gets a table of token_t's from a file.
+ * Map a source file, or read it if it cannot be mapped, ready for
+ * vm_next_token().
  *
- * @param[in]   fp        The file pointer of the file to be lexed.
- * @param[out]  tok_list  A pointer to the head of the token list.
- * @param[out]  tt_len    The token table length.
+ * @param[out]  src       The text, free with vm_free_source().
+ * @param[in]   fn        The file to be lexed.
  *
  * @return                The error status.
  */
-status_t vm_get_token_list (FILE *fp, token_t **tok_list)
+status_t vm_open_source (vm_source_t *src, const char *fn)
 {
-    assert(fp != NULL);
-    assert(tok_list != NULL);
-
-    char line[MAX_LINE_LEN],
-        *line_ptr =   NULL,
-        *checkpoint = NULL,
-        *token =      NULL;
+    status_t rc = FAILURE;
 
-    const char delim[] = " \n";
+    assert(src != NULL);
+    assert(fn != NULL);
 
-    unsigned int line_num  = 0,
-                 tok_len   = 0;
+    memset(src, 0, sizeof(vm_source_t));
+    src->line_num = 1;
+#ifdef VM_LEX_MMAP_SUPPORTED
+    struct stat st;
+    void *mapping = NULL;
+    int fd = -1;
 
-    token_t *next_tk  = NULL,
-            *prev_tk  = NULL;
-
-    vm_init_token_node(tok_list, "Dummy", 0);
-    prev_tk = *tok_list;
-    
-    if (fgets(line, MAX_LINE_LEN, fp) == NULL) {
-        return SUCCESS;
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", fn);
+        return FAILURE;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        rc = vm_read_source(src, fn);
+    } else {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            rc = vm_read_source(src, fn);
+        } else {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            src->text = (const char *)mapping;
+            src->len = st.st_size;
+            src->mapped = 1;
+            rc = SUCCESS;
+        }
+    }
+#else
+    rc = vm_read_source(src, fn);
+#endif
+    if (rc == SUCCESS && src->len > VM_MAX_SOURCE_LEN) {
+        fprintf(stderr, "\nERROR: %s is larger than %u bytes\n", fn,
+                VM_MAX_SOURCE_LEN);
+        vm_free_source(src);
+        return FAILURE;
     }
+    return rc;
+}
 
-    do {
-        line_num++;
-        line_ptr = line;
-        while ( (token = strtok_r(line_ptr, delim, &checkpoint)) != NULL) {
-            line_ptr = NULL;
-            tok_len = strlen(token);
-            if (tok_len == 0) {
-                continue;
+/**
+ * Read the next token of a source.
+ *
+ * @param[in,out]  src
+ * @param[out]     tok
+ *
+ * @return         1 if there was a token, 0 at the end of the source.
+ */
+int vm_next_token (vm_source_t *src, token_t *tok)
+{
+    const char *text = src->text;
+    const size_t len = src->len;
+    size_t i = src->pos,
+           start = 0;
+
+    while (i < len) {
+        if (text[i] == '\n') {
+            src->line_num ++;
+            i ++;
+        } else if (vm_is_space(text[i])) {
+            i ++;
+        } else if (text[i] == '#') {
+            while (i < len && text[i] != '\n') {
+                i ++;
             }
-            if (token[0] == '#') {
-                break;
+        } else {
+            start = i;
+            while (i < len && !vm_is_space(text[i])) {
+                i ++;
             }
-            vm_init_token_node(&next_tk, token, line_num);
-            prev_tk->next_tk = next_tk;
-            prev_tk = next_tk;
+            tok->offset = (uint32_t)start;
+            tok->len = (uint32_t)(i - start);
+            tok->line_num = src->line_num;
+            src->pos = i;
+            return 1;
         }
-    } while (fgets(line, MAX_LINE_LEN, fp) != NULL);
-
-    return SUCCESS;
+    }
+    src->pos = i;
+    return 0;
 }
 
 /**
- * Free the token list.
- *
- * @param  token_list
+ * Go back to the first token of a source.
  *
- * @return               The error status.
+ * @param  src
  */
-status_t vm_free_token_list (token_t *tok_list)
+void vm_rewind_source (vm_source_t *src)
 {
-    token_t *prev_tk = NULL,
-            *next_tk = NULL;
+    assert(src != NULL);
 
-    prev_tk = tok_list;
-    next_tk = NULL;
+    src->pos = 0;
+    src->line_num = 1;
+}
 
-    while (prev_tk) {
-        next_tk = prev_tk->next_tk;
-        free(prev_tk);
-        prev_tk = next_tk;
-    }
+/**
+ * Free the text of a source.
+ *
+ * @param  src
+ */
+void vm_free_source (vm_source_t *src)
+{
+    assert(src != NULL);
 
-    return SUCCESS;
+#ifdef VM_LEX_MMAP_SUPPORTED
+    if (src->mapped) {
+        munmap((void *)src->text, src->len);
+    } else {
+        free((void *)src->text);
+    }
+#else
+    free((void *)src->text);
+#endif
+    memset(src, 0, sizeof(vm_source_t));
 }
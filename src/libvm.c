@@ -0,0 +1,556 @@
+/**
+ * libvm.c
+ * Purpose: Run .vmc programs from inside another program.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "headers/constants.h"
+#include "headers/stack.h"
+#include "headers/decode.h"
+#include "headers/interp.h"
+#include "headers/libvm.h"
+#include "headers/vm.h"
+#include "headers/vmio.h"
+#include "headers/jit.h"
+#include "headers/regvm.h"
+#include "headers/unchecked.h"
+#include "headers/verify.h"
+#include "headers/vmc.h"
+#include "headers/enums.h"
+
+/*
+ * The program of an image, decoded and jitted once for every run of it.
+ * Runs only read it, so VMs sharing the image share it too.
+ */
+struct VM_CODE {
+    decoded_prog_t interp;      /* For the interpreter build that runs. */
+    decoded_prog_t engine;      /* For the JIT, the register engine or
+                                 * vm_run_unchecked(), if has_engine.   */
+    int            has_engine;
+    jit_code_t    *jit;         /* NULL if the JIT is not used or not
+                                 * available.                           */
+};
+
+typedef struct VM_CODE vm_code_t;
+
+struct VM {
+    vm_options_t options;
+    vmc_image_t  image;
+    int          loaded;
+    int          shared;  /* The image belongs to another vm_t.         */
+    int          verified; /* vm_verify_program() proved it safe.       */
+    vm_code_t   *code;
+    int          shared_code; /* code belongs to another vm_t.         */
+    reg_prog_t  *reg;     /* Blocks are translated as runs enter them,
+                           * so every VM has its own.                  */
+    vmc_image_t  run;     /* What a run executes: the image, with fresh */
+    vm_state_t   state;   /* copies of everything PUT can write to.     */
+    vm_out_t     out;
+    vm_in_t      in;
+};
+
+static const vm_io_t VM_STDIO = {vm_stdin_read, vm_stdout_write, NULL,
+                                 NULL, 0};
+
+/**
+ * The options the vm command runs with when given none: the interpreter,
+ * with superinstructions, mapped images and buffered output.
+ *
+ * @param[out]  options
+ */
+void vm_default_options (vm_options_t *options)
+{
+    assert(options != NULL);
+
+    options->engine = VM_ENGINE_INTERP;
+    options->fuse = 1;
+    options->use_mmap = 1;
+    options->unbuffered = 0;
+    options->show_stats = 0;
+    options->verify = 1;
+    options->snapshot_fn = NULL;
+    options->profile = NULL;
+    options->trace = NULL;
+}
+
+/**
+ * Create a VM with no program loaded.
+ *
+ * @param[out]  vm
+ * @param[in]   options    NULL for vm_default_options().
+ *
+ * @return      FAILURE if out of memory.
+ */
+status_t vm_create (vm_t **vm, const vm_options_t *options)
+{
+    assert(vm != NULL);
+
+    *vm = (vm_t *)calloc(1, sizeof(vm_t));
+    if (*vm == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    if (options != NULL) {
+        (*vm)->options = *options;
+    } else {
+        vm_default_options(&(*vm)->options);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Free the decoded and jitted program of an image.
+ *
+ * @param  code            May be NULL.
+ */
+static void vm_free_code (vm_code_t *code)
+{
+    if (code != NULL) {
+        vm_jit_free(code->jit);
+        if (code->has_engine) {
+            vm_free_decoded_program(&code->engine);
+        }
+        vm_free_decoded_program(&code->interp);
+        free(code);
+    }
+}
+
+/**
+ * Free the program loaded in a VM, if any.
+ */
+static void vm_unload_image (vm_t *vm)
+{
+    vm_reg_free(vm->reg);
+    vm->reg = NULL;
+    if (!vm->shared_code) {
+        vm_free_code(vm->code);
+    }
+    vm->code = NULL;
+    vm->shared_code = 0;
+    if (vm->loaded) {
+        if (vm->image.data != NULL) {
+            free(vm->run.data);
+        } else {
+            free(vm->run.code);
+        }
+        if (!vm->shared) {
+            vm_free_image(&vm->image);
+        }
+        memset(&vm->image, 0, sizeof(vmc_image_t));
+        memset(&vm->run, 0, sizeof(vmc_image_t));
+        vm->loaded = 0;
+        vm->shared = 0;
+        vm->verified = 0;
+    }
+}
+
+/**
+ * Set up what a run of vm->image executes. Code is only ever written in
+ * older images, with no data segment, so only that gets a copy of its
+ * own, with the zero padding of vm_image_code_size(). A v3 data segment
+ * always has room for at least one word.
+ *
+ * @return                 FAILURE if out of memory.
+ */
+static status_t vm_alloc_run (vm_t *vm)
+{
+    void *copy = NULL;
+
+    vm->run = vm->image;
+    if (vm->image.data != NULL) {
+        vm->run.data = (int32_t *)malloc(vm->image.data_len + 4);
+        copy = vm->run.data;
+    } else {
+        vm->run.code = (bytecode_t *)malloc(
+                vm_image_code_size(&vm->image) + 1);
+        copy = vm->run.code;
+    }
+    if (copy == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        memset(&vm->run, 0, sizeof(vmc_image_t));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Verify a loaded image from where its runs start, see verify.h.
+ *
+ * @param  vm
+ * @param  fn              The .vmc file, for messages.
+ *
+ * @return                 FAILURE if the image is invalid or out of
+ *                         memory.
+ */
+static status_t vm_verify_image (vm_t *vm, const char *fn)
+{
+    const vmc_state_t *saved = vm->image.state;
+    decoded_prog_t prog;
+    vm_verify_result_t result;
+    status_t rc = FAILURE;
+
+    /* Superinstructions only run what their instructions would. */
+    if (vm_decode_program(&prog, &vm->image, NULL, 0,
+                          vm->options.snapshot_fn != NULL) == FAILURE) {
+        return FAILURE;
+    }
+    rc = vm_verify_program(&prog,
+                           saved ? saved->pc : vm->image.code_start,
+                           saved ? (int)saved->depth : 0, &result);
+    vm_free_decoded_program(&prog);
+    if (rc == FAILURE) {
+        return FAILURE;
+    }
+    if (result.verdict == VM_INVALID) {
+        fprintf(stderr, "\nERROR: %s failed verification: %s in byte"
+                " number %u\n", fn, result.reason, result.pc);
+        return FAILURE;
+    }
+    vm->verified = result.verdict == VM_VERIFIED;
+    if (vm->options.show_stats && vm->verified) {
+        fprintf(stderr, "verified: %d instructions reached, stack depth"
+                " at most %d\n", result.reached, result.max_depth);
+    } else if (vm->options.show_stats) {
+        fprintf(stderr, "not verified: %s in byte number %u\n",
+                result.reason, result.pc);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Decode, and jit, the loaded image for the engine its runs start on, and
+ * for the interpreter the others hand it over to.
+ *
+ * @param  vm
+ *
+ * @return                 FAILURE if out of memory.
+ */
+static status_t vm_prepare_code (vm_t *vm)
+{
+    const vm_options_t *options = &vm->options;
+    const int snap = options->snapshot_fn != NULL;
+    const void *const *handlers = NULL;
+    vm_code_t *code = NULL;
+    int fuse = options->fuse;
+
+    code = (vm_code_t *)calloc(1, sizeof(vm_code_t));
+    if (code == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    if (options->profile != NULL) {
+        /* Count every instruction on its own, so the counts are exact. */
+        handlers = vm_interpret_profiled_handlers();
+        fuse = 0;
+    } else if (options->trace != NULL) {
+        handlers = vm_interpret_traced_handlers();
+    } else {
+        handlers = vm_interpret_handlers();
+    }
+    if (vm_decode_program(&code->interp, &vm->image, handlers, fuse,
+                          snap) == FAILURE) {
+        free(code);
+        return FAILURE;
+    }
+    vm->code = code;
+    if (options->profile != NULL || options->trace != NULL) {
+        return SUCCESS;
+    }
+
+    if (options->engine == VM_ENGINE_JIT) {
+        code->has_engine = vm_decode_program(&code->engine, &vm->image,
+                                             NULL, fuse, snap) == SUCCESS;
+        if (code->has_engine &&
+            vm_jit_compile(&code->jit, &code->engine) == FAILURE) {
+            code->jit = NULL;
+        }
+    } else if (options->engine == VM_ENGINE_REG) {
+        /* Blocks see through whole idioms, superinstructions would only
+         * get in the way. */
+        code->has_engine = vm_decode_program(&code->engine, &vm->image,
+                                             NULL, 0, snap) == SUCCESS;
+    } else if (vm->verified) {
+        code->has_engine = vm_decode_program(&code->engine, &vm->image,
+                                             vm_unchecked_handlers(), fuse,
+                                             snap) == SUCCESS;
+    }
+    /* Without an engine program, runs are interpreted. */
+    return SUCCESS;
+}
+
+/**
+ * Set up the per VM part of the engine, once vm->code is there.
+ *
+ * @return                 FAILURE if out of memory.
+ */
+static status_t vm_prepare_engine (vm_t *vm)
+{
+    if (vm->options.engine == VM_ENGINE_REG && vm->code->has_engine &&
+        vm->options.profile == NULL && vm->options.trace == NULL) {
+        return vm_reg_create(&vm->reg, &vm->code->engine);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Load a .vmc file, replacing the program loaded before.
+ *
+ * @param  vm
+ * @param  fn              The .vmc file.
+ *
+ * @return                 FAILURE if the file could not be loaded.
+ */
+status_t vm_load_image (vm_t *vm, const char *fn)
+{
+    assert(vm != NULL);
+    assert(fn != NULL);
+
+    vm_unload_image(vm);
+    if ((vm->options.use_mmap ? vm_map_image(&vm->image, fn)
+                              : vm_read_image(&vm->image, fn)) == FAILURE) {
+        return FAILURE;
+    }
+    if ((vm->options.verify && vm_verify_image(vm, fn) == FAILURE) ||
+        vm_prepare_code(vm) == FAILURE || vm_prepare_engine(vm) == FAILURE ||
+        vm_alloc_run(vm) == FAILURE) {
+        vm_free_image(&vm->image);
+        memset(&vm->image, 0, sizeof(vmc_image_t));
+        vm->verified = 0;
+        vm_unload_image(vm);
+        return FAILURE;
+    }
+    vm->loaded = 1;
+    return SUCCESS;
+}
+
+/**
+ * Whether two VMs decode and jit a program the same way.
+ */
+static int vm_same_code (const vm_options_t *a, const vm_options_t *b)
+{
+    return a->engine == b->engine && a->fuse == b->fuse &&
+           (a->snapshot_fn != NULL) == (b->snapshot_fn != NULL) &&
+           (a->profile != NULL) == (b->profile != NULL) &&
+           (a->trace != NULL) == (b->trace != NULL);
+}
+
+/**
+ * Run the program loaded in another VM, replacing the program loaded
+ * before, without loading it again. Only what the program writes is
+ * copied, so any number of VMs, e.g. one per thread, can share one image,
+ * and its decoded and jitted program if they run it with the same
+ * options. source must keep the program loaded until vm no longer uses
+ * it.
+ *
+ * @param  vm
+ * @param  source          A VM with a program loaded.
+ *
+ * @return                 FAILURE if source has no program or out of
+ *                         memory.
+ */
+status_t vm_share_image (vm_t *vm, const vm_t *source)
+{
+    assert(vm != NULL);
+    assert(source != NULL);
+    assert(vm != source);
+
+    vm_unload_image(vm);
+    if (!source->loaded) {
+        fprintf(stderr, "\nError: no program loaded");
+        return FAILURE;
+    }
+    vm->image = source->image;
+    vm->verified = vm->options.verify && source->verified;
+    if (vm_same_code(&vm->options, &source->options) &&
+        vm->verified == source->verified) {
+        vm->code = source->code;
+        vm->shared_code = 1;
+    } else if (vm_prepare_code(vm) == FAILURE) {
+        memset(&vm->image, 0, sizeof(vmc_image_t));
+        vm->verified = 0;
+        return FAILURE;
+    }
+    if (vm_prepare_engine(vm) == FAILURE || vm_alloc_run(vm) == FAILURE) {
+        memset(&vm->image, 0, sizeof(vmc_image_t));
+        vm->verified = 0;
+        vm_unload_image(vm);
+        return FAILURE;
+    }
+    vm->loaded = 1;
+    vm->shared = 1;
+    return SUCCESS;
+}
+
+/**
+ * Whether the loaded program is a snapshot, which vm_run() resumes where
+ * SNAP left off.
+ *
+ * @param  vm
+ *
+ * @return                 0 if not, or if no program is loaded.
+ */
+int vm_is_snapshot (const vm_t *vm)
+{
+    assert(vm != NULL);
+
+    return vm->loaded && vm->image.state != NULL;
+}
+
+/**
+ * Run the loaded program from the start, on a fresh stack and a fresh copy
+ * of its data, until it executes END or hits a run time error. A snapshot
+ * instead starts from the stack, data and pc saved by SNAP. All output
+ * has been handed to io->write on return.
+ *
+ * @param  vm
+ * @param  io              Where the program reads and writes, NULL for
+ *                         stdin and stdout.
+ *
+ * @return                 FAILURE if the program hit a run time error or
+ *                         none is loaded.
+ */
+status_t vm_run (vm_t *vm, const vm_io_t *io)
+{
+    vm_state_t *state = NULL;
+    const vm_code_t *code = NULL;
+    int show_stats = 0;
+    vm_exit_t stop = VM_EXIT_HANDOFF;
+    status_t rc = SUCCESS;
+
+    assert(vm != NULL);
+
+    if (!vm->loaded) {
+        fprintf(stderr, "\nError: no program loaded");
+        return FAILURE;
+    }
+    if (io == NULL) {
+        io = &VM_STDIO;
+    }
+    if (vm->image.data != NULL) {
+        memcpy(vm->run.data, vm->image.data, vm->image.data_len);
+    } else {
+        /* Zero the padding too, a v1 PUT may have written it. */
+        memcpy(vm->run.code, vm->image.code, vm->image.code_len);
+        memset(&vm->run.code[vm->image.code_len], 0,
+               vm_image_code_size(&vm->image) + 1 - vm->image.code_len);
+    }
+    vm_out_init(&vm->out, io, vm->options.unbuffered);
+    vm_in_init(&vm->in, io);
+
+    state = &vm->state;
+    initStack(&state->stack);
+    state->bool_flag = FALSE;
+    state->input = 0;
+    state->pc = vm->run.code_start;
+    state->data = vm->run.data;
+    state->code = vm->run.code;
+    if (vm->image.state != NULL) {
+        const vmc_state_t *saved = vm->image.state;
+
+        memcpy(state->stack.elems, saved->stack,
+               saved->depth * sizeof(stack_elem_t));
+        state->stack.top = (int)saved->depth - 1;
+        state->bool_flag = saved->bool_flag ? TRUE : FALSE;
+        state->input = saved->input;
+        state->pc = (int)saved->pc;
+    }
+    state->out = &vm->out;
+    state->in = &vm->in;
+    state->snapshot_fn = vm->options.snapshot_fn;
+    state->profile = vm->options.profile;
+    state->trace = vm->options.trace;
+
+    show_stats = vm->options.show_stats;
+    code = vm->code;
+    if (state->profile != NULL) {
+        rc = vm_interpret_profiled(&code->interp, &vm->run, show_stats,
+                                   state);
+        vm_out_flush(&vm->out);
+        return rc;
+    }
+    if (state->trace != NULL) {
+        rc = vm_interpret_traced(&code->interp, &vm->run, show_stats, state);
+        vm_out_flush(&vm->out);
+        return rc;
+    }
+    if (code->jit != NULL) {
+        if (show_stats) {
+            vm_print_fusion_stats(stderr, &code->engine);
+        }
+        stop = vm_jit_run(code->jit, state);
+        show_stats = 0;
+    } else if (vm->reg != NULL) {
+        stop = vm_reg_run(vm->reg, state);
+        if (show_stats) {
+            vm_reg_print_stats(stderr, vm->reg);
+        }
+        show_stats = 0;
+    } else if (vm->options.engine == VM_ENGINE_INTERP &&
+               code->has_engine) {
+        stop = vm_run_unchecked(&code->engine, &vm->run, show_stats, state);
+        show_stats = 0;
+    }
+    if (stop == VM_EXIT_END) {
+        vm_out_flush(&vm->out);
+        return SUCCESS;
+    }
+
+    rc = vm_interpret(&code->interp, &vm->run, show_stats, state);
+    vm_out_flush(&vm->out);
+    return rc;
+}
+
+/**
+ * Free a VM and the program loaded in it.
+ *
+ * @param  vm              May be NULL.
+ */
+void vm_destroy (vm_t *vm)
+{
+    if (vm != NULL) {
+        vm_unload_image(vm);
+        free(vm);
+    }
+}
+
+/**
+ * A vm_io_t read callback on stdin.
+ */
+size_t vm_stdin_read (void *ctx, char *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    (void)ctx;
+    do {
+        n = read(STDIN_FILENO, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 ? (size_t)n : 0;
+}
+
+/**
+ * A vm_io_t write callback on stdout. Output that cannot be written, e.g.
+ * to a closed pipe, is dropped.
+ */
+void vm_stdout_write (void *ctx, const char *buf, size_t len)
+{
+    (void)ctx;
+    while (len > 0) {
+        const ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        buf += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,331 @@
+/**
+ * optimize.c
+ * Purpose: The optimizing pass of compiler -O1.
+ *
+ * The code of the first pass is read into a list of instructions, with a
+ * LAB for every label in the code and IND for every PUSH &label, still
+ * holding the label id. On that list the pass folds constants, threads
+ * jumps to jumps and removes unreachable code, then writes the code back
+ * without the NOP of each label and moves every label to the instruction
+ * that followed it. The second pass resolves the INDs as before.
+ *
+ * The pass assumes that programs only jump to labels, never to an address
+ * computed from one.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "headers/optimize.h"
+#include "headers/constants.h"
+#include "headers/enums.h"
+
+struct OPT_INST {
+    symbol_t op;
+    int32_t  arg;   /* The value of PUSH, the label id of LAB and IND. */
+};
+
+typedef struct OPT_INST opt_inst_t;
+
+/**
+ * Read the code of the first pass into a list of instructions. The NOP
+ * of a label in the code is the byte before the offset of the label.
+ *
+ * @param[out]  insts          At least code_len entries.
+ * @param[out]  n_insts
+ * @param[in]   code
+ * @param[in]   code_len
+ * @param[in]   label_table
+ * @param[in]   lt_len
+ *
+ * @return                     The error status.
+ */
+static status_t vm_opt_read (opt_inst_t *insts, int *n_insts,
+                             const bytecode_t *code, const int code_len,
+                             const label_t *label_table, const int lt_len)
+{
+    int32_t *label_at = NULL;
+    int pc = 0,
+        n  = 0,
+        i  = 0;
+
+    label_at = (int32_t *)malloc(code_len * sizeof(int32_t));
+    if (label_at == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    for (pc = 0; pc < code_len; pc ++) {
+        label_at[pc] = -1;
+    }
+    for (i = 0; i < lt_len; i ++) {
+        if (label_table[i].in_code) {
+            assert(label_table[i].pc > 0 && label_table[i].pc <= code_len);
+            label_at[label_table[i].pc - 1] = i;
+        }
+    }
+
+    for (pc = 0; pc < code_len; pc ++) {
+        const symbol_t op = get_inst(code[pc]);
+
+        if (op == PUSH || op == IND) {
+            assert(pc + INST_LEN <= code_len);
+            insts[n].op = op;
+            vm_get_integer_from_bytecode(&code[pc + 1], &insts[n++].arg);
+            pc += 4;
+        } else if (op == NOP && label_at[pc] >= 0) {
+            insts[n].op = LAB;
+            insts[n++].arg = label_at[pc];
+        } else {
+            insts[n].op = op;
+            insts[n++].arg = 0;
+        }
+    }
+    free(label_at);
+    *n_insts = n;
+    return SUCCESS;
+}
+
+/**
+ * Replace PUSH a PUSH b ADD, SUB or MUL by PUSH of the result, as the vm
+ * computes it, b - a for SUB. Folded results fold again, so PUSH 2
+ * PUSH 3 ADD PUSH 4 MUL becomes PUSH 20. Nothing folds across a label.
+ *
+ * @return  The number of instructions left.
+ */
+static int vm_opt_fold (opt_inst_t *insts, const int n_insts,
+                        vm_opt_stats_t *stats)
+{
+    int i = 0,
+        n = 0;
+
+    for (i = 0; i < n_insts; i ++) {
+        insts[n++] = insts[i];
+        while (n >= 3 && insts[n - 2].op == PUSH && insts[n - 3].op == PUSH &&
+               (insts[n - 1].op == ADD || insts[n - 1].op == SUB ||
+                insts[n - 1].op == MUL)) {
+            /* Wrap around like the int32_t arithmetic of the vm. */
+            const uint32_t a = (uint32_t)insts[n - 3].arg,
+                           b = (uint32_t)insts[n - 2].arg;
+            uint32_t result = 0;
+
+            switch (insts[n - 1].op) {
+                case ADD: result = b + a; break;
+                case SUB: result = b - a; break;
+                default:  result = b * a; break;
+            }
+            insts[n - 3].arg = (int32_t)result;
+            n -= 2;
+            stats->folded ++;
+        }
+    }
+    return n;
+}
+
+/**
+ * Whether insts[i] starts a PUSH &label GOTO to a label in the code.
+ */
+static int vm_opt_is_goto (const opt_inst_t *insts, const int n_insts,
+                           const int i, const label_t *label_table)
+{
+    return i + 1 < n_insts && insts[i].op == IND &&
+           insts[i + 1].op == GOTO && label_table[insts[i].arg].in_code;
+}
+
+/**
+ * Retarget every PUSH &label GOTO, GOIF or GOUN whose label is followed
+ * by a PUSH &label GOTO, to the label that one jumps to, and so on. A
+ * cycle of jumps is followed no further than once around.
+ *
+ * @return  The error status.
+ */
+static status_t vm_opt_thread (opt_inst_t *insts, const int n_insts,
+                               const label_t *label_table, const int lt_len,
+                               vm_opt_stats_t *stats)
+{
+    int32_t *first = NULL;   /* Label id -> its first instruction. */
+    int i = 0,
+        j = 0;
+
+    first = (int32_t *)malloc((lt_len + 1) * sizeof(int32_t));
+    if (first == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    for (i = 0; i < lt_len; i ++) {
+        first[i] = n_insts;
+    }
+    for (i = n_insts - 1; i >= 0; i --) {
+        if (insts[i].op == LAB) {
+            first[insts[i].arg] = i + 1 < n_insts && insts[i + 1].op == LAB ?
+                                  first[insts[i + 1].arg] : i + 1;
+        }
+    }
+
+    for (i = 0; i + 1 < n_insts; i ++) {
+        int32_t label = insts[i].arg;
+
+        if (insts[i].op != IND || !label_table[label].in_code ||
+            (insts[i + 1].op != GOTO && insts[i + 1].op != GOIF &&
+             insts[i + 1].op != GOUN)) {
+            continue;
+        }
+        for (j = 0; j < lt_len; j ++) {
+            const int next = first[label];
+
+            if (!vm_opt_is_goto(insts, n_insts, next, label_table) ||
+                insts[next].arg == label) {
+                break;
+            }
+            label = insts[next].arg;
+        }
+        if (label != insts[i].arg) {
+            insts[i].arg = label;
+            stats->threaded ++;
+        }
+    }
+    free(first);
+    return SUCCESS;
+}
+
+/**
+ * Remove the instructions between a GOTO or END and the next label that
+ * some PUSH &label names. Removing code can leave labels unnamed, so
+ * repeat until nothing changes. Labels themselves are kept.
+ *
+ * @return  The number of instructions left, or -1 if out of memory.
+ */
+static int vm_opt_unreachable (opt_inst_t *insts, int n_insts,
+                               const int lt_len, vm_opt_stats_t *stats)
+{
+    int *refs = NULL;
+    int removed = 1,
+        i = 0,
+        n = 0;
+
+    refs = (int *)malloc((lt_len + 1) * sizeof(int));
+    if (refs == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return -1;
+    }
+    while (removed) {
+        int reachable = 1;
+
+        for (i = 0; i < lt_len; i ++) {
+            refs[i] = 0;
+        }
+        for (i = 0; i < n_insts; i ++) {
+            if (insts[i].op == IND) {
+                refs[insts[i].arg] ++;
+            }
+        }
+
+        removed = 0;
+        n = 0;
+        for (i = 0; i < n_insts; i ++) {
+            if (insts[i].op == LAB) {
+                reachable = reachable || refs[insts[i].arg] > 0;
+            } else if (!reachable) {
+                removed ++;
+                continue;
+            }
+            insts[n++] = insts[i];
+            if (insts[i].op == GOTO || insts[i].op == END) {
+                reachable = 0;
+            }
+        }
+        stats->unreachable += removed;
+        n_insts = n;
+    }
+    free(refs);
+    return n_insts;
+}
+
+/**
+ * Write the instructions back as code. A LAB takes no space, its label
+ * gets the offset of the instruction after it.
+ *
+ * @return  The length of the code.
+ */
+static int vm_opt_write (bytecode_t *code, const opt_inst_t *insts,
+                         const int n_insts, label_t *label_table,
+                         vm_opt_stats_t *stats)
+{
+    int pc = 0,
+        i  = 0;
+
+    for (i = 0; i < n_insts; i ++) {
+        if (insts[i].op == LAB) {
+            label_table[insts[i].arg].pc = pc;
+            stats->label_nops ++;
+        } else if (insts[i].op == PUSH || insts[i].op == IND) {
+            code[pc++] = INST_SET[insts[i].op].bytecode;
+            vm_put_integer_to_bytecode(&code[pc], insts[i].arg);
+            pc += 4;
+        } else {
+            code[pc++] = INST_SET[insts[i].op].bytecode;
+        }
+    }
+    return pc;
+}
+
+/**
+ * Optimize the code of the first pass of compilation in place. Labels in
+ * the code move to their new offsets, and PUSH &label is still an IND
+ * for the second pass to resolve.
+ *
+ * @param[in,out]  code         The code of vm_compile_first_pass().
+ * @param[in,out]  code_len     Its length, never longer after.
+ * @param[in,out]  label_table  The offsets of labels in the code change.
+ * @param[in]      lt_len       The length of the label table.
+ * @param[out]     stats        What changed.
+ *
+ * @return                      The error status.
+ */
+status_t vm_optimize (bytecode_t *code, int *code_len, label_t *label_table,
+                      const int lt_len, vm_opt_stats_t *stats)
+{
+    opt_inst_t *insts = NULL;
+    int n_insts = 0;
+
+    assert(code != NULL);
+    assert(code_len != NULL);
+    assert(label_table != NULL || lt_len == 0);
+    assert(stats != NULL);
+
+    stats->len_before = *code_len;
+    stats->len_after = *code_len;
+    stats->folded = 0;
+    stats->threaded = 0;
+    stats->unreachable = 0;
+    stats->label_nops = 0;
+
+    insts = (opt_inst_t *)malloc((*code_len + 1) * sizeof(opt_inst_t));
+    if (insts == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    if (vm_opt_read(insts, &n_insts, code, *code_len, label_table,
+                    lt_len) == FAILURE) {
+        free(insts);
+        return FAILURE;
+    }
+    n_insts = vm_opt_fold(insts, n_insts, stats);
+    if (vm_opt_thread(insts, n_insts, label_table, lt_len,
+                      stats) == FAILURE) {
+        free(insts);
+        return FAILURE;
+    }
+    n_insts = vm_opt_unreachable(insts, n_insts, lt_len, stats);
+    if (n_insts < 0) {
+        free(insts);
+        return FAILURE;
+    }
+
+    *code_len = vm_opt_write(code, insts, n_insts, label_table, stats);
+    stats->len_after = *code_len;
+    free(insts);
+    return SUCCESS;
+}
@@ -0,0 +1,435 @@
+/**
+ * profile.c
+ * Purpose: Count what a program executes and report it.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "headers/constants.h"
+#include "headers/decode.h"
+#include "headers/libvm.h"
+#include "headers/profile.h"
+#include "headers/vmc.h"
+#include "headers/enums.h"
+
+/* The number of instructions listed as hottest in the text report. */
+#define VM_PROFILE_TOP 10
+
+/**
+ * Create a profile with nothing counted yet.
+ *
+ * @param[out]  profile
+ *
+ * @return      FAILURE if out of memory.
+ */
+status_t vm_profile_create (vm_profile_t **profile)
+{
+    assert(profile != NULL);
+
+    *profile = (vm_profile_t *)calloc(1, sizeof(vm_profile_t));
+    if (*profile == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Free a profile.
+ *
+ * @param  profile         May be NULL.
+ */
+void vm_profile_destroy (vm_profile_t *profile)
+{
+    if (profile != NULL) {
+        free(profile->hits);
+        free(profile->taken);
+        free(profile->entries);
+        free(profile);
+    }
+}
+
+/**
+ * Set up zeroed counters for every instruction of a decoded program, the
+ * END sentinel included.
+ *
+ * @param  profile
+ * @param  prog            The program about to run.
+ *
+ * @return                 FAILURE if out of memory.
+ */
+status_t vm_profile_start (vm_profile_t *profile, const decoded_prog_t *prog)
+{
+    const int n = prog->n_insts + 1;
+
+    assert(profile != NULL);
+
+    free(profile->hits);
+    free(profile->taken);
+    profile->hits = (uint64_t *)calloc(n, sizeof(uint64_t));
+    profile->taken = (uint64_t *)calloc(n, sizeof(uint64_t));
+    if (profile->hits == NULL || profile->taken == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        profile->n_counters = 0;
+        return FAILURE;
+    }
+    profile->n_counters = n;
+    return SUCCESS;
+}
+
+static int vm_compare_entries (const void *a, const void *b)
+{
+    const vm_profile_entry_t *x = (const vm_profile_entry_t *)a,
+                             *y = (const vm_profile_entry_t *)b;
+
+    if (x->pc != y->pc) {
+        return x->pc < y->pc ? -1 : 1;
+    }
+    return (int)x->op - (int)y->op;
+}
+
+/**
+ * Add the counters of a decoded program to the collected counts and
+ * clear them. An instruction that ran before and after the program
+ * rewrote its code keeps one entry.
+ *
+ * @param  profile
+ * @param  prog            The program the counters were set up for.
+ * @param  max_depth       The deepest the stack got while it ran.
+ */
+void vm_profile_collect (vm_profile_t *profile, const decoded_prog_t *prog,
+                         const int max_depth)
+{
+    vm_profile_entry_t *grown = NULL;
+    int n = profile->n_entries,
+        i = 0,
+        j = 0;
+
+    assert(profile != NULL);
+    assert(prog != NULL);
+
+    if (max_depth > profile->max_depth) {
+        profile->max_depth = max_depth;
+    }
+    for (i = 0; i < profile->n_counters; i ++) {
+        n += profile->hits[i] != 0;
+    }
+    if (n == profile->n_entries) {
+        return;
+    }
+    grown = (vm_profile_entry_t *)realloc(profile->entries,
+                                          n * sizeof(vm_profile_entry_t));
+    if (grown == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return;
+    }
+    profile->entries = grown;
+    n = profile->n_entries;
+    for (i = 0; i < profile->n_counters; i ++) {
+        if (profile->hits[i] != 0) {
+            grown[n].hits = profile->hits[i];
+            grown[n].taken = profile->taken[i];
+            grown[n].pc = prog->insts[i].pc;
+            grown[n].op = prog->insts[i].op;
+            profile->hits[i] = 0;
+            profile->taken[i] = 0;
+            n ++;
+        }
+    }
+
+    /* Sort and merge the counts of the same instruction. */
+    qsort(grown, n, sizeof(vm_profile_entry_t), vm_compare_entries);
+    for (i = 0, j = 0; i < n; i ++) {
+        if (j > 0 && vm_compare_entries(&grown[j - 1], &grown[i]) == 0) {
+            grown[j - 1].hits += grown[i].hits;
+            grown[j - 1].taken += grown[i].taken;
+        } else {
+            grown[j ++] = grown[i];
+        }
+    }
+    profile->n_entries = j;
+}
+
+static int vm_compare_symbols (const void *a, const void *b)
+{
+    const vmc_symbol_t *x = (const vmc_symbol_t *)a,
+                       *y = (const vmc_symbol_t *)b;
+
+    if (x->in_code != y->in_code) {
+        return x->in_code ? -1 : 1;
+    }
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Find the code label an instruction follows.
+ *
+ * @param  symbols         Sorted by vm_compare_symbols(), code first.
+ * @param  n_code          The number of code labels.
+ * @param  pc
+ *
+ * @return                 The last label at or before pc, or NULL.
+ */
+static const vmc_symbol_t *vm_find_label (const vmc_symbol_t *symbols,
+                                          const int n_code,
+                                          const uint32_t pc)
+{
+    int lo = 0,
+        hi = n_code;
+
+    /* The first label after pc is at lo once lo == hi. */
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+
+        if (symbols[mid].offset <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? &symbols[lo - 1] : NULL;
+}
+
+/**
+ * Format pc as label+offset, or as - without a label.
+ */
+static void vm_format_location (char *buf, const size_t len,
+                                const vmc_symbol_t *symbols,
+                                const int n_code, const uint32_t pc)
+{
+    const vmc_symbol_t *label = vm_find_label(symbols, n_code, pc);
+
+    if (label != NULL) {
+        snprintf(buf, len, "%s+%u", label->name, pc - label->offset);
+    } else {
+        snprintf(buf, len, "-");
+    }
+}
+
+/**
+ * Write a string as a JSON string literal.
+ */
+static void vm_json_string (FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s ++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static int vm_is_branch (const int op)
+{
+    return op == GOIF || op == GOUN;
+}
+
+static const char *vm_op_name (const int op)
+{
+    return op < N_INST ? INST_SET[op].name : "?";
+}
+
+/**
+ * Write the counts as JSON.
+ *
+ * @return                 The error status.
+ */
+static status_t vm_profile_write_json (const vm_profile_t *profile,
+                                       const uint64_t *op_counts,
+                                       const uint64_t total,
+                                       const vmc_symbol_t *symbols,
+                                       const int n_code, const char *fn)
+{
+    const vmc_symbol_t *label = NULL;
+    const char *sep = "";
+    FILE *fp = NULL;
+    int ok = 0,
+        i  = 0;
+
+    fp = fopen(fn, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not create output file %s\n", fn);
+        return FAILURE;
+    }
+    fprintf(fp, "{\n  \"instructions\": %llu,\n  \"max_stack_depth\": %d,\n"
+            "  \"opcodes\": {", (unsigned long long)total,
+            profile->max_depth);
+    for (i = 0; i < N_INST; i ++) {
+        if (op_counts[i] != 0) {
+            fprintf(fp, "%s\n    \"%s\": %llu", sep, INST_SET[i].name,
+                    (unsigned long long)op_counts[i]);
+            sep = ",";
+        }
+    }
+    fprintf(fp, "\n  },\n  \"pcs\": [");
+    sep = "";
+    for (i = 0; i < profile->n_entries; i ++) {
+        const vm_profile_entry_t *e = &profile->entries[i];
+
+        fprintf(fp, "%s\n    {\"pc\": %u, \"op\": \"%s\"", sep, e->pc,
+                vm_op_name(e->op));
+        label = vm_find_label(symbols, n_code, e->pc);
+        if (label != NULL) {
+            fprintf(fp, ", \"label\": ");
+            vm_json_string(fp, label->name);
+            fprintf(fp, ", \"offset\": %u", e->pc - label->offset);
+        }
+        fprintf(fp, ", \"hits\": %llu", (unsigned long long)e->hits);
+        if (vm_is_branch(e->op)) {
+            fprintf(fp, ", \"taken\": %llu, \"not_taken\": %llu",
+                    (unsigned long long)e->taken,
+                    (unsigned long long)(e->hits - e->taken));
+        }
+        fprintf(fp, "}");
+        sep = ",";
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n", fn);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Print the counts for people: instructions per opcode, every GOIF and
+ * GOUN, and the hottest instructions.
+ */
+static void vm_profile_print (FILE *fp, const vm_profile_t *profile,
+                              const uint64_t *op_counts, const uint64_t total,
+                              const vmc_symbol_t *symbols, const int n_code)
+{
+    char where[MAX_LINE_LEN + 16];
+    int top[VM_PROFILE_TOP];
+    int n_top = 0,
+        i     = 0,
+        j     = 0;
+
+    fprintf(fp, "\nProfile: %llu instructions, max stack depth %d\n",
+            (unsigned long long)total, profile->max_depth);
+
+    fprintf(fp, "\n%-8s %14s %7s\n", "opcode", "count", "%");
+    for (i = 0; i < N_INST; i ++) {
+        if (op_counts[i] != 0) {
+            fprintf(fp, "%-8s %14llu %7.2f\n", INST_SET[i].name,
+                    (unsigned long long)op_counts[i],
+                    100.0 * op_counts[i] / total);
+        }
+    }
+
+    fprintf(fp, "\n%-8s %10s  %-24s %14s %14s\n", "branch", "pc", "label",
+            "taken", "not taken");
+    for (i = 0; i < profile->n_entries; i ++) {
+        const vm_profile_entry_t *e = &profile->entries[i];
+
+        if (vm_is_branch(e->op)) {
+            vm_format_location(where, sizeof(where), symbols, n_code, e->pc);
+            fprintf(fp, "%-8s %10u  %-24s %14llu %14llu\n", vm_op_name(e->op),
+                    e->pc, where, (unsigned long long)e->taken,
+                    (unsigned long long)(e->hits - e->taken));
+        }
+    }
+
+    /* Insert each entry into the sorted top list. */
+    for (i = 0; i < profile->n_entries; i ++) {
+        const uint64_t hits = profile->entries[i].hits;
+
+        for (j = n_top; j > 0 &&
+                        profile->entries[top[j - 1]].hits < hits; j --) {
+            if (j < VM_PROFILE_TOP) {
+                top[j] = top[j - 1];
+            }
+        }
+        if (j < VM_PROFILE_TOP) {
+            top[j] = i;
+            if (n_top < VM_PROFILE_TOP) {
+                n_top ++;
+            }
+        }
+    }
+    fprintf(fp, "\n%-8s %10s  %-24s %14s %7s\n", "hottest", "pc", "label",
+            "hits", "%");
+    for (i = 0; i < n_top; i ++) {
+        const vm_profile_entry_t *e = &profile->entries[top[i]];
+
+        vm_format_location(where, sizeof(where), symbols, n_code, e->pc);
+        fprintf(fp, "%-8s %10u  %-24s %14llu %7.2f\n", vm_op_name(e->op),
+                e->pc, where, (unsigned long long)e->hits,
+                100.0 * e->hits / total);
+    }
+}
+
+/**
+ * Report what the runs of a profile executed: a summary on stderr and
+ * every count in a JSON file. Instructions are named by the label they
+ * follow when the symbol file of the program, written by compiler -g, is
+ * found.
+ *
+ * @param  profile
+ * @param  vmc_fn          The .vmc file that ran. Its labels are read
+ *                         from vmc_fn.sym if that exists.
+ * @param  json_fn         Where to write the JSON report.
+ *
+ * @return                 The error status.
+ */
+status_t vm_profile_report (const vm_profile_t *profile, const char *vmc_fn,
+                            const char *json_fn)
+{
+    uint64_t op_counts[N_INST];
+    uint64_t total = 0;
+    vmc_symbol_t *symbols = NULL;
+    char *sym_fn = NULL;
+    status_t rc = FAILURE;
+    int n_symbols = 0,
+        n_code = 0,
+        i = 0;
+
+    assert(profile != NULL);
+    assert(vmc_fn != NULL);
+    assert(json_fn != NULL);
+
+    sym_fn = (char *)malloc(strlen(vmc_fn) + 5);
+    if (sym_fn == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    strcpy(sym_fn, vmc_fn);
+    strcat(sym_fn, ".sym");
+    if (vm_read_symbols(sym_fn, &symbols, &n_symbols) == SUCCESS &&
+        n_symbols > 0) {
+        qsort(symbols, n_symbols, sizeof(vmc_symbol_t), vm_compare_symbols);
+        while (n_code < n_symbols && symbols[n_code].in_code) {
+            n_code ++;
+        }
+    }
+    free(sym_fn);
+
+    memset(op_counts, 0, sizeof(op_counts));
+    for (i = 0; i < profile->n_entries; i ++) {
+        if (profile->entries[i].op < N_INST) {
+            op_counts[profile->entries[i].op] += profile->entries[i].hits;
+        }
+        total += profile->entries[i].hits;
+    }
+
+    vm_profile_print(stderr, profile, op_counts, total, symbols, n_code);
+    rc = vm_profile_write_json(profile, op_counts, total, symbols, n_code,
+                               json_fn);
+    vm_free_symbols(symbols, n_symbols);
+    return rc;
+}
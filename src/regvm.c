@@ -0,0 +1,1141 @@
+/**
+ * regvm.c
+ * Purpose: Register based execution engine.
+ *
+ * Each basic block of the decoded program is translated, the first time it
+ * is entered, into a short list of three address instructions. The
+ * translator runs the stack effect of the block symbolically: every stack
+ * slot is statically mapped to either a constant, a slot that held a value
+ * when the block was entered, or a virtual register holding the result of
+ * an earlier instruction. PUSH, POP, DUP and FLIP therefore produce no code
+ * at all, constants are folded into immediate operands, and the stack in
+ * memory is only written once, when the block exits.
+ *
+ * The IR interpreter keeps the top of the stack in a local variable, which
+ * the compiler keeps in a machine register, so that it never has to be
+ * stored and reloaded between blocks.
+ *
+ * The depth the whole block needs is checked once on entry. A block that
+ * would underflow or overflow, jump to a bad address, GET or PUT a bad
+ * address, execute an invalid opcode or, in images without a separate
+ * data segment, PUT into the code segment is handed
+ * to the interpreter before it has any side effect, which then reports the
+ * error, or carries on, with exactly its usual behaviour.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "headers/regvm.h"
+#include "headers/decode.h"
+#include "headers/constants.h"
+#include "headers/enums.h"
+#include "headers/stack.h"
+#include "headers/vm.h"
+#include "headers/vmio.h"
+
+/* Bytecode instructions per block, bounds the IR and registers below. */
+#define REG_MAX_BLOCK 32
+
+/* Each instruction uses at most 4 registers, each slot at most 2. */
+#define REG_MAX_REGS  (REG_MAX_BLOCK * 4 + REG_MAX_BLOCK * 2 * 3)
+#define REG_MAX_IR    (REG_MAX_REGS * 2)
+
+/* Lowest slot a block can reach: every instruction pops at most 2. */
+#define REG_MIN_SLOT  (-REG_MAX_BLOCK * 2)
+#define REG_N_SLOTS   (REG_MAX_BLOCK * 3 + 1)
+
+/*
+ * The IR. Operands d, a and b are registers, slots are relative to the
+ * stack depth on block entry (-1 is the top), imm is an immediate.
+ *
+ *   LD d, slot a     LDT d (top on entry)     LI d, imm
+ *   ADD, SUB, MUL    d = a op b, the I forms use imm for b, RSUBI is
+ *                    d = imm - a
+ *   DIV              d = a / b and register imm = a % b
+ *   EQ, GT, LT       flag = a op b, the I forms use imm for b; SETF imm
+ *   WRTH, WRTD, WRTC print a; REAH, READ, REAC read into d
+ *   GET d, a         d = value at address a; hands off if a is out of
+ *                    bounds or unaligned, which v1 addresses never are,
+ *                    so then it is the first instruction of its block
+ *   GETI d, imm      imm is an offset known to be in bounds
+ *   GETW d, imm      the same for word imm of a data segment
+ *   PUT a, b         store b at address a; hands off if a is out of
+ *                    bounds or in the code segment, only ever the first
+ *                    instruction of a block
+ *   PUTI a, imm      imm is known to be in bounds and not in the code
+ *   PUTW a, imm      the same for word imm of a data segment
+ *   READN d, a, b    read up to b integers to address a, d = the number
+ *                    read; hands off if they do not fit in the data
+ *                    segment, only ever the first instruction of a block
+ *   WRTS a           write the string at address a; hands off if it is
+ *                    not a zero terminated string in the data segment,
+ *                    only ever the first instruction of a block
+ *   MCPY a, b, imm   copy b words from the address in register imm to
+ *                    address a
+ *   MSET a, b, imm   fill b words from address a with register imm; both
+ *                    hand off if a block is not in the data segment, and
+ *                    are the only instruction of their block
+ *   ST slot d, a     STI slot d, imm; store a slot on exit
+ *   STT a, STTI imm  set the new top of stack on exit
+ *   LDTOP slot d     the new top of stack is slot d, if the stack is not
+ *                    empty; SPILL stores the top on entry in slot -1
+ *
+ * Each block ends in one terminator: FALL, JMP, JMPIF or JMPUN to the
+ * block's next or target, JMPR, JMPRIF or JMPRUN to the byte offset in a,
+ * END or HANDOFF.
+ */
+#define REG_OP_DEF(list_macro) list_macro(R_LD),                          \
+        list_macro(R_LDT), list_macro(R_LI),                              \
+        list_macro(R_ADD), list_macro(R_ADDI),                            \
+        list_macro(R_SUB), list_macro(R_SUBI), list_macro(R_RSUBI),       \
+        list_macro(R_MUL), list_macro(R_MULI), list_macro(R_DIV),         \
+        list_macro(R_EQ), list_macro(R_EQI), list_macro(R_GT),            \
+        list_macro(R_GTI), list_macro(R_LT), list_macro(R_LTI),           \
+        list_macro(R_SETF),                                               \
+        list_macro(R_WRTH), list_macro(R_WRTD), list_macro(R_WRTC),       \
+        list_macro(R_REAH), list_macro(R_READ), list_macro(R_REAC),       \
+        list_macro(R_GET), list_macro(R_GETI), list_macro(R_GETW),        \
+        list_macro(R_PUT), list_macro(R_PUTI), list_macro(R_PUTW),        \
+        list_macro(R_READN), list_macro(R_WRTS),                          \
+        list_macro(R_MCPY), list_macro(R_MSET),                           \
+        list_macro(R_ST), list_macro(R_STI),                              \
+        list_macro(R_STT), list_macro(R_STTI),                            \
+        list_macro(R_LDTOP), list_macro(R_SPILL),                         \
+        list_macro(R_FALL), list_macro(R_JMP),                            \
+        list_macro(R_JMPIF), list_macro(R_JMPUN),                         \
+        list_macro(R_JMPR), list_macro(R_JMPRIF), list_macro(R_JMPRUN),   \
+        list_macro(R_END), list_macro(R_HANDOFF),
+
+typedef enum {
+    REG_OP_DEF(get_symbol_macro)
+    N_REG_OPS
+} reg_op_t;
+
+/* Same dispatch scheme as the interpreter in interp.c. */
+#ifdef __GNUC__
+#define REG_USE_COMPUTED_GOTO
+#endif
+
+#ifdef REG_USE_COMPUTED_GOTO
+#define get_reg_label_macro(op) [op] = &&do_##op
+#define REG_CASE(op)    do_##op
+#define REG_DISPATCH()  goto *labels[ri->op]
+#define REG_NEXT()      { ri ++; REG_DISPATCH(); }
+#else
+#define REG_CASE(op)    case op
+#define REG_NEXT()      continue
+#endif
+
+struct REG_INST {
+    int32_t  imm;
+    int16_t  d;
+    int16_t  a;
+    int16_t  b;
+    uint8_t  op;
+};
+
+typedef struct REG_INST reg_inst_t;
+
+struct REG_BLOCK {
+    uint32_t    pc;        /* Byte offset of the first instruction.      */
+    uint32_t    term_pc;   /* Byte offset of GOTO, GOIF, GOUN or END.    */
+    int32_t     target;    /* Index of a constant jump target.           */
+    int32_t     next;      /* Index of the instruction after the block.  */
+    int         need;      /* Stack depth the block needs on entry.      */
+    int         grow;      /* Highest depth above the entry depth.       */
+    int         delta;     /* Depth change when the block exits.         */
+    int         n_src;     /* Bytecode instructions covered.             */
+    int         n_ir;
+    reg_inst_t  ir[];
+};
+
+typedef struct REG_BLOCK reg_block_t;
+
+/* A stack slot during translation. */
+typedef enum {
+    V_SLOT,     /* Still the value the slot held on entry. */
+    V_CONST,
+    V_REG
+} value_kind_t;
+
+struct REG_VALUE {
+    value_kind_t kind;
+    int32_t      v;
+};
+
+typedef struct REG_VALUE reg_value_t;
+
+struct REG_TRANSLATOR {
+    reg_inst_t  ir[REG_MAX_IR];
+    int         n_ir;
+    int         n_regs;
+    reg_value_t stack[REG_N_SLOTS];     /* Indexed by slot - REG_MIN_SLOT. */
+    int16_t     slot_reg[REG_N_SLOTS];  /* Register an entry slot was
+                                         * loaded into, or -1.             */
+    int         height;                 /* Slots above the entry depth.    */
+    int         need;
+    int         grow;
+};
+
+typedef struct REG_TRANSLATOR reg_translator_t;
+
+struct REG_PROG {
+    const decoded_prog_t *prog;
+    reg_block_t         **blocks;     /* Decoded index -> block starting
+                                       * there, NULL until first entered. */
+    uint8_t              *leader;     /* Index is a PUSH &label target.   */
+    unsigned int          n_blocks;
+    unsigned int          n_src;
+    unsigned int          n_ir;
+    unsigned long long    executed;   /* Bytecode instructions run.       */
+    reg_translator_t     *scratch;
+};
+
+
+static reg_inst_t *emit (reg_translator_t *t, const reg_op_t op,
+                         const int d, const int a, const int b,
+                         const int32_t imm)
+{
+    reg_inst_t *inst = &t->ir[t->n_ir++];
+
+    assert(t->n_ir <= REG_MAX_IR);
+    inst->op = op;
+    inst->d = d;
+    inst->a = a;
+    inst->b = b;
+    inst->imm = imm;
+    return inst;
+}
+
+static int new_reg (reg_translator_t *t)
+{
+    assert(t->n_regs < REG_MAX_REGS);
+    return t->n_regs++;
+}
+
+/**
+ * The value in a slot, n from the top of the translated stack. Reaching
+ * below the deepest slot seen so far raises the depth the block needs.
+ */
+static reg_value_t *slot_at (reg_translator_t *t, const int n)
+{
+    const int slot = t->height - 1 - n;
+    int s = 0;
+
+    assert(slot >= REG_MIN_SLOT);
+    for (s = -t->need - 1; s >= slot; s --) {
+        t->stack[s - REG_MIN_SLOT].kind = V_SLOT;
+        t->stack[s - REG_MIN_SLOT].v = s;
+        t->slot_reg[s - REG_MIN_SLOT] = -1;
+    }
+    if (-slot > t->need) {
+        t->need = -slot;
+    }
+    return &t->stack[slot - REG_MIN_SLOT];
+}
+
+static void push_value (reg_translator_t *t, const value_kind_t kind,
+                        const int32_t v)
+{
+    reg_value_t *value = &t->stack[t->height - REG_MIN_SLOT];
+
+    value->kind = kind;
+    value->v = v;
+    t->height ++;
+    if (t->height > t->grow) {
+        t->grow = t->height;
+    }
+}
+
+/**
+ * Make a value available in a register, loading an entry slot or an
+ * immediate if needed.
+ */
+static int use_reg (reg_translator_t *t, const reg_value_t value)
+{
+    int16_t *cached = NULL;
+    int r = 0;
+
+    switch (value.kind) {
+    case V_REG:
+        return value.v;
+
+    case V_CONST:
+        r = new_reg(t);
+        emit(t, R_LI, r, 0, 0, value.v);
+        return r;
+
+    case V_SLOT:
+    default:
+        /* No slot is stored before the block exits, so one load of an
+         * entry slot is good for the whole block. */
+        cached = &t->slot_reg[value.v - REG_MIN_SLOT];
+        if (*cached < 0) {
+            *cached = new_reg(t);
+            if (value.v == -1) {
+                emit(t, R_LDT, *cached, 0, 0, 0);
+            } else {
+                emit(t, R_LD, *cached, value.v, 0, 0);
+            }
+        }
+        return *cached;
+    }
+}
+
+/**
+ * Whether slot already holds value in the memory layout the next block
+ * expects, where the top of stack lives in a register.
+ */
+static int in_place (const reg_value_t value, const int slot, const int top)
+{
+    return value.kind == V_SLOT && value.v == slot &&
+           (slot == -1) == (slot == top);
+}
+
+/**
+ * Write the translated stack back to memory before the block exits.
+ */
+static void materialize (reg_translator_t *t)
+{
+    const int top = t->height - 1;
+    int s = 0;
+
+    if (t->need == 0 && t->height > 0) {
+        /* The block pushed on top of a stack it never looked at. */
+        emit(t, R_SPILL, 0, 0, 0, 0);
+    }
+    /* Load first, the stores may overwrite entry slots. */
+    for (s = -t->need; s < t->height; s ++) {
+        reg_value_t *value = &t->stack[s - REG_MIN_SLOT];
+
+        if (value->kind == V_SLOT && !in_place(*value, s, top)) {
+            value->v = use_reg(t, *value);
+            value->kind = V_REG;
+        }
+    }
+    for (s = -t->need; s < t->height; s ++) {
+        const reg_value_t value = t->stack[s - REG_MIN_SLOT];
+
+        if (value.kind == V_SLOT) {
+            continue;
+        }
+        if (s == top) {
+            if (value.kind == V_CONST) {
+                emit(t, R_STTI, 0, 0, 0, value.v);
+            } else {
+                emit(t, R_STT, 0, value.v, 0, 0);
+            }
+        } else if (value.kind == V_CONST) {
+            emit(t, R_STI, s, 0, 0, value.v);
+        } else {
+            emit(t, R_ST, s, value.v, 0, 0);
+        }
+    }
+    if (top < -t->need && top != -1) {
+        /* The block popped slots it never looked at. */
+        emit(t, R_LDTOP, top, 0, 0, 0);
+    }
+}
+
+/**
+ * Translate a binary arithmetic instruction: the result of top op second
+ * replaces both.
+ */
+static void translate_arith (reg_translator_t *t, const symbol_t inst)
+{
+    const reg_value_t a = *slot_at(t, 0),
+                      b = *slot_at(t, 1);
+    reg_value_t *result = slot_at(t, 1);
+    uint32_t folded = 0;
+    int d = 0;
+
+    if (a.kind == V_CONST && b.kind == V_CONST) {
+        folded = inst == ADD ? (uint32_t)a.v + (uint32_t)b.v :
+                 inst == SUB ? (uint32_t)a.v - (uint32_t)b.v :
+                               (uint32_t)a.v * (uint32_t)b.v;
+        result->kind = V_CONST;
+        result->v = (int32_t)folded;
+        t->height --;
+        return;
+    }
+
+    if (inst == SUB && a.kind == V_CONST) {
+        d = new_reg(t);
+        emit(t, R_RSUBI, d, use_reg(t, b), 0, a.v);
+    } else if (b.kind == V_CONST) {
+        d = new_reg(t);
+        emit(t, inst == ADD ? R_ADDI : inst == SUB ? R_SUBI : R_MULI,
+             d, use_reg(t, a), 0, b.v);
+    } else if (a.kind == V_CONST) {
+        /* ADD and MUL commute. */
+        d = new_reg(t);
+        emit(t, inst == ADD ? R_ADDI : R_MULI, d, use_reg(t, b), 0, a.v);
+    } else {
+        const int ra = use_reg(t, a),
+                  rb = use_reg(t, b);
+
+        d = new_reg(t);
+        emit(t, inst == ADD ? R_ADD : inst == SUB ? R_SUB : R_MUL,
+             d, ra, rb, 0);
+    }
+    result->kind = V_REG;
+    result->v = d;
+    t->height --;
+}
+
+/**
+ * Translate EQU, GRT and LST, which compare top with second.
+ */
+static void translate_compare (reg_translator_t *t, const symbol_t inst)
+{
+    const reg_value_t a = *slot_at(t, 0),
+                      b = *slot_at(t, 1);
+    const reg_op_t op   = inst == EQU ? R_EQ  : inst == GRT ? R_GT  : R_LT,
+                   opi  = inst == EQU ? R_EQI : inst == GRT ? R_GTI : R_LTI,
+                   swpi = inst == EQU ? R_EQI : inst == GRT ? R_LTI : R_GTI;
+    int flag = 0;
+
+    if (a.kind == V_CONST && b.kind == V_CONST) {
+        flag = inst == EQU ? a.v == b.v : inst == GRT ? a.v > b.v : a.v < b.v;
+        emit(t, R_SETF, 0, 0, 0, flag ? TRUE : FALSE);
+    } else if (b.kind == V_CONST) {
+        emit(t, opi, 0, use_reg(t, a), 0, b.v);
+    } else if (a.kind == V_CONST) {
+        emit(t, swpi, 0, use_reg(t, b), 0, a.v);
+    } else {
+        const int ra = use_reg(t, a),
+                  rb = use_reg(t, b);
+
+        emit(t, op, 0, ra, rb, 0);
+    }
+}
+
+/**
+ * Translate the block starting at decoded index start.
+ *
+ * @return  The block, or NULL if out of memory.
+ */
+static reg_block_t *vm_reg_translate (reg_prog_t *rp, const int32_t start)
+{
+    reg_translator_t *t = rp->scratch;
+    const decoded_prog_t *prog = rp->prog;
+    const decoded_inst_t *insts = prog->insts;
+    reg_block_t *block = NULL;
+    reg_value_t a, b;
+    reg_op_t term = R_FALL;
+    int32_t target  = -1,
+            next    = start,
+            address = -1;
+    uint32_t term_pc = insts[start].pc;
+    int n = 0,
+        d = 0;
+
+    t->n_ir = 0;
+    t->n_regs = 0;
+    t->height = 0;
+    t->need = 0;
+    t->grow = 0;
+
+    for (n = 0; ; n ++) {
+        const decoded_inst_t *inst = &insts[start + n];
+
+        next = start + n;
+        if (n > 0 && (n == REG_MAX_BLOCK || rp->leader[next])) {
+            break;
+        }
+
+        switch (inst->op) {
+        case PUSH:
+            push_value(t, V_CONST, inst->arg);
+            continue;
+
+        case POP:
+            slot_at(t, 0);
+            t->height --;
+            continue;
+
+        case DUP:
+            a = *slot_at(t, 0);
+            push_value(t, a.kind, a.v);
+            continue;
+
+        case FLIP:
+            a = *slot_at(t, 0);
+            b = *slot_at(t, 1);
+            *slot_at(t, 0) = b;
+            *slot_at(t, 1) = a;
+            continue;
+
+        case ADD:
+        case SUB:
+        case MUL:
+            translate_arith(t, inst->op);
+            continue;
+
+        case DIV:
+            /* Division by zero traps, just like the interpreter. */
+            a = *slot_at(t, 0);
+            b = *slot_at(t, 1);
+            {
+                const int ra = use_reg(t, a),
+                          rb = use_reg(t, b),
+                          q  = new_reg(t),
+                          r  = new_reg(t);
+
+                emit(t, R_DIV, q, ra, rb, r);
+                slot_at(t, 0)->kind = V_REG;
+                slot_at(t, 0)->v = q;
+                slot_at(t, 1)->kind = V_REG;
+                slot_at(t, 1)->v = r;
+            }
+            continue;
+
+        case EQU:
+        case GRT:
+        case LST:
+            translate_compare(t, inst->op);
+            continue;
+
+        case WRTH:
+        case WRTD:
+        case WRTC:
+            a = *slot_at(t, 0);
+            emit(t, inst->op == WRTH ? R_WRTH :
+                     inst->op == WRTD ? R_WRTD : R_WRTC,
+                 0, use_reg(t, a), 0, 0);
+            t->height --;
+            continue;
+
+        case REAH:
+        case READ:
+        case REAC:
+            d = new_reg(t);
+            emit(t, inst->op == REAH ? R_REAH :
+                     inst->op == READ ? R_READ : R_REAC, d, 0, 0, 0);
+            push_value(t, V_REG, d);
+            continue;
+
+        case GET:
+            a = *slot_at(t, 0);
+            address = a.kind == V_CONST ? vm_data_address(prog, a.v) : -1;
+            if (address < 0 && !prog->byte_addresses && n > 0) {
+                /* A bad address hands off, start a block with it. */
+                break;
+            }
+            d = new_reg(t);
+            if (address >= 0 && prog->has_data) {
+                emit(t, R_GETW, d, 0, 0, address >> 2);
+            } else if (address >= 0) {
+                emit(t, R_GETI, d, 0, 0, address);
+            } else {
+                emit(t, R_GET, d, use_reg(t, a), 0, 0);
+            }
+            slot_at(t, 0)->kind = V_REG;
+            slot_at(t, 0)->v = d;
+            continue;
+
+        case PUT:
+            a = *slot_at(t, 0);
+            b = *slot_at(t, 1);
+            address = a.kind == V_CONST ? vm_data_address(prog, a.v) : -1;
+            if (address >= 0 && prog->has_data) {
+                emit(t, R_PUTW, 0, use_reg(t, b), 0, address >> 2);
+            } else if (address >= 0 && !vm_hits_code(prog, address)) {
+                emit(t, R_PUTI, 0, use_reg(t, b), 0, address);
+            } else if (n == 0) {
+                /* Nothing has run yet if this hands off. */
+                const int ra = use_reg(t, a),
+                          rb = use_reg(t, b);
+
+                emit(t, R_PUT, 0, ra, rb, 0);
+            } else {
+                /* End the block, so the PUT starts the next one. */
+                break;
+            }
+            t->height -= 2;
+            continue;
+
+        case READN:
+            if (n > 0) {
+                /* A bad address hands off, start a block with it. */
+                break;
+            }
+            a = *slot_at(t, 0);
+            b = *slot_at(t, 1);
+            {
+                const int ra = use_reg(t, a),
+                          rb = use_reg(t, b);
+
+                d = new_reg(t);
+                emit(t, R_READN, d, ra, rb, 0);
+            }
+            t->height -= 2;
+            push_value(t, V_REG, d);
+            continue;
+
+        case WRTS:
+            if (n > 0) {
+                /* A bad address hands off, start a block with it. */
+                break;
+            }
+            a = *slot_at(t, 0);
+            emit(t, R_WRTS, 0, use_reg(t, a), 0, 0);
+            t->height --;
+            continue;
+
+        case MCPY:
+        case MSET:
+            if (n > 0) {
+                break;
+            }
+            a = *slot_at(t, 0);
+            b = *slot_at(t, 1);
+            {
+                const reg_value_t c = *slot_at(t, 2);
+                const int ra = use_reg(t, a),
+                          rb = use_reg(t, b),
+                          rc = use_reg(t, c);
+
+                emit(t, inst->op == MCPY ? R_MCPY : R_MSET, 0, ra, rb, rc);
+            }
+            t->height -= 3;
+            /* Alone in its block, which keeps to REG_MIN_SLOT. */
+            n ++;
+            next = start + n;
+            break;
+
+        case NOP:
+            continue;
+
+        case GOTO:
+        case GOIF:
+        case GOUN:
+            a = *slot_at(t, 0);
+            t->height --;
+            term_pc = inst->pc;
+            next = start + n + 1;
+            if (a.kind == V_CONST) {
+                target = vm_decoded_index(prog, a.v);
+            }
+            if (target >= 0) {
+                term = inst->op == GOTO ? R_JMP :
+                       inst->op == GOIF ? R_JMPIF : R_JMPUN;
+            } else {
+                d = use_reg(t, a);
+                term = inst->op == GOTO ? R_JMPR :
+                       inst->op == GOIF ? R_JMPRIF : R_JMPRUN;
+            }
+            n ++;
+            break;
+
+        case END:
+            term_pc = inst->pc;
+            term = R_END;
+            n ++;
+            break;
+
+        default:
+            /* ERR and friends, let the interpreter report them. */
+            if (n == 0) {
+                term = R_HANDOFF;
+            }
+            break;
+        }
+        break;
+    }
+
+    if (term != R_HANDOFF) {
+        materialize(t);
+    }
+    emit(t, term, 0, d, 0, 0);
+
+    block = (reg_block_t *)malloc(sizeof(reg_block_t) +
+                                  t->n_ir * sizeof(reg_inst_t));
+    if (block == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return NULL;
+    }
+    block->pc = insts[start].pc;
+    block->term_pc = term_pc;
+    block->target = target;
+    block->next = next;
+    block->need = t->need;
+    block->grow = t->grow;
+    block->delta = t->height;
+    block->n_src = n;
+    block->n_ir = t->n_ir;
+    memcpy(block->ir, t->ir, t->n_ir * sizeof(reg_inst_t));
+
+    rp->blocks[start] = block;
+    rp->n_blocks ++;
+    rp->n_src += n;
+    rp->n_ir += t->n_ir;
+    return block;
+}
+
+/**
+ * Prepare a decoded program for the register engine. Blocks are translated
+ * lazily, the first time they are entered.
+ *
+ * @param[out]  rp              The register program.
+ * @param[in]   prog            The decoded program, without superinstructions.
+ *                              Must outlive rp. GET and PUT operate on the
+ *                              data and code of the state rp is run on.
+ *
+ * @return                      The error status.
+ */
+status_t vm_reg_create (reg_prog_t **rp, const decoded_prog_t *prog)
+{
+    reg_prog_t *p = NULL;
+    int i = 0;
+
+    assert(rp != NULL);
+    assert(prog != NULL);
+
+    p = (reg_prog_t *)calloc(1, sizeof(reg_prog_t));
+    if (p == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    p->prog = prog;
+    p->blocks = (reg_block_t **)calloc(prog->n_insts + 1,
+                                       sizeof(reg_block_t *));
+    p->leader = (uint8_t *)calloc(prog->n_insts + 1, sizeof(uint8_t));
+    p->scratch = (reg_translator_t *)malloc(sizeof(reg_translator_t));
+    if (p->blocks == NULL || p->leader == NULL || p->scratch == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        vm_reg_free(p);
+        return FAILURE;
+    }
+
+    /* Start blocks at every label, so loops are not translated twice. */
+    for (i = 0; i < prog->n_insts; i ++) {
+        if (prog->insts[i].op == PUSH) {
+            const int32_t target = vm_decoded_index(prog, prog->insts[i].arg);
+
+            if (target >= 0) {
+                p->leader[target] = 1;
+            }
+        }
+    }
+
+    *rp = p;
+    return SUCCESS;
+}
+
+static reg_block_t *vm_reg_block (reg_prog_t *rp, const int32_t index)
+{
+    reg_block_t *block = rp->blocks[index];
+
+    return block ? block : vm_reg_translate(rp, index);
+}
+
+/**
+ * Run a program from state until it ends or has to be handed to the
+ * interpreter.
+ *
+ * @param  rp
+ * @param  state   The state to start from, updated on return.
+ *
+ * @return         VM_EXIT_END, or VM_EXIT_HANDOFF if the interpreter must go
+ *                 on from state->pc.
+ */
+vm_exit_t vm_reg_run (reg_prog_t *rp, vm_state_t *state)
+{
+#ifdef REG_USE_COMPUTED_GOTO
+    static const void *const labels[N_REG_OPS] = {
+        REG_OP_DEF(get_reg_label_macro)
+    };
+#endif
+    int32_t regs[REG_MAX_REGS];
+    const decoded_prog_t *prog = rp->prog;
+    bytecode_t *code = state->code;
+    int32_t *data = state->data;
+    const uint32_t data_words = prog->data_words;
+    uint32_t word = 0;
+    vm_out_t *out = state->out;
+    vm_in_t *in = state->in;
+    stack_elem_t *elems = state->stack.elems,
+                 *base  = NULL,
+                 tos    = 0;
+    int depth = state->stack.top + 1;
+    bool_flag_t flag = state->bool_flag;
+    unsigned long long executed = 0;
+    const reg_block_t *block = NULL;
+    const reg_inst_t *ri = NULL;
+    vm_exit_t rc = VM_EXIT_HANDOFF;
+    int32_t index = 0;
+    uint32_t pc = state->pc;
+    int32_t address = 0,
+            source  = 0;
+
+    if (depth > 0) {
+        tos = elems[depth - 1];
+    }
+    index = vm_decoded_index(prog, pc);
+    if (index < 0 || (block = vm_reg_block(rp, index)) == NULL) {
+        return VM_EXIT_HANDOFF;
+    }
+
+    while (1) {
+        if (depth < block->need || depth + block->grow > MAX_STACK) {
+            pc = block->pc;
+            goto handoff;
+        }
+        executed += block->n_src;
+        base = elems + depth;
+
+        ri = block->ir;
+#ifdef REG_USE_COMPUTED_GOTO
+        REG_DISPATCH();
+        {
+            {
+#else
+        for (; ; ri ++) {
+            switch (ri->op) {
+#endif
+            REG_CASE(R_LD):
+                regs[ri->d] = base[ri->a];
+                REG_NEXT();
+
+            REG_CASE(R_LDT):
+                regs[ri->d] = tos;
+                REG_NEXT();
+
+            REG_CASE(R_LI):
+                regs[ri->d] = ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_ADD):
+                regs[ri->d] = (uint32_t)regs[ri->a] + (uint32_t)regs[ri->b];
+                REG_NEXT();
+
+            REG_CASE(R_ADDI):
+                regs[ri->d] = (uint32_t)regs[ri->a] + (uint32_t)ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_SUB):
+                regs[ri->d] = (uint32_t)regs[ri->a] - (uint32_t)regs[ri->b];
+                REG_NEXT();
+
+            REG_CASE(R_SUBI):
+                regs[ri->d] = (uint32_t)regs[ri->a] - (uint32_t)ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_RSUBI):
+                regs[ri->d] = (uint32_t)ri->imm - (uint32_t)regs[ri->a];
+                REG_NEXT();
+
+            REG_CASE(R_MUL):
+                regs[ri->d] = (uint32_t)regs[ri->a] * (uint32_t)regs[ri->b];
+                REG_NEXT();
+
+            REG_CASE(R_MULI):
+                regs[ri->d] = (uint32_t)regs[ri->a] * (uint32_t)ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_DIV):
+                {
+                    const int32_t num1 = regs[ri->a],
+                                  num2 = regs[ri->b];
+
+                    regs[ri->d] = num1 / num2;
+                    regs[ri->imm] = num1 % num2;
+                }
+                REG_NEXT();
+
+            REG_CASE(R_EQ):
+                flag = regs[ri->a] == regs[ri->b] ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_EQI):
+                flag = regs[ri->a] == ri->imm ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_GT):
+                flag = regs[ri->a] > regs[ri->b] ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_GTI):
+                flag = regs[ri->a] > ri->imm ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_LT):
+                flag = regs[ri->a] < regs[ri->b] ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_LTI):
+                flag = regs[ri->a] < ri->imm ? TRUE : FALSE;
+                REG_NEXT();
+
+            REG_CASE(R_SETF):
+                flag = (bool_flag_t)ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_WRTH):
+                vm_out_hex(out, regs[ri->a]);
+                REG_NEXT();
+
+            REG_CASE(R_WRTD):
+                vm_out_dec(out, regs[ri->a]);
+                REG_NEXT();
+
+            REG_CASE(R_WRTC):
+                vm_out_char(out, regs[ri->a]);
+                REG_NEXT();
+
+            REG_CASE(R_REAH):
+                vm_out_flush(out);
+                vm_in_read_hex(in, &state->input);
+                regs[ri->d] = state->input;
+                REG_NEXT();
+
+            REG_CASE(R_READ):
+                vm_out_flush(out);
+                vm_in_read_dec(in, &state->input);
+                regs[ri->d] = state->input;
+                REG_NEXT();
+
+            REG_CASE(R_REAC):
+                vm_out_flush(out);
+                vm_in_read_char(in, (char *)&state->input);
+                regs[ri->d] = state->input;
+                REG_NEXT();
+
+            REG_CASE(R_GET):
+                word = vm_data_index(regs[ri->a]);
+                if (word < data_words) {
+                    regs[ri->d] = data[word];
+                    REG_NEXT();
+                }
+                address = vm_data_address(prog, regs[ri->a]);
+                if (address < 0) {
+                    /* Only ever the first instruction of its block. */
+                    pc = block->pc;
+                    goto handoff;
+                }
+                vm_get_integer_from_bytecode(&code[address], &regs[ri->d]);
+                REG_NEXT();
+
+            REG_CASE(R_GETI):
+                vm_get_integer_from_bytecode(&code[ri->imm], &regs[ri->d]);
+                REG_NEXT();
+
+            REG_CASE(R_GETW):
+                regs[ri->d] = data[ri->imm];
+                REG_NEXT();
+
+            REG_CASE(R_PUT):
+                word = vm_data_index(regs[ri->a]);
+                if (word < data_words) {
+                    data[word] = regs[ri->b];
+                    REG_NEXT();
+                }
+                address = vm_data_address(prog, regs[ri->a]);
+                if (address < 0 || vm_hits_code(prog, address)) {
+                    /* Only ever the first instruction of its block. */
+                    pc = block->pc;
+                    goto handoff;
+                }
+                vm_put_integer_to_bytecode(&code[address], regs[ri->b]);
+                REG_NEXT();
+
+            REG_CASE(R_PUTI):
+                vm_put_integer_to_bytecode(&code[ri->imm], regs[ri->a]);
+                REG_NEXT();
+
+            REG_CASE(R_PUTW):
+                data[ri->imm] = regs[ri->a];
+                REG_NEXT();
+
+            REG_CASE(R_READN):
+                address = vm_data_range(prog, regs[ri->a], regs[ri->b]);
+                if (address < 0) {
+                    /* Only ever the first instruction of its block. */
+                    pc = block->pc;
+                    goto handoff;
+                }
+                vm_out_flush(out);
+                regs[ri->d] = vm_in_read_words(in, &data[address],
+                                               regs[ri->b]);
+                REG_NEXT();
+
+            REG_CASE(R_WRTS):
+                address = vm_data_string(prog, data, regs[ri->a]);
+                if (address < 0) {
+                    /* Only ever the first instruction of its block. */
+                    pc = block->pc;
+                    goto handoff;
+                }
+                vm_out_words(out, &data[vm_data_index(regs[ri->a])],
+                             address);
+                REG_NEXT();
+
+            REG_CASE(R_MCPY):
+                address = vm_data_range(prog, regs[ri->a], regs[ri->b]);
+                source = vm_data_range(prog, regs[ri->imm], regs[ri->b]);
+                if (address < 0 || source < 0) {
+                    pc = block->pc;
+                    goto handoff;
+                }
+                memmove(&data[address], &data[source],
+                        (size_t)regs[ri->b] * sizeof(int32_t));
+                REG_NEXT();
+
+            REG_CASE(R_MSET):
+                address = vm_data_range(prog, regs[ri->a], regs[ri->b]);
+                if (address < 0) {
+                    pc = block->pc;
+                    goto handoff;
+                }
+                vm_data_fill(&data[address], regs[ri->b], regs[ri->imm]);
+                REG_NEXT();
+
+            REG_CASE(R_ST):
+                base[ri->d] = regs[ri->a];
+                REG_NEXT();
+
+            REG_CASE(R_STI):
+                base[ri->d] = ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_STT):
+                tos = regs[ri->a];
+                REG_NEXT();
+
+            REG_CASE(R_STTI):
+                tos = ri->imm;
+                REG_NEXT();
+
+            REG_CASE(R_LDTOP):
+                if (depth + ri->d >= 0) {
+                    tos = base[ri->d];
+                }
+                REG_NEXT();
+
+            REG_CASE(R_SPILL):
+                if (depth > 0) {
+                    base[-1] = tos;
+                }
+                REG_NEXT();
+
+            REG_CASE(R_FALL):
+                depth += block->delta;
+                index = block->next;
+                goto next_block;
+
+            REG_CASE(R_JMP):
+                depth += block->delta;
+                index = block->target;
+                goto next_block;
+
+            REG_CASE(R_JMPIF):
+                depth += block->delta;
+                index = flag == TRUE ? block->target : block->next;
+                goto next_block;
+
+            REG_CASE(R_JMPUN):
+                depth += block->delta;
+                index = flag == FALSE ? block->target : block->next;
+                goto next_block;
+
+            REG_CASE(R_JMPR):
+            REG_CASE(R_JMPRIF):
+            REG_CASE(R_JMPRUN):
+                depth += block->delta;
+                index = vm_decoded_index(prog, regs[ri->a]);
+                if (index < 0) {
+                    /* Put the bad target back for the interpreter. */
+                    if (depth > 0) {
+                        elems[depth - 1] = tos;
+                    }
+                    tos = regs[ri->a];
+                    depth ++;
+                    pc = block->term_pc;
+                    goto handoff;
+                }
+                if ((ri->op == R_JMPRIF && flag != TRUE) ||
+                    (ri->op == R_JMPRUN && flag != FALSE)) {
+                    index = block->next;
+                }
+                goto next_block;
+
+            REG_CASE(R_END):
+                depth += block->delta;
+                pc = block->term_pc;
+                rc = VM_EXIT_END;
+                goto handoff;
+
+            REG_CASE(R_HANDOFF):
+#ifndef REG_USE_COMPUTED_GOTO
+            default:
+#endif
+                pc = block->pc;
+                goto handoff;
+            }
+        }
+
+next_block:
+
+        if ((block = vm_reg_block(rp, index)) == NULL) {
+            pc = prog->insts[index].pc;
+            goto handoff;
+        }
+    }
+
+handoff:
+    if (depth > 0) {
+        elems[depth - 1] = tos;
+    }
+    state->stack.top = depth - 1;
+    state->bool_flag = flag;
+    state->pc = pc;
+    rp->executed += executed;
+    return rc;
+}
+
+/**
+ * Print what the translator did and how much of the program it ran.
+ *
+ * @param  fp
+ * @param  rp
+ */
+void vm_reg_print_stats (FILE *fp, const reg_prog_t *rp)
+{
+    assert(fp != NULL);
+    assert(rp != NULL);
+
+    fprintf(fp, "%-16s %u\n", "blocks", rp->n_blocks);
+    fprintf(fp, "%-16s %u bytecode, %u IR\n", "translated", rp->n_src,
+            rp->n_ir);
+    fprintf(fp, "%-16s %llu\n", "executed", rp->executed);
+}
+
+/**
+ * Free a register program and all its blocks.
+ *
+ * @param  rp
+ */
+void vm_reg_free (reg_prog_t *rp)
+{
+    int i = 0;
+
+    if (rp == NULL) {
+        return;
+    }
+    if (rp->blocks != NULL) {
+        for (i = 0; i <= rp->prog->n_insts; i ++) {
+            free(rp->blocks[i]);
+        }
+    }
+    free(rp->blocks);
+    free(rp->leader);
+    free(rp->scratch);
+    free(rp);
+}
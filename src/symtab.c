@@ -0,0 +1,306 @@
+/**
+ * symtab.c
+ * Purpose: The label table of the compiler, hashed by name.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "headers/symtab.h"
+#include "headers/enums.h"
+
+/* Bytes of names per block, more for a longer name. */
+#define NAME_BLOCK_LEN  65536
+
+struct NAME_BLOCK {
+    struct NAME_BLOCK *next;
+    size_t             used;
+    size_t             size;
+    char               bytes[];
+};
+
+/**
+ * FNV-1a hash of a label name.
+ */
+static uint32_t vm_symtab_hash (const char *name, const size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+
+    for (i = 0; i < len; i ++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Create an empty label table.
+ *
+ * @param[out]  tab
+ *
+ * @return      FAILURE if out of memory.
+ */
+status_t vm_symtab_init (symtab_t *tab)
+{
+    uint32_t i = 0;
+
+    assert(tab != NULL);
+
+    tab->labels = NULL;
+    tab->len = 0;
+    tab->capacity = 0;
+    tab->names = NULL;
+    tab->n_buckets = 64;
+    tab->buckets = (int32_t *)malloc(tab->n_buckets * sizeof(int32_t));
+    if (tab->buckets == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    for (i = 0; i < tab->n_buckets; i ++) {
+        tab->buckets[i] = -1;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Free a label table and its names.
+ *
+ * @param  tab
+ */
+void vm_symtab_free (symtab_t *tab)
+{
+    struct NAME_BLOCK *block = NULL;
+
+    assert(tab != NULL);
+
+    while (tab->names != NULL) {
+        block = tab->names;
+        tab->names = block->next;
+        free(block);
+    }
+    free(tab->labels);
+    free(tab->buckets);
+    tab->labels = NULL;
+    tab->buckets = NULL;
+    tab->len = 0;
+    tab->capacity = 0;
+}
+
+/**
+ * The bucket holding a label name, or the empty one it would go in.
+ */
+static uint32_t vm_symtab_bucket (const symtab_t *tab, const char *name,
+                                  const size_t len)
+{
+    const uint32_t mask = tab->n_buckets - 1;
+    uint32_t i = vm_symtab_hash(name, len) & mask;
+
+    while (tab->buckets[i] >= 0 &&
+           (strncmp(tab->labels[tab->buckets[i]].label, name, len) != 0 ||
+            tab->labels[tab->buckets[i]].label[len] != '\0')) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * Find a label by name.
+ *
+ * @param  tab
+ * @param  name            Without the ':' or '&', need not be NUL
+ *                         terminated.
+ * @param  len             The length of name.
+ *
+ * @return                 The label, NULL if it was never defined or
+ *                         referenced.
+ */
+label_t *vm_symtab_find (const symtab_t *tab, const char *name,
+                         const size_t len)
+{
+    int32_t id = 0;
+
+    assert(tab != NULL);
+    assert(name != NULL);
+
+    id = tab->buckets[vm_symtab_bucket(tab, name, len)];
+    return id >= 0 ? &tab->labels[id] : NULL;
+}
+
+/**
+ * Copy a name into the name blocks of the table.
+ *
+ * @return  The copy, NULL if out of memory.
+ */
+static char *vm_symtab_intern (symtab_t *tab, const char *name,
+                               const size_t len)
+{
+    struct NAME_BLOCK *block = tab->names;
+    char *copy = NULL;
+
+    if (block == NULL || block->size - block->used < len + 1) {
+        const size_t size = len >= NAME_BLOCK_LEN ? len + 1 : NAME_BLOCK_LEN;
+
+        block = (struct NAME_BLOCK *)malloc(sizeof(struct NAME_BLOCK) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = tab->names;
+        block->used = 0;
+        block->size = size;
+        tab->names = block;
+    }
+    copy = &block->bytes[block->used];
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    return copy;
+}
+
+/**
+ * Double the buckets of a table and hash every label again.
+ *
+ * @return  FAILURE if out of memory.
+ */
+static status_t vm_symtab_grow (symtab_t *tab)
+{
+    const uint32_t n_buckets = tab->n_buckets * 2;
+    int32_t *buckets = NULL;
+    uint32_t i = 0;
+    int id = 0;
+
+    buckets = (int32_t *)malloc(n_buckets * sizeof(int32_t));
+    if (buckets == NULL) {
+        return FAILURE;
+    }
+    for (i = 0; i < n_buckets; i ++) {
+        buckets[i] = -1;
+    }
+    free(tab->buckets);
+    tab->buckets = buckets;
+    tab->n_buckets = n_buckets;
+    for (id = 0; id < tab->len; id ++) {
+        const char *label = tab->labels[id].label;
+
+        tab->buckets[vm_symtab_bucket(tab, label, strlen(label))] = id;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Add a label that is neither defined nor referenced yet.
+ *
+ * @return  The label, NULL if out of memory.
+ */
+static label_t *vm_symtab_add (symtab_t *tab, const char *name,
+                               const size_t len)
+{
+    label_t *label = NULL;
+    uint32_t bucket = 0;
+
+    if (2 * ((uint32_t)tab->len + 1) > tab->n_buckets &&
+        vm_symtab_grow(tab) == FAILURE) {
+        return NULL;
+    }
+    if (tab->len == tab->capacity) {
+        const int capacity = tab->capacity ? 2 * tab->capacity : 16;
+        label_t *grown = (label_t *)realloc(tab->labels,
+                                            capacity * sizeof(label_t));
+        if (grown == NULL) {
+            return NULL;
+        }
+        tab->labels = grown;
+        tab->capacity = capacity;
+    }
+
+    label = &tab->labels[tab->len];
+    label->label = vm_symtab_intern(tab, name, len);
+    if (label->label == NULL) {
+        return NULL;
+    }
+    label->line_num = 0;
+    label->ref_line = 0;
+    label->pc = 0;
+    label->id = tab->len;
+    label->in_code = 0;
+
+    bucket = vm_symtab_bucket(tab, name, len);
+    assert(tab->buckets[bucket] < 0);
+    tab->buckets[bucket] = tab->len++;
+    return label;
+}
+
+/**
+ * Define a label, which may have been referenced already.
+ *
+ * @param[in,out]  tab
+ * @param[in]      name      Without the ':'.
+ * @param[in]      len       The length of name.
+ * @param[in]      line_num  Where it is defined.
+ * @param[out]     label     The label, to set its offset.
+ *
+ * @return                   FAILURE if it is already defined or out of
+ *                           memory.
+ */
+status_t vm_symtab_define (symtab_t *tab, const char *name, const size_t len,
+                           const unsigned int line_num, label_t **label)
+{
+    assert(tab != NULL);
+    assert(name != NULL);
+    assert(label != NULL);
+
+    *label = vm_symtab_find(tab, name, len);
+    if (*label == NULL) {
+        *label = vm_symtab_add(tab, name, len);
+        if (*label == NULL) {
+            fprintf(stderr, "\nError: Not enough memory for malloc");
+            return FAILURE;
+        }
+    } else if ((*label)->line_num != 0) {
+        fprintf(stderr,
+                "\nERROR: Label %s redefined in line number %d, "
+                "earlier definition was here %d\n",
+                (*label)->label, line_num, (*label)->line_num);
+        return FAILURE;
+    }
+    (*label)->line_num = line_num;
+    return SUCCESS;
+}
+
+/**
+ * Look up a label for a PUSH &label, adding it undefined if it is not in
+ * the table yet.
+ *
+ * @param[in,out]  tab
+ * @param[in]      name      Without the '&'.
+ * @param[in]      len       The length of name.
+ * @param[in]      line_num  Where it is referenced.
+ * @param[out]     label
+ *
+ * @return                   FAILURE if out of memory.
+ */
+status_t vm_symtab_reference (symtab_t *tab, const char *name,
+                              const size_t len, const unsigned int line_num,
+                              label_t **label)
+{
+    assert(tab != NULL);
+    assert(name != NULL);
+    assert(label != NULL);
+
+    *label = vm_symtab_find(tab, name, len);
+    if (*label == NULL) {
+        *label = vm_symtab_add(tab, name, len);
+        if (*label == NULL) {
+            fprintf(stderr, "\nError: Not enough memory for malloc");
+            return FAILURE;
+        }
+    }
+    if ((*label)->ref_line == 0) {
+        (*label)->ref_line = line_num;
+    }
+    return SUCCESS;
+}
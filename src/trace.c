@@ -0,0 +1,158 @@
+/**
+ * trace.c
+ * Purpose: The ring buffer of vm --trace, and dumping it.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "headers/libvm.h"
+#include "headers/trace.h"
+#include "headers/enums.h"
+
+/* Records converted to little endian per write() by vm_trace_dump(). */
+#define VM_TRACE_CHUNK 256
+
+/**
+ * Create a trace that keeps the last n_records instructions.
+ *
+ * @param[out]  trace
+ * @param[in]   n_records  Rounded up to a power of 2, 0 for
+ *                         VM_TRACE_DEFAULT_RECORDS.
+ *
+ * @return      FAILURE if out of memory.
+ */
+status_t vm_trace_create (vm_trace_t **trace, uint32_t n_records)
+{
+    uint64_t size = 1;
+
+    assert(trace != NULL);
+
+    if (n_records == 0) {
+        n_records = VM_TRACE_DEFAULT_RECORDS;
+    }
+    while (size < n_records) {
+        size *= 2;
+    }
+    *trace = (vm_trace_t *)calloc(1, sizeof(vm_trace_t));
+    if (*trace != NULL) {
+        (*trace)->ring = (vm_trace_record_t *)malloc(
+                size * sizeof(vm_trace_record_t));
+    }
+    if (*trace == NULL || (*trace)->ring == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        free(*trace);
+        *trace = NULL;
+        return FAILURE;
+    }
+    (*trace)->mask = size - 1;
+    (*trace)->n = 0;
+    return SUCCESS;
+}
+
+/**
+ * Free a trace.
+ *
+ * @param  trace           May be NULL.
+ */
+void vm_trace_destroy (vm_trace_t *trace)
+{
+    if (trace != NULL) {
+        free(trace->ring);
+        free(trace);
+    }
+}
+
+static void vm_put_le (unsigned char *bytes, uint64_t value, const int len)
+{
+    int i = 0;
+
+    for (i = 0; i < len; i ++) {
+        bytes[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+/**
+ * write() all of buf, unless it fails.
+ */
+static int vm_write_all (const int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        const ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+ * Write the records in a trace, oldest first, to a file in the format of
+ * trace.h. Only calls functions that are safe in a signal handler, so it
+ * can dump the trace of a program that is stopped or crashed by a signal.
+ *
+ * @param  trace
+ * @param  fn              The dump file, replaced if it exists.
+ *
+ * @return                 The error status.
+ */
+status_t vm_trace_dump (const vm_trace_t *trace, const char *fn)
+{
+    static const char error[] = "\nERROR: could not write the trace\n";
+    unsigned char buf[VM_TRACE_CHUNK * VM_TRACE_RECORD_LEN];
+    const uint64_t n = trace->n;
+    const uint64_t kept = n <= trace->mask ? n : trace->mask + 1;
+    uint64_t i = 0;
+    size_t len = 0;
+    int ok = 1,
+        fd = -1;
+
+    assert(trace != NULL);
+    assert(fn != NULL);
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ok = 0;
+    } else {
+        memcpy(buf, "VMT", 3);
+        buf[3] = VM_TRACE_VERSION;
+        vm_put_le(&buf[4], VM_TRACE_RECORD_LEN, 4);
+        vm_put_le(&buf[8], n, 8);
+        vm_put_le(&buf[16], kept, 8);
+        ok = vm_write_all(fd, buf, VM_TRACE_HEADER_LEN);
+
+        for (i = n - kept; i < n && ok; i ++) {
+            const vm_trace_record_t *r = &trace->ring[i & trace->mask];
+
+            vm_put_le(&buf[len], r->pc, 4);
+            vm_put_le(&buf[len + 4], (uint32_t)r->tos, 4);
+            vm_put_le(&buf[len + 8], r->op, 2);
+            vm_put_le(&buf[len + 10], r->depth, 2);
+            len += VM_TRACE_RECORD_LEN;
+            if (len == sizeof(buf) || i + 1 == n) {
+                ok = vm_write_all(fd, buf, len);
+                len = 0;
+            }
+        }
+        ok = close(fd) == 0 && ok;
+    }
+    if (!ok) {
+        vm_write_all(STDERR_FILENO, (const unsigned char *)error,
+                     sizeof(error) - 1);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
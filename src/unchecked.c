@@ -0,0 +1,348 @@
+/**
+ * unchecked.c
+ * Purpose: Interpret a program that passed vm_verify_program(), with a
+ *          pointer past the top of the stack in a local, checking nothing
+ *          the verifier proved: stack depths and jump targets.
+ *
+ * Addresses given to GET, PUT, READN, WRTS, MCPY and MSET are still
+ * checked, they are data.
+ * On a bad one, and at SNAP, the loop hands the program over to the
+ * interpreter at that instruction, which reports the error or takes the
+ * snapshot. Dispatch is threaded on GNU compatible compilers, like
+ * vm_threaded, and a switch elsewhere.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "headers/constants.h"
+#include "headers/stack.h"
+#include "headers/decode.h"
+#include "headers/unchecked.h"
+#include "headers/vmio.h"
+#include "headers/enums.h"
+
+#ifdef __GNUC__
+#define VM_USE_COMPUTED_GOTO
+#endif
+
+#ifdef VM_USE_COMPUTED_GOTO
+#define get_dispatch_label_macro(symbol) [symbol] = &&do_##symbol
+#define VM_CASE(symbol) do_##symbol
+#define VM_DISPATCH()   goto *ip->handler
+#else
+#define VM_CASE(symbol) case symbol: do_##symbol
+#define VM_DISPATCH()   continue
+#endif
+
+#define VM_NEXT()       { ip ++; VM_DISPATCH(); }
+#define VM_SKIP(n)      { ip += (n); VM_DISPATCH(); }
+#define VM_JUMP(index)  { ip = &prog->insts[index]; VM_DISPATCH(); }
+
+#ifdef VM_USE_COMPUTED_GOTO
+/* Set by vm_run_unchecked(NULL, ...), like the interpreter's. */
+static const void *const *vm_dispatch_table = NULL;
+#endif
+
+/**
+ * The handler addresses a program must be decoded with to run on
+ * vm_run_unchecked().
+ *
+ * @return                 The table, NULL for switch dispatch.
+ */
+const void *const *vm_unchecked_handlers (void)
+{
+#ifdef VM_USE_COMPUTED_GOTO
+    vm_run_unchecked(NULL, NULL, 0, NULL);
+    return vm_dispatch_table;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Run a verified program, starting from the given state.
+ *
+ * @param  prog            The program, decoded with vm_unchecked_handlers().
+ *                         Only read, any number of runs may share it.
+ * @param  image           The image of this run, with a data segment.
+ * @param  show_stats      Print the superinstruction counts to stderr.
+ * @param  state           The state the verifier started from, updated on
+ *                         return.
+ *
+ * @return                 VM_EXIT_END, or VM_EXIT_HANDOFF if the
+ *                         interpreter must go on from state->pc.
+ */
+vm_exit_t vm_run_unchecked (const decoded_prog_t *prog, vmc_image_t *image,
+                            const int show_stats, vm_state_t *state)
+{
+    int32_t *data = NULL;
+    uint32_t data_words = 0;
+    const decoded_inst_t *ip = NULL;
+    stack_elem_t *sp = NULL;
+    vm_out_t *out = NULL;
+    vm_in_t *in = NULL;
+    bool_flag_t bool_flag = FALSE;
+    stack_elem_t a = 0,
+                 b = 0;
+    int32_t address = 0,
+            source  = 0;
+    uint32_t index = 0;
+    vm_exit_t rc = VM_EXIT_HANDOFF;
+
+#ifdef VM_USE_COMPUTED_GOTO
+    static const void *const dispatch_table[N_OPS] = {
+        BYTECODE_DEF(get_dispatch_label_macro)
+        FUSED_DEF(get_dispatch_label_macro)
+    };
+
+    if (prog == NULL) {
+        vm_dispatch_table = dispatch_table;
+        return VM_EXIT_END;
+    }
+#endif
+
+    data = image->data;
+    data_words = image->data_len / 4;
+    sp = &state->stack.elems[state->stack.top + 1];
+    out = state->out;
+    in = state->in;
+    bool_flag = state->bool_flag;
+    /* Only a program without instructions verifies without data. */
+    assert(data != NULL || prog->n_insts == 0);
+
+    if (show_stats) {
+        vm_print_fusion_stats(stderr, prog);
+    }
+    ip = &prog->insts[prog->index_of[state->pc]];
+
+#ifdef VM_USE_COMPUTED_GOTO
+    VM_DISPATCH();
+    {
+        {
+#else
+    while (1) {
+        switch (ip->op) {
+#endif
+        VM_CASE(REAH):
+            vm_out_flush(out);
+            vm_in_read_hex(in, &state->input);
+            *sp++ = state->input;
+            VM_NEXT();
+
+        VM_CASE(READ):
+            vm_out_flush(out);
+            vm_in_read_dec(in, &state->input);
+            *sp++ = state->input;
+            VM_NEXT();
+
+        VM_CASE(REAC):
+            vm_out_flush(out);
+            vm_in_read_char(in, (char *)&state->input);
+            *sp++ = state->input;
+            VM_NEXT();
+
+        VM_CASE(WRTH):
+            vm_out_hex(out, *--sp);
+            VM_NEXT();
+
+        VM_CASE(WRTD):
+            vm_out_dec(out, *--sp);
+            VM_NEXT();
+
+        VM_CASE(WRTC):
+            vm_out_char(out, *--sp);
+            VM_NEXT();
+
+        VM_CASE(ADD):
+            sp[-2] = sp[-1] + sp[-2];
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(SUB):
+            sp[-2] = sp[-1] - sp[-2];
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(MUL):
+            sp[-2] = sp[-1] * sp[-2];
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(DIV):
+            a = sp[-1];
+            b = sp[-2];
+            sp[-1] = a / b;
+            sp[-2] = a % b;
+            VM_NEXT();
+
+        VM_CASE(POP):
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(EQU):
+            bool_flag = sp[-1] == sp[-2] ? TRUE : FALSE;
+            VM_NEXT();
+
+        VM_CASE(GRT):
+            bool_flag = sp[-1] > sp[-2] ? TRUE : FALSE;
+            VM_NEXT();
+
+        VM_CASE(LST):
+            bool_flag = sp[-1] < sp[-2] ? TRUE : FALSE;
+            VM_NEXT();
+
+        VM_CASE(GOTO):
+            VM_JUMP(prog->index_of[*--sp]);
+
+        VM_CASE(GOIF):
+            a = *--sp;
+            if (bool_flag == TRUE) {
+                VM_JUMP(prog->index_of[a]);
+            }
+            VM_NEXT();
+
+        VM_CASE(GOUN):
+            a = *--sp;
+            if (bool_flag == FALSE) {
+                VM_JUMP(prog->index_of[a]);
+            }
+            VM_NEXT();
+
+        VM_CASE(END):
+            rc = VM_EXIT_END;
+            goto exit;
+
+        VM_CASE(DUP):
+            sp[0] = sp[-1];
+            sp ++;
+            VM_NEXT();
+
+        VM_CASE(FLIP):
+            a = sp[-1];
+            sp[-1] = sp[-2];
+            sp[-2] = a;
+            VM_NEXT();
+
+        VM_CASE(PUSH):
+            *sp++ = ip->arg;
+            VM_NEXT();
+
+        VM_CASE(GET):
+            index = vm_data_index(sp[-1]);
+            if (index >= data_words) {
+                goto exit;
+            }
+            sp[-1] = data[index];
+            VM_NEXT();
+
+        VM_CASE(PUT):
+            index = vm_data_index(sp[-1]);
+            if (index >= data_words) {
+                goto exit;
+            }
+            data[index] = sp[-2];
+            sp -= 2;
+            VM_NEXT();
+
+        VM_CASE(READN):
+            address = vm_data_range(prog, sp[-1], sp[-2]);
+            if (address < 0) {
+                goto exit;
+            }
+            vm_out_flush(out);
+            sp[-2] = vm_in_read_words(in, &data[address], sp[-2]);
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(WRTS):
+            address = vm_data_string(prog, data, sp[-1]);
+            if (address < 0) {
+                goto exit;
+            }
+            vm_out_words(out, &data[vm_data_index(sp[-1])], address);
+            sp --;
+            VM_NEXT();
+
+        VM_CASE(MCPY):
+            address = vm_data_range(prog, sp[-1], sp[-2]);
+            source = vm_data_range(prog, sp[-3], sp[-2]);
+            if (address < 0 || source < 0) {
+                goto exit;
+            }
+            memmove(&data[address], &data[source],
+                    (size_t)sp[-2] * sizeof(int32_t));
+            sp -= 3;
+            VM_NEXT();
+
+        VM_CASE(MSET):
+            address = vm_data_range(prog, sp[-1], sp[-2]);
+            if (address < 0) {
+                goto exit;
+            }
+            vm_data_fill(&data[address], sp[-2], sp[-3]);
+            sp -= 3;
+            VM_NEXT();
+
+        VM_CASE(NOP):
+            VM_NEXT();
+
+        VM_CASE(PUSH_GOTO):
+            VM_JUMP(ip->target);
+
+        VM_CASE(PUSH_GOIF):
+            if (bool_flag == TRUE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(2);
+
+        VM_CASE(PUSH_GOUN):
+            if (bool_flag == FALSE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(2);
+
+        VM_CASE(PUSH_ADD):
+            sp[-1] += ip->arg;
+            VM_SKIP(2);
+
+        VM_CASE(DUP_WRTD):
+            vm_out_dec(out, sp[-1]);
+            VM_SKIP(2);
+
+        VM_CASE(EQU_PUSH_GOIF):
+            bool_flag = sp[-1] == sp[-2] ? TRUE : FALSE;
+            if (bool_flag == TRUE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(3);
+
+        VM_CASE(EQU_PUSH_GOUN):
+            bool_flag = sp[-1] == sp[-2] ? TRUE : FALSE;
+            if (bool_flag == FALSE) {
+                VM_JUMP(ip->target);
+            }
+            VM_SKIP(3);
+
+        /* SNAP, and what the verifier never lets through. */
+        VM_CASE(SNAP):
+        VM_CASE(ERR):
+        VM_CASE(LAB):
+        VM_CASE(IND):
+#ifndef VM_USE_COMPUTED_GOTO
+        default:
+#endif
+            goto exit;
+        }
+    }
+
+exit:
+    state->stack.top = (int)(sp - state->stack.elems) - 1;
+    state->bool_flag = bool_flag;
+    state->pc = ip->pc;
+    return rc;
+}
@@ -0,0 +1,298 @@
+/**
+ * verify.c
+ * Purpose: Load time verification of a decoded program.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "headers/verify.h"
+#include "headers/constants.h"
+#include "headers/stack.h"
+
+/* What an instruction leaves on top of the stack. */
+typedef enum {
+    VM_TOP_LOST,      /* Something the verifier does not track.   */
+    VM_TOP_KEPT,      /* The same top as before.                  */
+    VM_TOP_PUSHED,    /* Its immediate.                           */
+    VM_TOP_COPIED     /* A copy of the top before.                */
+} vm_top_t;
+
+struct STACK_EFFECT {
+    int8_t   known;   /* 0 for instructions that are never verified. */
+    int8_t   need;    /* Elements it reads.                          */
+    int8_t   delta;   /* Change in depth.                            */
+    uint8_t  top;     /* A vm_top_t.                                 */
+};
+
+static const struct STACK_EFFECT STACK_EFFECTS[N_INST] = {
+    [REAH]  = {1, 0,  1, VM_TOP_LOST},
+    [READ]  = {1, 0,  1, VM_TOP_LOST},
+    [REAC]  = {1, 0,  1, VM_TOP_LOST},
+    [WRTH]  = {1, 1, -1, VM_TOP_LOST},
+    [WRTD]  = {1, 1, -1, VM_TOP_LOST},
+    [WRTC]  = {1, 1, -1, VM_TOP_LOST},
+    [ADD]   = {1, 2, -1, VM_TOP_LOST},
+    [SUB]   = {1, 2, -1, VM_TOP_LOST},
+    [MUL]   = {1, 2, -1, VM_TOP_LOST},
+    [DIV]   = {1, 2,  0, VM_TOP_LOST},
+    [POP]   = {1, 1, -1, VM_TOP_LOST},
+    [EQU]   = {1, 2,  0, VM_TOP_KEPT},
+    [GRT]   = {1, 2,  0, VM_TOP_KEPT},
+    [LST]   = {1, 2,  0, VM_TOP_KEPT},
+    [GOTO]  = {1, 1, -1, VM_TOP_LOST},
+    [GOIF]  = {1, 1, -1, VM_TOP_LOST},
+    [GOUN]  = {1, 1, -1, VM_TOP_LOST},
+    [END]   = {1, 0,  0, VM_TOP_KEPT},
+    [DUP]   = {1, 1,  1, VM_TOP_COPIED},
+    [FLIP]  = {1, 2,  0, VM_TOP_LOST},
+    [PUSH]  = {1, 0,  1, VM_TOP_PUSHED},
+    [NOP]   = {1, 0,  0, VM_TOP_KEPT},
+    [GET]   = {1, 1,  0, VM_TOP_LOST},
+    [PUT]   = {1, 2, -2, VM_TOP_LOST},
+    [READN] = {1, 2, -1, VM_TOP_LOST},
+    [SNAP]  = {1, 0,  0, VM_TOP_KEPT},
+    [WRTS]  = {1, 1, -1, VM_TOP_LOST},
+    [MCPY]  = {1, 3, -3, VM_TOP_LOST},
+    [MSET]  = {1, 3, -3, VM_TOP_LOST},
+};
+
+/* What the verifier knows on entry to an instruction. */
+struct ABSTRACT_STATE {
+    int32_t depth;       /* -1 until a path reaches it.            */
+    int32_t top;         /* The top of the stack, if top_known.    */
+    uint8_t top_known;
+    uint8_t queued;
+};
+
+typedef struct ABSTRACT_STATE abstract_state_t;
+
+/**
+ * The instruction a superinstruction starts with, which is what the
+ * verifier checks: the other instructions of the sequence follow it.
+ */
+static symbol_t vm_base_op (const int op)
+{
+    switch (op) {
+    case PUSH_GOTO:
+    case PUSH_GOIF:
+    case PUSH_GOUN:
+    case PUSH_ADD:
+        return PUSH;
+    case DUP_WRTD:
+        return DUP;
+    case EQU_PUSH_GOIF:
+    case EQU_PUSH_GOUN:
+        return EQU;
+    default:
+        return op < N_INST ? (symbol_t)op : ERR;
+    }
+}
+
+/**
+ * Record the outcome of a program that did not verify.
+ *
+ * @return  The verdict, to return it.
+ */
+static vm_verdict_t vm_verify_fail (vm_verify_result_t *result,
+                                    const vm_verdict_t verdict,
+                                    const uint32_t pc, const char *reason)
+{
+    result->verdict = verdict;
+    result->pc = pc;
+    result->reason = reason;
+    return verdict;
+}
+
+/**
+ * Merge the state after an instruction into the state on entry to its
+ * successor, queueing the successor if that taught the verifier
+ * something new.
+ *
+ * @return  0 if the stack depths differ.
+ */
+static int vm_verify_merge (abstract_state_t *states, int32_t *worklist,
+                            int *n_work, const int32_t next,
+                            const int32_t depth, const int top_known,
+                            const int32_t top)
+{
+    abstract_state_t *s = &states[next];
+
+    if (s->depth < 0) {
+        s->depth = depth;
+        s->top_known = top_known;
+        s->top = top;
+    } else if (s->depth != depth) {
+        return 0;
+    } else if (s->top_known && (!top_known || s->top != top)) {
+        s->top_known = 0;
+    } else {
+        return 1;
+    }
+    if (!s->queued) {
+        s->queued = 1;
+        worklist[(*n_work)++] = next;
+    }
+    return 1;
+}
+
+/**
+ * Verify a program decoded without superinstructions, from the given
+ * start, as described in verify.h.
+ *
+ * @param[in]   prog         The decoded program.
+ * @param[in]   start_pc     Byte offset of the first instruction run.
+ * @param[in]   start_depth  Elements on the stack then, those of a
+ *                           snapshot. Their values are unknown.
+ * @param[out]  result       The verdict, and why if not verified.
+ *
+ * @return                   FAILURE if out of memory.
+ */
+status_t vm_verify_program (const decoded_prog_t *prog,
+                            const uint32_t start_pc, const int start_depth,
+                            vm_verify_result_t *result)
+{
+    abstract_state_t *states = NULL;
+    int32_t *worklist = NULL;
+    int32_t start = 0,
+            i = 0;
+    int n_work = 0;
+
+    assert(prog != NULL);
+    assert(result != NULL);
+    assert(start_depth >= 0 && start_depth <= MAX_STACK);
+
+    memset(result, 0, sizeof(vm_verify_result_t));
+    result->verdict = VM_VERIFIED;
+    result->max_depth = start_depth;
+
+    if (start_pc == (uint32_t)prog->code_len) {
+        /* No instructions, the program ends as soon as it starts. */
+        return SUCCESS;
+    }
+    start = vm_decoded_index(prog, (int32_t)start_pc);
+    if (start < 0) {
+        vm_verify_fail(result, VM_INVALID, start_pc,
+                       "start is not an instruction");
+        return SUCCESS;
+    }
+    if (!prog->has_data) {
+        /* PUT may rewrite the code of older images. */
+        vm_verify_fail(result, VM_UNVERIFIABLE, start_pc,
+                       "no data segment");
+        return SUCCESS;
+    }
+
+    states = (abstract_state_t *)malloc((prog->n_insts + 1) *
+                                        sizeof(abstract_state_t));
+    worklist = (int32_t *)malloc((prog->n_insts + 1) * sizeof(int32_t));
+    if (states == NULL || worklist == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        free(states);
+        free(worklist);
+        return FAILURE;
+    }
+    memset(states, 0, (prog->n_insts + 1) * sizeof(abstract_state_t));
+    for (i = 0; i <= prog->n_insts; i ++) {
+        states[i].depth = -1;
+    }
+    vm_verify_merge(states, worklist, &n_work, start, start_depth, 0, 0);
+
+    /*
+     * Both arms of every GOIF and GOUN are followed, whether or not the
+     * program ever takes them, so a finding on a path is no proof the
+     * program fails: any finding only makes it unverifiable. Exploring
+     * stops at the first, the verdict is the same whichever it is.
+     */
+    while (n_work > 0 && result->verdict == VM_VERIFIED) {
+        const int32_t at = worklist[--n_work];
+        const decoded_inst_t *inst = &prog->insts[at];
+        const symbol_t op = vm_base_op(inst->op);
+        const struct STACK_EFFECT *effect = &STACK_EFFECTS[op];
+        abstract_state_t *s = &states[at];
+        const int32_t depth = s->depth + effect->delta;
+        int32_t target = -1;
+        int top_known = 0;
+        int32_t top = 0;
+
+        s->queued = 0;
+        if (!effect->known) {
+            vm_verify_fail(result, VM_UNVERIFIABLE, inst->pc,
+                           "invalid instruction");
+            break;
+        }
+        if (s->depth < effect->need) {
+            vm_verify_fail(result, VM_UNVERIFIABLE, inst->pc,
+                           "stack underflow");
+            break;
+        }
+        if (depth > MAX_STACK) {
+            vm_verify_fail(result, VM_UNVERIFIABLE, inst->pc,
+                           "stack overflow");
+            break;
+        }
+        if (depth > result->max_depth) {
+            result->max_depth = depth;
+        }
+
+        if (op == GOTO || op == GOIF || op == GOUN) {
+            if (!s->top_known) {
+                vm_verify_fail(result, VM_UNVERIFIABLE, inst->pc,
+                               "jump to a computed address");
+                break;
+            }
+            target = vm_decoded_index(prog, s->top);
+            if (target < 0) {
+                vm_verify_fail(result, VM_UNVERIFIABLE, inst->pc,
+                               "jump to an address that is not an"
+                               " instruction");
+                break;
+            }
+            if (!vm_verify_merge(states, worklist, &n_work, target, depth,
+                                 0, 0)) {
+                vm_verify_fail(result, VM_UNVERIFIABLE,
+                               prog->insts[target].pc,
+                               "stack depth differs between paths");
+                break;
+            }
+            if (op == GOTO) {
+                continue;
+            }
+        }
+        if (op == END) {
+            continue;
+        }
+
+        switch (effect->top) {
+        case VM_TOP_KEPT:
+        case VM_TOP_COPIED:
+            top_known = s->top_known;
+            top = s->top;
+            break;
+        case VM_TOP_PUSHED:
+            top_known = 1;
+            top = inst->arg;
+            break;
+        default:
+            break;
+        }
+        /* The END sentinel follows the last instruction. */
+        if (!vm_verify_merge(states, worklist, &n_work, at + 1, depth,
+                             top_known, top)) {
+            vm_verify_fail(result, VM_UNVERIFIABLE, prog->insts[at + 1].pc,
+                           "stack depth differs between paths");
+            break;
+        }
+    }
+
+    for (i = 0; i <= prog->n_insts; i ++) {
+        result->reached += states[i].depth >= 0;
+    }
+    free(states);
+    free(worklist);
+    return SUCCESS;
+}
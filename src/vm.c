@@ -1,392 +1,241 @@
 /**
  * vm.c
- * Purpose: Interpret a .vmc file.
+ * Purpose: Interpret a .vmc file. A thin command line wrapper around
+ *          libvm, see libvm.h.
  *
  * @author Nishanth H. Kottary
  */
 
 #include <stdio.h>
 #include <string.h>
-#include <malloc.h>
-#include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-#include "headers/constants.h"
-#include "headers/stack.h"
+#include "headers/batch.h"
+#include "headers/libvm.h"
 #include "headers/enums.h"
 
-#define CHECK_NOT_ENOUGH_MEMORY_ERROR(ptr)                        \
-    if (ptr == NULL) {                                            \
-        fprintf(stderr, "\nError: Not enough memory for malloc"); \
-        return -1;                                                \
-    }
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define VM_MMAP_STDIN
+#define VM_TRACE_SIGNALS
+#endif
 
-int main (int argc, char *argv[]) 
-{  
-    if (argc != 2) {
-        printf("\nUSAGE: vm <vmc file>\n");
-        return 0;
-    }
+/* The trace of vm --trace, for the signal handler to dump. */
+static vm_trace_t *vm_active_trace = NULL;
+static const char *vm_trace_fn = NULL;
 
-    FILE *fp = fopen(argv[1], "rb");
-    if (fp == NULL) {
-        fprintf(stderr, "\nERROR: could not open file %s\n", argv[1]);
-        return -1;
+#ifdef VM_TRACE_SIGNALS
+/**
+ * Dump the trace. SIGUSR1 lets the program carry on, any other signal
+ * then does what it would have done without the handler, e.g. stops the
+ * program or dumps core.
+ */
+static void vm_trace_signal (int sig)
+{
+    vm_trace_dump(vm_active_trace, vm_trace_fn);
+    if (sig != SIGUSR1) {
+        signal(sig, SIG_DFL);
+        raise(sig);
     }
+}
 
-    bytecode_t compiled_code[MAX_CODE_LEN], 
-               code_len   = 0, 
-               code_start = 0,
-               pc         = 0;
-    Stack *stk = newStack();
-    bool_flag_t bool_flag   = FALSE;
-    error_flag_t error_flag = NO_ERROR;
-    int input = 0;
-    int *stack_val = NULL, 
-        *num1      = NULL, 
-        *num2      = NULL;
-
-    fread(&code_start, sizeof (bytecode_t), 1, fp);
-    fread(&code_len, sizeof (bytecode_t), 1, fp);
-    fread(compiled_code, sizeof (bytecode_t), code_len, fp);
-    fclose(fp);
-  
-    for (pc = code_start; pc < code_len; pc ++) {
-        symbol_t inst = get_inst(compiled_code[pc]);
-        switch (inst) {
-        case REAH:
-            stack_val = (int *)malloc(sizeof(int));
-            CHECK_NOT_ENOUGH_MEMORY_ERROR(stack_val);
-            scanf("%08x", &input);
-            *stack_val = input;
-            if (push(stk, (void *)stack_val) == FAILURE) {
-                fprintf(stderr, "\nError: Stack overflow error."
-                        " in byte number %d, instruction REAH", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case READ:
-            stack_val = (int *)malloc(sizeof(int));
-            CHECK_NOT_ENOUGH_MEMORY_ERROR(stack_val);
-            scanf("%d", &input);
-            *stack_val = input;
-            if (push(stk, (void *)stack_val) == FAILURE) {
-                fprintf(stderr, "\nError: Stack overflow error."
-                        " in byte number %d, instruction READ", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case REAC:
-            stack_val = (int *)malloc(sizeof(int));
-            CHECK_NOT_ENOUGH_MEMORY_ERROR(stack_val);
-            scanf("%c", (char *)&input);
-            *stack_val = input;
-            if (push(stk, (void *)stack_val) == FAILURE) {
-                fprintf(stderr, "\nError: Stack overflow error."
-                        " in byte number %d, instruction REAC", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case WRTH:
-            stack_val = pop(stk);
-            if (stack_val) {
-                printf("%08x", *stack_val);
-                free(stack_val);
-            } else {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction WRTH", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case WRTD:
-            stack_val = pop(stk);
-            if (stack_val) {
-                printf("%d", *stack_val);
-                free(stack_val);
-            } else {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction WRTD", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case WRTC:
-            stack_val = pop(stk);
-            if (stack_val) {
-                printf("%c", *stack_val);
-                free(stack_val);
-            } else {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction WRTC", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case ADD:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction ADD", pc);
-                error_flag = ERROR;
-            } else {
-                *num2 = (*num1) + (*num2);
-                free(num1);
-            }
-            break;
-
-        case SUB:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction SUB", pc);
-                error_flag = ERROR;
-            } else {
-                *num2 = (*num1) - (*num2);
-
-                free(num1);
-            }
-            break;
-
-        case MUL:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction MUL", pc);
-                error_flag = ERROR;
-            } else {
-                *num2 = (*num1) * (*num2);
-
-                free(num1);
-            }
-            break;
-
-        case DIV:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction DIV", pc);
-                error_flag = ERROR;
-            } else {
-                int _num1, _num2;
-                _num1 = *num1;
-                _num2 = *num2;
-                *num1 = _num1 / _num2;
-                *num2 = _num1 % _num2;
-                push(stk, (void *)num1);
-
-            }
-            break;
-
-        case POP:
-            stack_val = pop(stk);
-            if (stack_val == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction POP", pc);
-                error_flag = ERROR;
-            } else {
-                free(stack_val);
-            }
-            break;
-
-        case EQU:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction EQU", pc);
-                error_flag = ERROR;
-            } else {
-                if (*num1 == *num2) {
-                    bool_flag = TRUE;
-                } else {
-                    bool_flag = FALSE;
-                }
-                push(stk, (void *)num1);
-            }
-            break;
-
-        case GRT:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction GRT", pc);
-                error_flag = ERROR;
-            } else {
-                if (*num1 > *num2) {
-                    bool_flag = TRUE;
-                } else {
-                    bool_flag = FALSE;
-                }
-                push(stk, (void *)num1);
-            }
-            break;
-
-        case LST:
-            num1 = (int *)pop(stk);
-            num2 = (int *)top(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction LST", pc);
-                error_flag = ERROR;
-            } else {
-                if (*num1 < *num2) {
-                    bool_flag = TRUE;
-                } else {
-                    bool_flag = FALSE;
-                }
-                push(stk, (void *)num1);
-            }
-            break;
-
-        case GOTO:
-            stack_val = (int *)pop(stk);
-            if (stack_val == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction GOTO", pc);
-                error_flag = ERROR;
-            } else if (*stack_val > code_len - 1) {
-                fprintf(stderr, "\nError: GOTO instruction given"
-                        " out of bounds address in byte number %d", pc);
-                error_flag = ERROR;
-            } else {
-                pc = *stack_val - 1;
-                free(stack_val);
-            }
-            break;
-
-        case GOIF:
-            stack_val = (int *)pop(stk);
-            if (stack_val == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction GOIF", pc);
-                error_flag = ERROR;
-            } else if (*stack_val > code_len - 1) {
-                fprintf(stderr, "\nError: GOIF instruction given"
-                        " out of bounds address in byte number %d", pc);
-                error_flag = ERROR;
-            } else {
-                if (bool_flag == TRUE) {
-                    pc = *stack_val - 1;
-                }
-                free(stack_val);
-            }
-            break;
-
-        case GOUN:
-            stack_val = (int *)pop(stk);
-            if (stack_val == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction GOUN", pc);
-                error_flag = ERROR;
-            } else if (*stack_val > code_len - 1) {
-                fprintf(stderr, "\nError: GOUN instruction given"
-                        " out of bounds address in byte number %d", pc);
-                error_flag = ERROR;
-            } else {
-                if (bool_flag == FALSE) {
-                    pc = *stack_val - 1;
-                }
-                free(stack_val);
-            }
-            break;
-
-        case END:
-            freeStack(stk);
-            return 0;
-
-        case DUP:
-            num1 = (int *)top(stk);
-            num2 = (int *)malloc(sizeof(int *));
-            if (num1 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction DUP", pc);
-                error_flag = ERROR;
-            } else {
-                *num2 = *num1;
-
-                if (push(stk, num2) == FAILURE) {
-                    fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction DUP", pc);
-                    error_flag = ERROR;
-                }
-            }
-            break;
-
-        case FLIP:
-            num1 = (int *)pop(stk);
-            num2 = (int *)pop(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction FLIP", pc);
-                error_flag = ERROR;
-            } else {
-                push(stk, num1);
-                push(stk, num2);
-            }
-            break;
-
-        case PUSH:
-            stack_val = (int *)malloc(sizeof(int *));
-            vm_get_integer_from_bytecode(&compiled_code[pc + 1], stack_val);
-            pc += 4;
-            assert(pc < code_len);
-            if (push(stk, (void *)stack_val) == FAILURE) {
-                fprintf(stderr, "\nError: Stack overflow error."
-                        " in byte number %d, instruction PUSH", pc);
-                error_flag = ERROR;
-            }
-            break;
-
-        case GET:
-            num1 = (int *)top(stk);
-            if (num1 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction GET", pc);
-                error_flag = ERROR;
-            } else {
-                vm_get_integer_from_bytecode(&compiled_code[(bytecode_t)*num1], 
-                                             num1);
-            }
-            break;
+/**
+ * Dump the trace when the vm is interrupted, killed or crashes, or on
+ * SIGUSR1.
+ */
+static void vm_trace_on_signals (void)
+{
+    static const int signals[] = {SIGUSR1, SIGINT, SIGTERM, SIGQUIT,
+                                  SIGSEGV, SIGBUS, SIGFPE, SIGABRT};
+    struct sigaction action;
+    size_t i = 0;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = vm_trace_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i ++) {
+        sigaction(signals[i], &action, NULL);
+    }
+}
+#endif
 
-        case PUT:
-            num1 = (int *)pop(stk);
-            num2 = (int *)pop(stk);
-            if (num1 == 0 || num2 == 0) {
-                fprintf(stderr, "\nError: Stack underflow error."
-                        " in byte number %d, instruction PUT", pc);
-                error_flag = ERROR;
-            } else {
-                vm_put_integer_to_bytecode(&compiled_code[(bytecode_t)*num1], 
-                                           *num2);
-            }
-            break;
+/**
+ * Map stdin if it is a regular file, so that reads never copy it. Reads
+ * work without this, through vm_stdin_read().
+ *
+ * @param[out]  io          Gets the rest of stdin as its input.
+ * @param[out]  mapped_len  The length of the mapping.
+ *
+ * @return      The mapping, or NULL if stdin was not mapped.
+ */
+static void *vm_map_stdin (vm_io_t *io, size_t *mapped_len)
+{
+#ifdef VM_MMAP_STDIN
+    struct stat st;
+    off_t offset = 0;
+    void *mapping = NULL;
+
+    if (fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (offset < 0 || offset >= st.st_size) {
+        return NULL;
+    }
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+    io->input = (const char *)mapping + offset;
+    io->input_len = st.st_size - offset;
+    *mapped_len = st.st_size;
+    /* Everything is read from the mapping. */
+    io->read = NULL;
+    return mapping;
+#else
+    (void)io;
+    (void)mapped_len;
+    return NULL;
+#endif
+}
 
-        case NOP:
+int main (int argc, char *argv[]) 
+{  
+    const char *vmc_fn = NULL,
+               *manifest_fn = NULL,
+               *profile_fn = NULL,
+               *trace_fn = NULL;
+    vm_options_t options;
+    vm_io_t io = {vm_stdin_read, vm_stdout_write, NULL, NULL, 0};
+    vm_t *vm = NULL;
+    vm_profile_t *profile = NULL;
+    vm_trace_t *trace = NULL;
+    uint32_t trace_size = 0;
+    void *stdin_mapping = NULL;
+    size_t stdin_mapped_len = 0;
+    status_t rc = FAILURE;
+    int n_threads = 0,
+        restore = 0,
+        i = 0;
+
+    vm_default_options(&options);
+    for (i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "--no-fusion") == 0) {
+            options.fuse = 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.show_stats = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.engine = VM_ENGINE_JIT;
+        } else if (strcmp(argv[i], "--reg") == 0) {
+            options.engine = VM_ENGINE_REG;
+        } else if (strcmp(argv[i], "--no-verify") == 0) {
+            options.verify = 0;
+        } else if (strcmp(argv[i], "--no-mmap") == 0) {
+            options.use_mmap = 0;
+        } else if (strcmp(argv[i], "--unbuffered") == 0) {
+            options.unbuffered = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest_fn = argv[++ i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            n_threads = atoi(argv[++ i]);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            options.snapshot_fn = argv[++ i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_fn = argv[++ i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_fn = argv[++ i];
+        } else if (strcmp(argv[i], "--trace-size") == 0 && i + 1 < argc) {
+            trace_size = (uint32_t)strtoul(argv[++ i], NULL, 10);
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc &&
+                   vmc_fn == NULL) {
+            vmc_fn = argv[++ i];
+            restore = 1;
+        } else if (vmc_fn == NULL) {
+            vmc_fn = argv[i];
+        } else {
+            vmc_fn = NULL;
             break;
+        }
+    }
+    if (manifest_fn != NULL && vmc_fn == NULL &&
+        options.snapshot_fn == NULL && profile_fn == NULL &&
+        trace_fn == NULL) {
+        rc = vm_run_batch(manifest_fn, &options, n_threads);
+        exit(rc == SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (vmc_fn == NULL || manifest_fn != NULL ||
+        (profile_fn != NULL && trace_fn != NULL)) {
+        printf("\nUSAGE: vm [--jit | --reg] [--no-fusion] [--no-verify]"
+               " [--no-mmap]\n          [--unbuffered] [--stats]"
+               " [--snapshot <file>]"
+               "\n          [--profile <json file> | --trace <file>"
+               " [--trace-size n]] <vmc file>"
+               "\n       vm [options] --restore <snapshot>"
+               "\n       vm [options] --batch <manifest> [--threads n]\n");
+        return 0;
+    }
 
-        default:
-            fprintf(stderr, "\n Unexpected or invalid byte code at"
-                    " instruction %d .. exiting\n", pc);
-            error_flag = ERROR;
+    if (profile_fn != NULL) {
+        if (vm_profile_create(&profile) == FAILURE) {
+            return -1;
         }
-        if (error_flag == ERROR) {
-            break;
+        options.profile = profile;
+    }
+    if (trace_fn != NULL) {
+        if (vm_trace_create(&trace, trace_size) == FAILURE) {
+            vm_profile_destroy(profile);
+            return -1;
         }
+        options.trace = trace;
+    }
+    if (vm_create(&vm, &options) == FAILURE) {
+        vm_profile_destroy(profile);
+        vm_trace_destroy(trace);
+        return -1;
     }
-    freeStack(stk);
-    if (error_flag == ERROR) {
-        exit(EXIT_FAILURE);
+    if (vm_load_image(vm, vmc_fn) == FAILURE) {
+        vm_destroy(vm);
+        vm_profile_destroy(profile);
+        vm_trace_destroy(trace);
+        return -1;
+    }
+    if (restore && !vm_is_snapshot(vm)) {
+        fprintf(stderr, "\nERROR: %s is not a snapshot\n", vmc_fn);
+        vm_destroy(vm);
+        vm_profile_destroy(profile);
+        vm_trace_destroy(trace);
+        return -1;
+    }
+    stdin_mapping = vm_map_stdin(&io, &stdin_mapped_len);
+    if (trace != NULL) {
+        vm_active_trace = trace;
+        vm_trace_fn = trace_fn;
+#ifdef VM_TRACE_SIGNALS
+        vm_trace_on_signals();
+#endif
     }
-    exit(EXIT_SUCCESS);
-}
 
+    rc = vm_run(vm, &io);
+    if (trace != NULL && vm_trace_dump(trace, trace_fn) == FAILURE) {
+        rc = FAILURE;
+    }
+    if (profile != NULL &&
+        vm_profile_report(profile, vmc_fn, profile_fn) == FAILURE) {
+        rc = FAILURE;
+    }
+
+#ifdef VM_MMAP_STDIN
+    if (stdin_mapping != NULL) {
+        munmap(stdin_mapping, stdin_mapped_len);
+    }
+#endif
+    vm_destroy(vm);
+    vm_profile_destroy(profile);
+    vm_trace_destroy(trace);
+    exit(rc == SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
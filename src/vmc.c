@@ -0,0 +1,690 @@
+/**
+ * vmc.c
+ * Purpose: Reading and writing .vmc files.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "headers/vmc.h"
+#include "headers/constants.h"
+#include "headers/enums.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define VMC_MMAP_SUPPORTED
+#endif
+
+/* v1 GET and PUT address the image with a single byte. */
+#define VMC_V1_ADDRESS_SPACE 256
+
+static uint32_t vm_get_uint32 (const bytecode_t *bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void vm_put_uint32 (bytecode_t *bytes, const uint32_t value)
+{
+    bytes[0] = (bytecode_t)value;
+    bytes[1] = (bytecode_t)(value >> 8);
+    bytes[2] = (bytecode_t)(value >> 16);
+    bytes[3] = (bytecode_t)(value >> 24);
+}
+
+/**
+ * Fill in the version and segment sizes of an image from a v2, v3 or v4
+ * header.
+ *
+ * @param[out]  image
+ * @param[in]   header   VMC_HEADER_LEN bytes starting with "VM".
+ * @param[in]   fn       The file name, for error messages.
+ *
+ * @return               The error status.
+ */
+static status_t vm_parse_header (vmc_image_t *image, const bytecode_t *header,
+                                 const char *fn)
+{
+    if (header[2] != 'C') {
+        fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+        return FAILURE;
+    }
+    if (header[3] != 2 && header[3] != VMC_VERSION &&
+        header[3] != VMC_SNAPSHOT_VERSION) {
+        fprintf(stderr, "\nERROR: %s has unsupported version %d\n",
+                fn, header[3]);
+        return FAILURE;
+    }
+    image->version = header[3];
+    image->code_len = vm_get_uint32(&header[8]);
+    if (image->version == 2) {
+        image->code_start = vm_get_uint32(&header[4]);
+        if (image->code_start > image->code_len ||
+            image->code_len > VMC_MAX_LEN) {
+            fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+            return FAILURE;
+        }
+    } else {
+        image->data_len = vm_get_uint32(&header[4]);
+        if (image->data_len % 4 != 0 || image->data_len > VMC_MAX_LEN ||
+            image->code_len > VMC_MAX_LEN) {
+            fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Allocate the data segment of a v3 image and fill it from the little
+ * endian words in the file.
+ *
+ * @param  image   A parsed v3 image.
+ * @param  bytes   image->data_len bytes.
+ *
+ * @return         The error status.
+ */
+static status_t vm_load_data (vmc_image_t *image, const bytecode_t *bytes)
+{
+    const uint32_t n_words = image->data_len / 4;
+    uint32_t i = 0;
+
+    /* At least one word, so that data is never NULL for a v3 image. */
+    image->data = (int32_t *)calloc(n_words ? n_words : 1, sizeof(int32_t));
+    if (image->data == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    for (i = 0; i < n_words; i ++) {
+        image->data[i] = (int32_t)vm_get_uint32(&bytes[4 * i]);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Fill in the state a snapshot resumes from.
+ *
+ * @param  image   A parsed v4 image.
+ * @param  bytes   The state, see vmc.h.
+ * @param  len     The number of bytes from the state to the end of file.
+ * @param  fn      The file name, for error messages.
+ *
+ * @return         The error status.
+ */
+static status_t vm_load_state (vmc_image_t *image, const bytecode_t *bytes,
+                               const size_t len, const char *fn)
+{
+    vmc_state_t *state = NULL;
+    uint32_t i = 0;
+
+    if (len < VMC_STATE_LEN) {
+        fprintf(stderr, "\nERROR: %s is truncated\n", fn);
+        return FAILURE;
+    }
+    state = (vmc_state_t *)calloc(1, sizeof(vmc_state_t));
+    if (state == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    state->pc = vm_get_uint32(&bytes[0]);
+    state->bool_flag = (int32_t)vm_get_uint32(&bytes[4]);
+    state->input = (int32_t)vm_get_uint32(&bytes[8]);
+    state->depth = vm_get_uint32(&bytes[12]);
+    if (state->pc > image->code_len || state->depth > MAX_STACK ||
+        len - VMC_STATE_LEN < 4 * (size_t)state->depth) {
+        fprintf(stderr, "\nERROR: corrupt snapshot state in %s\n", fn);
+        free(state);
+        return FAILURE;
+    }
+    for (i = 0; i < state->depth; i ++) {
+        state->stack[i] = (int32_t)vm_get_uint32(&bytes[VMC_STATE_LEN +
+                                                          4 * i]);
+    }
+    image->state = state;
+    return SUCCESS;
+}
+
+/**
+ * Read the data and code segments of a v3 image that follow the header,
+ * and the state of a v4 image that follows them.
+ *
+ * @param  image   A parsed v3 or v4 image.
+ * @param  fp      Positioned after the header.
+ * @param  fn      The file name, for error messages.
+ *
+ * @return         The error status.
+ */
+static status_t vm_read_segments (vmc_image_t *image, FILE *fp, const char *fn)
+{
+    bytecode_t *bytes = (bytecode_t *)malloc(image->data_len + 1);
+    status_t status = FAILURE;
+
+    image->code = (bytecode_t *)malloc(image->code_len + 1);
+    if (bytes == NULL || image->code == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+    } else if (fread(bytes, 1, image->data_len, fp) != image->data_len ||
+               fread(image->code, 1, image->code_len, fp) !=
+               image->code_len) {
+        fprintf(stderr, "\nERROR: %s is truncated\n", fn);
+    } else {
+        status = vm_load_data(image, bytes);
+    }
+    free(bytes);
+
+    if (status == SUCCESS && image->version == VMC_SNAPSHOT_VERSION) {
+        bytecode_t state[VMC_STATE_LEN + 4 * MAX_STACK];
+        status = vm_load_state(image, state, fread(state, 1, sizeof(state),
+                                                   fp), fn);
+    }
+    return status;
+}
+
+/**
+ * Bytes the code of an image takes in memory. Older images keep the data
+ * in front of the code and are zero padded past its end: a v1 GET or PUT
+ * can reach 4 bytes from any byte address, whatever the length of the
+ * code.
+ *
+ * @param  image
+ *
+ * @return          The size, at least code_len.
+ */
+size_t vm_image_code_size (const vmc_image_t *image)
+{
+    if (image->version == 1) {
+        return (image->code_len < VMC_V1_ADDRESS_SPACE
+                ? VMC_V1_ADDRESS_SPACE : image->code_len) + 4;
+    }
+    return image->code_len;
+}
+
+/**
+ * Read a .vmc file of any supported version into heap buffers.
+ *
+ * @param[out]  image   The image, free with vm_free_image().
+ * @param[in]   fn      The file name.
+ *
+ * @return              The error status.
+ */
+status_t vm_read_image (vmc_image_t *image, const char *fn)
+{
+    bytecode_t header[VMC_HEADER_LEN];
+    size_t size = 0;
+    FILE *fp = NULL;
+
+    assert(image != NULL);
+    assert(fn != NULL);
+
+    memset(image, 0, sizeof(vmc_image_t));
+
+    fp = fopen(fn, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", fn);
+        return FAILURE;
+    }
+
+    if (fread(header, 1, 2, fp) != 2) {
+        fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+        fclose(fp);
+        return FAILURE;
+    }
+    if (header[0] == 'V' && header[1] == 'M') {
+        if (fread(&header[2], 1, VMC_HEADER_LEN - 2, fp) !=
+            VMC_HEADER_LEN - 2) {
+            fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+            fclose(fp);
+            return FAILURE;
+        }
+        if (vm_parse_header(image, header, fn) == FAILURE) {
+            fclose(fp);
+            return FAILURE;
+        }
+        if (image->version >= VMC_VERSION) {
+            if (vm_read_segments(image, fp, fn) == FAILURE) {
+                vm_free_image(image);
+                fclose(fp);
+                return FAILURE;
+            }
+            fclose(fp);
+            return SUCCESS;
+        }
+    } else {
+        image->version = 1;
+        image->code_start = header[0];
+        image->code_len = header[1];
+        if (image->code_start > image->code_len) {
+            fprintf(stderr, "\nERROR: corrupt header in %s\n", fn);
+            fclose(fp);
+            return FAILURE;
+        }
+    }
+
+    /* See vm_image_code_size(). */
+    size = vm_image_code_size(image);
+    image->code = (bytecode_t *)calloc(size + 4, sizeof(bytecode_t));
+    if (image->code == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        fclose(fp);
+        return FAILURE;
+    }
+    if (fread(image->code, 1, image->code_len, fp) != image->code_len) {
+        fprintf(stderr, "\nERROR: %s is truncated\n", fn);
+        vm_free_image(image);
+        fclose(fp);
+        return FAILURE;
+    }
+    fclose(fp);
+    return SUCCESS;
+}
+
+/**
+ * Map a .vmc file into memory instead of reading it. The code segment of
+ * a v3 image runs straight from a read-only mapping shared through the
+ * page cache by every process running the file, and only its data
+ * segment is copied. A v2 image, whose PUTs write into the image, gets a
+ * private mapping whose pages are copied when written. Version 1 images,
+ * and files that cannot be mapped, are read with vm_read_image().
+ *
+ * @param[out]  image   The image, free with vm_free_image().
+ * @param[in]   fn      The file name.
+ *
+ * @return              The error status.
+ */
+status_t vm_map_image (vmc_image_t *image, const char *fn)
+{
+#ifdef VMC_MMAP_SUPPORTED
+    struct stat st;
+    bytecode_t *mapping = NULL;
+    size_t body = 0;
+    int fd = -1;
+
+    assert(image != NULL);
+    assert(fn != NULL);
+
+    memset(image, 0, sizeof(vmc_image_t));
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", fn);
+        return FAILURE;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size < VMC_HEADER_LEN) {
+        close(fd);
+        return vm_read_image(image, fn);
+    }
+    mapping = (bytecode_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                 fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return vm_read_image(image, fn);
+    }
+    if (mapping[0] != 'V' || mapping[1] != 'M') {
+        munmap(mapping, st.st_size);
+        return vm_read_image(image, fn);
+    }
+
+    image->mapping = mapping;
+    image->mapped_len = st.st_size;
+    if (vm_parse_header(image, mapping, fn) == FAILURE) {
+        vm_free_image(image);
+        return FAILURE;
+    }
+    body = (size_t)st.st_size - VMC_HEADER_LEN;
+    if (body < image->data_len ||
+        body - image->data_len < image->code_len) {
+        fprintf(stderr, "\nERROR: %s is truncated\n", fn);
+        vm_free_image(image);
+        return FAILURE;
+    }
+    if (image->version >= VMC_VERSION) {
+        if (vm_load_data(image, mapping + VMC_HEADER_LEN) == FAILURE) {
+            vm_free_image(image);
+            return FAILURE;
+        }
+        body -= image->data_len + image->code_len;
+        if (image->version == VMC_SNAPSHOT_VERSION &&
+            vm_load_state(image, mapping + st.st_size - body, body,
+                          fn) == FAILURE) {
+            vm_free_image(image);
+            return FAILURE;
+        }
+    } else if (mprotect(mapping, st.st_size,
+                        PROT_READ | PROT_WRITE) != 0) {
+        vm_free_image(image);
+        return vm_read_image(image, fn);
+    }
+    image->code = mapping + VMC_HEADER_LEN + image->data_len;
+    return SUCCESS;
+#else
+    return vm_read_image(image, fn);
+#endif
+}
+
+/**
+ * Write a .vmc file under a temporary name and rename it, so a VM running
+ * from a mapping of the old file keeps it.
+ *
+ * @param  fn           The file name.
+ * @param  version      VMC_VERSION or VMC_SNAPSHOT_VERSION.
+ * @param  data         The data segment, as little endian words.
+ * @param  data_len     The number of bytes in data, a multiple of 4.
+ * @param  code         The code segment.
+ * @param  code_len     The number of bytes in code.
+ * @param  trailer      What follows the code, e.g. the state of a
+ *                      snapshot.
+ * @param  trailer_len  The number of bytes in trailer.
+ *
+ * @return              The error status.
+ */
+static status_t vm_write_file (const char *fn, const int version,
+                               const bytecode_t *data,
+                               const uint32_t data_len,
+                               const bytecode_t *code,
+                               const uint32_t code_len,
+                               const bytecode_t *trailer,
+                               const size_t trailer_len)
+{
+    bytecode_t header[VMC_HEADER_LEN] = {'V', 'M', 'C'};
+    char *tmp_fn = NULL;
+    FILE *fp = NULL;
+    int ok = 0;
+
+    assert(fn != NULL);
+    assert(data != NULL || data_len == 0);
+    assert(code != NULL);
+    assert(data_len % 4 == 0);
+
+    header[3] = (bytecode_t)version;
+    vm_put_uint32(&header[4], data_len);
+    vm_put_uint32(&header[8], code_len);
+
+    tmp_fn = (char *)malloc(strlen(fn) + 32);
+    if (tmp_fn == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    /* Unique to this process, as other compilers may write the same
+     * output at once. */
+    sprintf(tmp_fn, "%s.tmp.%ld", fn, (long)getpid());
+
+    fp = fopen(tmp_fn, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not create output file %s\n", fn);
+        free(tmp_fn);
+        return FAILURE;
+    }
+    ok = fwrite(header, 1, VMC_HEADER_LEN, fp) == VMC_HEADER_LEN &&
+         fwrite(data, 1, data_len, fp) == data_len &&
+         fwrite(code, 1, code_len, fp) == code_len &&
+         fwrite(trailer, 1, trailer_len, fp) == trailer_len;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp_fn, fn) != 0) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n", fn);
+        remove(tmp_fn);
+        free(tmp_fn);
+        return FAILURE;
+    }
+    free(tmp_fn);
+    return SUCCESS;
+}
+
+/**
+ * Write a version 3 .vmc file.
+ *
+ * @param  fn           The file name.
+ * @param  data         The data segment, as little endian words.
+ * @param  data_len     The number of bytes in data, a multiple of 4.
+ * @param  code         The code segment.
+ * @param  code_len     The number of bytes in code.
+ *
+ * @return              The error status.
+ */
+status_t vm_write_image (const char *fn, const bytecode_t *data,
+                         const uint32_t data_len, const bytecode_t *code,
+                         const uint32_t code_len)
+{
+    return vm_write_file(fn, VMC_VERSION, data, data_len, code, code_len,
+                         NULL, 0);
+}
+
+/**
+ * Write a snapshot, a version 4 .vmc file that resumes from the given
+ * state when loaded.
+ *
+ * @param  fn           The file name.
+ * @param  image        A v3 or v4 image, with its data segment as it is
+ *                      now.
+ * @param  state        The state to resume from.
+ *
+ * @return              The error status.
+ */
+status_t vm_write_snapshot (const char *fn, const vmc_image_t *image,
+                            const vmc_state_t *state)
+{
+    bytecode_t trailer[VMC_STATE_LEN + 4 * MAX_STACK];
+    bytecode_t *data = NULL;
+    uint32_t i = 0;
+    status_t status = FAILURE;
+
+    assert(image != NULL);
+    assert(image->data != NULL);
+    assert(state != NULL);
+    assert(state->depth <= MAX_STACK);
+
+    data = (bytecode_t *)malloc(image->data_len + 1);
+    if (data == NULL) {
+        fprintf(stderr, "\nError: Not enough memory for malloc");
+        return FAILURE;
+    }
+    for (i = 0; i < image->data_len / 4; i ++) {
+        vm_put_uint32(&data[4 * i], (uint32_t)image->data[i]);
+    }
+    vm_put_uint32(&trailer[0], state->pc);
+    vm_put_uint32(&trailer[4], (uint32_t)state->bool_flag);
+    vm_put_uint32(&trailer[8], (uint32_t)state->input);
+    vm_put_uint32(&trailer[12], state->depth);
+    for (i = 0; i < state->depth; i ++) {
+        vm_put_uint32(&trailer[VMC_STATE_LEN + 4 * i],
+                      (uint32_t)state->stack[i]);
+    }
+    status = vm_write_file(fn, VMC_SNAPSHOT_VERSION, data, image->data_len,
+                           image->code, image->code_len, trailer,
+                           VMC_STATE_LEN + 4 * state->depth);
+    free(data);
+    return status;
+}
+
+/**
+ * Free the memory held by an image.
+ *
+ * @param  image
+ */
+void vm_free_image (vmc_image_t *image)
+{
+    assert(image != NULL);
+
+#ifdef VMC_MMAP_SUPPORTED
+    if (image->mapping != NULL) {
+        munmap(image->mapping, image->mapped_len);
+        image->mapping = NULL;
+        image->mapped_len = 0;
+        image->code = NULL;
+    }
+#endif
+    free(image->code);
+    free(image->data);
+    free(image->state);
+    image->code = NULL;
+    image->data = NULL;
+    image->state = NULL;
+    image->code_len = 0;
+    image->code_start = 0;
+    image->data_len = 0;
+}
+
+/**
+ * Write a symbol file.
+ *
+ * @param  fn           The file name.
+ * @param  symbols      The labels.
+ * @param  n            The number of labels.
+ *
+ * @return              The error status.
+ */
+status_t vm_write_symbols (const char *fn, const vmc_symbol_t *symbols,
+                           const int n)
+{
+    FILE *fp = NULL;
+    int ok = 1,
+        i  = 0;
+
+    assert(fn != NULL);
+    assert(symbols != NULL || n == 0);
+
+    fp = fopen(fn, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not create output file %s\n", fn);
+        return FAILURE;
+    }
+    for (i = 0; i < n && ok; i ++) {
+        ok = fprintf(fp, "%s %u %s\n", symbols[i].in_code ? "code" : "data",
+                     symbols[i].offset, symbols[i].name) > 0;
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "\nERROR: could not write output file %s\n", fn);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Read a label name of any length, after the blanks before it.
+ *
+ * @return  The name, to be freed, or NULL at the end of the file or if
+ *          out of memory.
+ */
+static char *vm_read_name (FILE *fp)
+{
+    char *name = NULL;
+    size_t len = 0,
+           capacity = 0;
+    int c = 0;
+
+    do {
+        c = getc(fp);
+    } while (c == ' ' || c == '\t');
+    while (c != EOF && c != '\n' && c != ' ' && c != '\t') {
+        if (len + 1 >= capacity) {
+            char *grown = NULL;
+
+            capacity = capacity ? 2 * capacity : 32;
+            grown = (char *)realloc(name, capacity);
+            if (grown == NULL) {
+                free(name);
+                return NULL;
+            }
+            name = grown;
+        }
+        name[len++] = (char)c;
+        c = getc(fp);
+    }
+    if (name != NULL) {
+        name[len] = '\0';
+    }
+    return name;
+}
+
+/**
+ * Read a symbol file written by vm_write_symbols().
+ *
+ * @param[in]   fn       The file name.
+ * @param[out]  symbols  The labels in the order they are listed, free
+ *                       with vm_free_symbols().
+ * @param[out]  n        The number of labels.
+ *
+ * @return               FAILURE if the file could not be opened or is
+ *                       corrupt, reported on stderr only in the latter
+ *                       case.
+ */
+status_t vm_read_symbols (const char *fn, vmc_symbol_t **symbols, int *n)
+{
+    char segment[5];
+    char *name = NULL;
+    unsigned int offset = 0;
+    vmc_symbol_t *table = NULL;
+    int count    = 0,
+        capacity = 0,
+        rc       = 0;
+    FILE *fp = NULL;
+
+    assert(fn != NULL);
+    assert(symbols != NULL);
+    assert(n != NULL);
+
+    *symbols = NULL;
+    *n = 0;
+    fp = fopen(fn, "r");
+    if (fp == NULL) {
+        return FAILURE;
+    }
+    while ((rc = fscanf(fp, "%4s %u", segment, &offset)) == 2) {
+        name = vm_read_name(fp);
+        if (name == NULL) {
+            rc = 0;
+            break;
+        }
+        if (count == capacity) {
+            vmc_symbol_t *grown = NULL;
+
+            capacity = capacity ? 2 * capacity : 16;
+            grown = (vmc_symbol_t *)realloc(table,
+                                            capacity * sizeof(vmc_symbol_t));
+            if (grown == NULL) {
+                fprintf(stderr, "\nError: Not enough memory for malloc");
+                free(name);
+                break;
+            }
+            table = grown;
+        }
+        table[count].name = name;
+        table[count].offset = offset;
+        table[count].in_code = strcmp(segment, "code") == 0;
+        count ++;
+    }
+    fclose(fp);
+    if (rc != EOF) {
+        if (rc != 2) {
+            fprintf(stderr, "\nERROR: corrupt symbol file %s\n", fn);
+        }
+        vm_free_symbols(table, count);
+        return FAILURE;
+    }
+    *symbols = table;
+    *n = count;
+    return SUCCESS;
+}
+
+/**
+ * Free the labels read by vm_read_symbols().
+ *
+ * @param  symbols      May be NULL.
+ * @param  n            The number of labels.
+ */
+void vm_free_symbols (vmc_symbol_t *symbols, const int n)
+{
+    int i = 0;
+
+    for (i = 0; i < n; i ++) {
+        free(symbols[i].name);
+    }
+    free(symbols);
+}
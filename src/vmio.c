@@ -0,0 +1,229 @@
+/**
+ * vmio.c
+ * Purpose: Buffered program input and output.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+
+#include "headers/vmio.h"
+
+/**
+ * Set up the output buffer of a program.
+ *
+ * @param[out]  out
+ * @param[in]   io          Where the output goes, see vm_io_t.
+ * @param[in]   unbuffered  Write every character and number out at once.
+ */
+void vm_out_init (vm_out_t *out, const vm_io_t *io, const int unbuffered)
+{
+    out->len = 0;
+    out->limit = unbuffered ? 1 : VM_OUT_BUF_LEN - VM_OUT_MAX_ITEM;
+    out->write = io->write;
+    out->ctx = io->ctx;
+}
+
+/**
+ * Hand everything buffered to the write callback, or drop it if there is
+ * none.
+ */
+void vm_out_flush (vm_out_t *out)
+{
+    if (out->len > 0 && out->write != NULL) {
+        out->write(out->ctx, out->buf, out->len);
+    }
+    out->len = 0;
+}
+
+/**
+ * Set up the input of a program: io->input first, then whatever the read
+ * callback returns.
+ *
+ * @param[out]  in
+ * @param[in]   io
+ */
+void vm_in_init (vm_in_t *in, const vm_io_t *io)
+{
+    in->p = io->input != NULL ? io->input : in->buf;
+    in->end = in->p + (io->input != NULL ? io->input_len : 0);
+    in->read = io->read;
+    in->ctx = io->ctx;
+}
+
+/**
+ * Read more input once everything read so far has been parsed.
+ *
+ * @return  0 at the end of input.
+ */
+static int vm_in_refill (vm_in_t *in)
+{
+    size_t n = 0;
+
+    if (in->read == NULL) {
+        return 0;
+    }
+    n = in->read(in->ctx, in->buf, VM_IN_BUF_LEN);
+    if (n == 0) {
+        return 0;
+    }
+    in->p = in->buf;
+    in->end = in->buf + n;
+    return 1;
+}
+
+/**
+ * The next byte of input, without consuming it.
+ *
+ * @return  The byte, or EOF.
+ */
+static inline int vm_in_peek (vm_in_t *in)
+{
+    if (in->p == in->end && !vm_in_refill(in)) {
+        return EOF;
+    }
+    return (unsigned char)*in->p;
+}
+
+static inline int vm_in_is_space (const int c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int vm_in_hex_digit (const int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        return (c | 0x20) - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Read one byte, whitespace included, like scanf("%c").
+ *
+ * @param[in]   in
+ * @param[out]  value
+ *
+ * @return      FAILURE at the end of input.
+ */
+status_t vm_in_read_char (vm_in_t *in, char *value)
+{
+    const int c = vm_in_peek(in);
+
+    if (c == EOF) {
+        return FAILURE;
+    }
+    in->p ++;
+    *value = (char)c;
+    return SUCCESS;
+}
+
+/**
+ * Read a decimal integer, like scanf("%d"). Leading whitespace is
+ * skipped; a number that does not fit wraps around.
+ *
+ * @param[in]   in
+ * @param[out]  value   Left alone if no number could be read.
+ *
+ * @return      FAILURE at the end of input or if there is no number.
+ */
+status_t vm_in_read_dec (vm_in_t *in, int32_t *value)
+{
+    uint32_t u = 0;
+    int c = vm_in_peek(in),
+        negative = 0;
+
+    while (vm_in_is_space(c)) {
+        in->p ++;
+        c = vm_in_peek(in);
+    }
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        in->p ++;
+        c = vm_in_peek(in);
+    }
+    if (c < '0' || c > '9') {
+        return FAILURE;
+    }
+    do {
+        u = u * 10 + (uint32_t)(c - '0');
+        in->p ++;
+        c = vm_in_peek(in);
+    } while (c >= '0' && c <= '9');
+
+    *value = (int32_t)(negative ? 0u - u : u);
+    return SUCCESS;
+}
+
+/**
+ * Read a hexadecimal integer of at most 8 characters, sign and 0x prefix
+ * included, like scanf("%08x").
+ *
+ * @param[in]   in
+ * @param[out]  value   Left alone if no number could be read.
+ *
+ * @return      FAILURE at the end of input or if there is no number.
+ */
+status_t vm_in_read_hex (vm_in_t *in, int32_t *value)
+{
+    uint32_t u = 0;
+    int c = vm_in_peek(in),
+        width = 8,
+        digit = 0,
+        n_digits = 0,
+        negative = 0;
+
+    while (vm_in_is_space(c)) {
+        in->p ++;
+        c = vm_in_peek(in);
+    }
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        in->p ++;
+        width --;
+        c = vm_in_peek(in);
+    }
+    while (width > 0 && (digit = vm_in_hex_digit(c)) >= 0) {
+        u = u << 4 | (uint32_t)digit;
+        in->p ++;
+        width --;
+        n_digits ++;
+        c = vm_in_peek(in);
+        if (n_digits == 1 && u == 0 && width > 0 && (c | 0x20) == 'x') {
+            /* A 0x prefix. */
+            in->p ++;
+            width --;
+            c = vm_in_peek(in);
+        }
+    }
+    if (n_digits == 0) {
+        return FAILURE;
+    }
+    *value = (int32_t)(negative ? 0u - u : u);
+    return SUCCESS;
+}
+
+/**
+ * Read up to n decimal integers, like n scanf("%d") calls.
+ *
+ * @param[in]   in
+ * @param[out]  words   Room for n words.
+ * @param[in]   n
+ *
+ * @return      The number of integers read, less than n at the end of
+ *              input or at something that is not a number.
+ */
+int32_t vm_in_read_words (vm_in_t *in, int32_t *words, const int32_t n)
+{
+    int32_t i = 0;
+
+    for (i = 0; i < n; i ++) {
+        if (vm_in_read_dec(in, &words[i]) == FAILURE) {
+            break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,119 @@
+/**
+ * vmtrace.c
+ * Purpose: Print a trace dumped by vm --trace.
+ *
+ * @author Nishanth H. Kottary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "headers/constants.h"
+#include "headers/decode.h"
+#include "headers/trace.h"
+
+#define get_name_macro(symbol) #symbol
+
+static const char *const FUSED_NAMES[N_FUSED] = {
+    FUSED_DEF(get_name_macro)
+};
+
+static uint64_t vm_get_le (const unsigned char *bytes, const int len)
+{
+    uint64_t value = 0;
+    int i = 0;
+
+    for (i = len - 1; i >= 0; i --) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+/**
+ * The name of an instruction or superinstruction in a trace record.
+ */
+static const char *vm_trace_op_name (const unsigned int op)
+{
+    if (op < N_INST) {
+        return INST_SET[op].name;
+    }
+    if (op < N_OPS) {
+        return FUSED_NAMES[op - N_INST];
+    }
+    return "?";
+}
+
+int main (int argc, char *argv[])
+{
+    unsigned char header[VM_TRACE_HEADER_LEN];
+    unsigned char record[VM_TRACE_RECORD_LEN];
+    uint64_t n_executed = 0,
+             n_records  = 0,
+             last       = 0,
+             skip       = 0,
+             i          = 0;
+    uint32_t record_len = 0;
+    FILE *fp = NULL;
+
+    if (argc != 2 && argc != 3) {
+        printf("\nUSAGE: vmtrace <trace file> [last n records]\n");
+        return 0;
+    }
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "\nERROR: could not open file %s\n", argv[1]);
+        return -1;
+    }
+    if (fread(header, 1, VM_TRACE_HEADER_LEN, fp) != VM_TRACE_HEADER_LEN ||
+        memcmp(header, "VMT", 3) != 0) {
+        fprintf(stderr, "\nERROR: %s is not a trace\n", argv[1]);
+        fclose(fp);
+        return -1;
+    }
+    record_len = (uint32_t)vm_get_le(&header[4], 4);
+    if (header[3] != VM_TRACE_VERSION || record_len != VM_TRACE_RECORD_LEN) {
+        fprintf(stderr, "\nERROR: unsupported trace version %d in %s\n",
+                header[3], argv[1]);
+        fclose(fp);
+        return -1;
+    }
+    n_executed = vm_get_le(&header[8], 8);
+    n_records = vm_get_le(&header[16], 8);
+    if (argc == 3) {
+        last = strtoull(argv[2], NULL, 10);
+        skip = last < n_records ? n_records - last : 0;
+    }
+
+    printf("# %llu instructions executed, the last %llu recorded\n",
+           (unsigned long long)n_executed, (unsigned long long)n_records);
+    printf("# %12s %10s  %-14s %5s  %s\n", "seq", "pc", "op", "depth", "tos");
+    if (skip > 0 && fseek(fp, (long)(skip * VM_TRACE_RECORD_LEN),
+                          SEEK_CUR) != 0) {
+        fprintf(stderr, "\nERROR: truncated trace %s\n", argv[1]);
+        fclose(fp);
+        return -1;
+    }
+    for (i = skip; i < n_records; i ++) {
+        uint32_t depth = 0;
+
+        if (fread(record, 1, VM_TRACE_RECORD_LEN, fp) != VM_TRACE_RECORD_LEN) {
+            fprintf(stderr, "\nERROR: truncated trace %s\n", argv[1]);
+            fclose(fp);
+            return -1;
+        }
+        depth = (uint32_t)vm_get_le(&record[10], 2);
+        printf("  %12llu %10u  %-14s %5u",
+               (unsigned long long)(n_executed - n_records + i),
+               (uint32_t)vm_get_le(&record[0], 4),
+               vm_trace_op_name((unsigned int)vm_get_le(&record[8], 2)),
+               depth);
+        if (depth > 0) {
+            printf("  %d", (int32_t)(uint32_t)vm_get_le(&record[4], 4));
+        }
+        printf("\n");
+    }
+    fclose(fp);
+    return 0;
+}
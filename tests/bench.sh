@@ -0,0 +1,199 @@
+#!/bin/bash
+#
+# Time the vm on generated microbenchmarks, one per class of opcodes, and
+# on scaled up versions of prime.vm, max.vm and loop.vm. Each benchmark
+# is run once to warm up, then timed over several runs. The exact number
+# of instructions it executes comes from vm --profile, which gives the
+# time per instruction.
+#
+# USAGE: bench.sh [-r runs] [-w warmups] [-q] [-a "vm options"]
+#                 <build dir> [baseline build dir]
+#
+#   -r n     timed runs per benchmark, 5 by default.
+#   -w n     untimed runs first, 1 by default.
+#   -q       a tenth of the work, for a quick check.
+#   -a opts  options for every vm run, e.g. "--jit".
+#
+# With a baseline build, every benchmark also runs on the vm there and
+# the difference of the means is printed. Run from the top of the tree,
+# or with make bench.
+
+runs=5
+warmups=1
+quick=0
+vm_opts=""
+while getopts "r:w:qa:" opt
+do
+    case $opt in
+        r) runs=$OPTARG ;;
+        w) warmups=$OPTARG ;;
+        q) quick=1 ;;
+        a) vm_opts=$OPTARG ;;
+        *) exit -1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 1 ] || [ $# -gt 2 ] || [ $runs -lt 1 ]; then
+    echo "USAGE: bench.sh [-r runs] [-w warmups] [-q] [-a \"vm options\"]" \
+         "<build dir> [baseline build dir]"
+    exit -1
+fi
+builds=(`cd "$1" && pwd`)
+if [ $# -eq 2 ]; then
+    builds+=(`cd "$2" && pwd`)
+fi
+tests_dir=`cd "$(dirname "$0")" && pwd`
+work=`mktemp -d`
+trap "rm -rf \"$work\"" EXIT
+
+# Loop iterations of the microbenchmarks, and the inputs of the macro ones.
+iters=200000
+prime=10000019
+max_reps=200
+loop_to=5000000
+if [ $quick -eq 1 ]; then
+    iters=20000
+    prime=1000003
+    max_reps=20
+    loop_to=500000
+fi
+
+# Write a program to $1 that runs $2, 50 copies of the body of a
+# microbenchmark, $3 times. The body keeps the stack as it found it, with
+# a 0 and the loop count below.
+micro () {
+    awk -v iters=$3 -v body="$2" 'BEGIN {
+        printf ":n %d\n:x 7\n__CODE__\nPUSH 0\n:loop\n", iters;
+        for (i = 0; i < 50; i++) {
+            b = body;
+            gsub(/@/, i, b);
+            printf "%s", b;
+        }
+        print "PUSH &n\nGET\nPUSH -1\nADD\nDUP\nPUSH &n\nPUT";
+        print "PUSH 0\nEQU\nPOP\nPOP\nPUSH &loop\nGOUN\nEND";
+    }' > "$1"
+}
+
+# Every benchmark, name and input. Programs are generated into $work.
+gen_all () {
+    micro $work/arith.vm \
+        'PUSH 3\nADD\nPUSH -3\nADD\nPUSH 1\nMUL\nPUSH 0\nSUB\nPUSH 0\nSUB\n' \
+        $iters
+    micro $work/stack.vm 'DUP\nFLIP\nFLIP\nPOP\nPUSH 5\nPOP\n' $iters
+    micro $work/branch.vm \
+        'PUSH &a@\nGOTO\n:a@\nPUSH &b@\nGOIF\n:b@\nPUSH &c@\nGOUN\n:c@\n' \
+        $iters
+    micro $work/getput.vm 'PUSH &x\nGET\nPUSH &x\nPUT\n' $iters
+    # A system call per READ, which flushes the output first.
+    micro $work/io.vm 'READ\nWRTD\nPUSH 10\nWRTC\n' $((iters / 10))
+    awk -v n=$((iters * 5)) 'BEGIN {
+        for (i = 0; i < n; i++) {
+            print i % 1000;
+        }
+    }' > $work/io.in
+
+    cp "$tests_dir/prime.vm" $work/prime.vm
+    echo $prime > $work/prime.in
+
+    # max.vm over 10000 numbers, run again $max_reps times.
+    awk -v reps=$max_reps 'BEGIN {
+        srand(1);
+        printf ":nums\n";
+        for (i = 0; i < 10000; i++) {
+            printf "%d\n", 1 + int(rand() * 1000000);
+        }
+        printf "0\n:max -1\n:reps %d\n__CODE__\n:again\n", reps;
+    }' > $work/max.vm
+    sed -n '/^__CODE__/,$p' "$tests_dir/max.vm" | sed '1d; /^END/d' \
+        >> $work/max.vm
+    printf "%s\n" "PUSH 10" "WRTC" "POP" "POP" "PUSH -1" "PUSH &max" "PUT" \
+        "PUSH &reps" "GET" "PUSH -1" "ADD" "DUP" "PUSH &reps" "PUT" \
+        "PUSH 0" "EQU" "POP" "POP" "PUSH &again" "GOUN" "END" >> $work/max.vm
+
+    sed "s/^PUSH 10$/PUSH $loop_to/" "$tests_dir/loop.vm" > $work/loop.vm
+}
+
+benches=(arith stack branch getput io prime max loop)
+
+gen_all
+for b in "${benches[@]}"
+do
+    "${builds[0]}/compiler" $work/$b.vm
+    if [ $? -ne 0 ]; then
+        echo "$b.vm not compiled."
+        exit -1
+    fi
+done
+
+# Run benchmark $2 on the vm of build $1, output dropped.
+run () {
+    local input=/dev/null
+    if [ -f $work/$2.in ]; then
+        input=$work/$2.in
+    fi
+    "$1/vm" $vm_opts $work/$2.vmc < $input > /dev/null
+}
+
+# The instructions benchmark $1 executes, nothing if it fails.
+count () {
+    local input=/dev/null
+    if [ -f $work/$1.in ]; then
+        input=$work/$1.in
+    fi
+    "${builds[0]}/vm" --profile $work/$1.json $work/$1.vmc < $input \
+        > /dev/null 2>&1 || return
+    sed -n 's/^  "instructions": \([0-9]*\),$/\1/p' $work/$1.json
+}
+
+printf "# %d runs after %d warmup runs, vm %s\n" $runs $warmups "$vm_opts"
+printf "%-8s %11s  %-24s %9s %8s %6s %9s %9s %8s\n" "bench" "insts" "build" \
+       "mean ms" "sd ms" "cv %" "min ms" "ns/inst" "Minst/s"
+for b in "${benches[@]}"
+do
+    insts=`count $b`
+    if [ -z "$insts" ] || [ "$insts" -eq 0 ]; then
+        echo "$b failed, or could not count its instructions."
+        exit -1
+    fi
+    base_mean=""
+    for build in "${builds[@]}"
+    do
+        for i in `seq $warmups`
+        do
+            run $build $b
+        done
+        times=()
+        for i in `seq $runs`
+        do
+            start=`date +%s%N`
+            run $build $b
+            end=`date +%s%N`
+            times+=($((end - start)))
+        done
+        stats=`printf "%s\n" "${times[@]}" | awk -v insts=$insts '
+            { t[NR] = $1; sum += $1; if (NR == 1 || $1 < min) min = $1 }
+            END {
+                mean = sum / NR;
+                for (i = 1; i <= NR; i++) var += (t[i] - mean) ^ 2;
+                sd = NR > 1 ? sqrt(var / (NR - 1)) : 0;
+                printf "%.3f %.3f %.2f %.3f %.3f %.1f", mean / 1e6, sd / 1e6,
+                       100 * sd / mean, min / 1e6, mean / insts,
+                       insts / mean * 1e3;
+            }'`
+        set -- $stats
+        name=$build
+        if [ ${#name} -gt 24 ]; then
+            name="...${name: -21}"
+        fi
+        printf "%-8s %11d  %-24s %9.1f %8.1f %6.1f %9.1f %9.2f %8.1f" \
+               $b $insts "$name" $1 $2 $3 $4 $5 $6
+        if [ -z "$base_mean" ]; then
+            base_mean=$1
+        else
+            awk -v a=$base_mean -v b=$1 \
+                'BEGIN { printf "  %+.1f%% vs first", 100 * (b - a) / a }'
+        fi
+        printf "\n"
+    done
+done
+exit 0
@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Generate programs with many labels and time how long the compiler takes
+# on them. Every label is jumped to from the block before it, and named
+# again by a jump back to the start of the program. Run from a directory
+# holding the compiler and vm binaries, e.g. build/.
+#
+# USAGE: labels.sh [label counts...]
+#
+# Times are in milliseconds.
+
+counts=("$@")
+if [ ${#counts[@]} -eq 0 ]; then
+    counts=(1000 10000 100000)
+fi
+
+# Write a program with $1 labels to $2. It counts the labels it passes in
+# the data segment and prints the count.
+gen () {
+    awk -v n="$1" 'BEGIN {
+        print ":count 0";
+        print "__CODE__";
+        for (i = 0; i < n; i++) {
+            printf ":L%d\nPUSH &count\nGET\nPUSH 1\nADD\nPUSH &count\nPUT\n", i;
+            printf "PUSH &L%d\nGOTO\nPUSH &L0\nGOTO\n", i + 1;
+        }
+        printf ":L%d\nPUSH &count\nGET\nWRTD\nEND\n", n;
+    }' > "$2"
+}
+
+# Milliseconds since the epoch.
+now () {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+printf "%10s %10s %10s %10s\n" "labels" "lines" "compile" "compile -O1"
+
+for n in "${counts[@]}"
+do
+    gen $n labels_$n.vm
+    printf "%10d %10d" $n `wc -l < labels_$n.vm`
+    for opt in "" "-O1"
+    do
+        start=`now`
+        ./compiler $opt labels_$n.vm > /dev/null
+        if [ $? -ne 0 ]; then
+            echo "labels_$n.vm not compiled."
+            exit -1
+        fi
+        end=`now`
+        output=`./vm labels_$n.vmc`
+        if [ "$output" != "$n" ]; then
+            echo "\nWrong output: $output"
+            exit -1
+        fi
+        printf " %10d" $((end - start))
+    done
+    printf "\n"
+    rm labels_$n.vm labels_$n.vmc
+done
+exit 0
@@ -2,9 +2,11 @@
 
 rm *.vmc
 
-declare -a  fnames=("echo.vm" "hw.vm"           "loop.vm"                          "odd_or_even.vm" "odd_or_even.vm" "prime.vm" "prime.vm"   "max.vm")
-declare -a  inputs=("123"     ""                ""                                 "32"             "33"             "31"       "32"         "")
-declare -a outputs=($'123'    $'\nHELLO WORLD!' $'1, 2, 3, 4, 5, 6, 7, 8, 9, 10, ' $'Even'          $'Odd'           $'prime'   $'not prime' $'800')
+declare -a  fnames=("echo.vm" "hw.vm"           "loop.vm"                          "odd_or_even.vm" "odd_or_even.vm" "prime.vm" "prime.vm"   "max.vm" "sum.vm"  "sum.vm"            "hws.vm")
+declare -a  inputs=("123"     ""                ""                                 "32"             "33"             "31"       "32"         ""       "3 -4 50" "1 2 3 4 5 6 7 8 9" "")
+declare -a outputs=($'123'    $'\nHELLO WORLD!' $'1, 2, 3, 4, 5, 6, 7, 8, 9, 10, ' $'Even'          $'Odd'           $'prime'   $'not prime' $'800'  $'49'     $'36'               $'HELLO WORLD!\n------------')
+
+declare -a     vms=("vm_dbg" "vm_threaded_dbg" "vm_dbg --no-fusion" "vm_dbg --jit" "vm_dbg --reg")
 
 #compilation
 for fname in "${fnames[@]}"
@@ -20,21 +22,252 @@ echo "--------------------------------------------------"
 echo "              Compilation Success!"
 echo "--------------------------------------------------"
 
-#IO test
-for i in "${!fnames[@]}"
+#IO test, once per dispatch engine
+for vm in "${vms[@]}"
 do
-    output=`echo "${inputs[$i]}" | ./vm_dbg "${fnames[$i]}""c"`
-    if [ $? -ne 0 ]; then
-        echo "\nVM error for ${fnames[$i]}."
+    for i in "${!fnames[@]}"
+    do
+        output=`echo "${inputs[$i]}" | ./$vm "${fnames[$i]}""c"`
+        if [ $? -ne 0 ]; then
+            echo "\nVM error for ${fnames[$i]} with $vm."
+            exit -1
+        fi
+        if [ "$output" != "${outputs[$i]}" ]; then
+            echo "\nTest failed for ${fnames[$i]} with $vm"
+            echo "\nExpected: ${outputs[$i]}"
+            echo "\nReal: $output"
+            exit -1
+        fi
+    done
+done
+
+#The IO tests again, compiled with -O1
+for vm in "${vms[@]}"
+do
+    for i in "${!fnames[@]}"
+    do
+        ./compiler_dbg -O1 "${fnames[$i]}" opt.vmc > /dev/null
+        output=`echo "${inputs[$i]}" | ./$vm opt.vmc`
+        if [ $? -ne 0 ] || [ "$output" != "${outputs[$i]}" ]; then
+            echo "\nTest failed for ${fnames[$i]} with -O1 and $vm"
+            echo "\nExpected: ${outputs[$i]}"
+            echo "\nReal: $output"
+            exit -1
+        fi
+    done
+done
+rm opt.vmc
+
+#A program past the old 255 byte and 10 label limits
+awk 'BEGIN {
+    print ":counter 0\n__CODE__";
+    for (i = 0; i < 500; i++) {
+        printf ":L%d\nPUSH &counter\nGET\nPUSH 1\nADD\nPUSH &counter\nPUT\n", i;
+    }
+    print "PUSH &counter\nGET\nWRTD\nEND";
+}' > big.vm
+./compiler_dbg big.vm
+if [ $? -ne 0 ]; then
+    echo "\nbig.vm not compiled."
+    exit -1
+fi
+for vm in "${vms[@]}"
+do
+    output=`./$vm big.vmc`
+    if [ "$output" != "500" ]; then
+        echo "\nTest failed for big.vm with $vm"
+        echo "\nReal: $output"
         exit -1
     fi
+done
+rm big.vm big.vmc
+
+#Lines and labels longer than 80 characters
+label=`printf 'a%.0s' {1..100}`
+printf "__CODE__\n:$label `printf 'PUSH 7 WRTD %.0s' {1..10}`PUSH &$label POP\n" > long.vm
+./compiler_dbg long.vm
+output=`./vm_dbg long.vmc`
+if [ "$output" != "7777777777" ]; then
+    echo "\nTest failed for long.vm"
+    echo "\nReal: $output"
+    exit -1
+fi
+rm long.vm long.vmc
+
+#A label defined twice is reported with both lines
+printf ':a 1\n__CODE__\n:b\nPUSH &b\nGOTO\n:a\nEND\n' > dup.vm
+output=`./compiler_dbg dup.vm 2>&1`
+if [ $? -eq 0 ] || [[ "$output" != *"Label a redefined in line number 6, earlier definition was here 1"* ]]; then
+    echo "\nTest failed for a label defined twice"
+    echo "\nReal: $output"
+    exit -1
+fi
+rm dup.vm
+
+#Every IO test again as one batch
+rm -f batch.manifest
+for i in "${!fnames[@]}"
+do
+    echo "${inputs[$i]}" > batch.in$i
+    echo "${fnames[$i]}c batch.in$i batch.out$i" >> batch.manifest
+done
+./vm_dbg --batch batch.manifest --threads 4 2>/dev/null
+if [ $? -ne 0 ]; then
+    echo "\nVM error for --batch."
+    exit -1
+fi
+for i in "${!fnames[@]}"
+do
+    output=`cat batch.out$i`
     if [ "$output" != "${outputs[$i]}" ]; then
-        echo "\nTest failed for ${fnames[$i]}"
+        echo "\nTest failed for ${fnames[$i]} with --batch"
         echo "\nExpected: ${outputs[$i]}"
         echo "\nReal: $output"
         exit -1
     fi
 done
+rm batch.manifest batch.in* batch.out*
+
+#A snapshot taken by SNAP, then restored with other input
+./compiler_dbg squares.vm
+if [ $? -ne 0 ]; then
+    echo "\nsquares.vm not compiled."
+    exit -1
+fi
+for vm in "${vms[@]}"
+do
+    output=`echo "3 9" | ./$vm --snapshot squares.snap squares.vmc`
+    if [ "$output" != "9 81 7" ]; then
+        echo "\nTest failed for squares.vm with $vm --snapshot"
+        echo "\nReal: $output"
+        exit -1
+    fi
+    output=`echo "4 2" | ./$vm --restore squares.snap`
+    if [ "$output" != "16 4 7" ]; then
+        echo "\nTest failed for squares.snap with $vm --restore"
+        echo "\nReal: $output"
+        exit -1
+    fi
+    rm squares.snap
+done
+
+#A second compile with --cache copies the image the first one stored
+rm -rf vmcache
+./compiler_dbg --cache vmcache -g prime.vm prime_c1.vmc &&
+./compiler_dbg --cache vmcache -g prime.vm prime_c2.vmc
+stats=`./compiler_dbg --cache-stats vmcache`
+output=`echo 31 | ./vm_dbg prime_c2.vmc`
+if [ "$output" != "prime" ] || ! cmp -s prime_c1.vmc prime_c2.vmc ||
+   ! cmp -s prime_c1.vmc.sym prime_c2.vmc.sym ||
+   [ "$stats" != "Cache vmcache: 1 hits, 1 misses, 50.0% hit rate, 1 entries, 233 bytes" ]; then
+    echo "\nTest failed for prime.vm with --cache"
+    echo "\nReal: $stats"
+    exit -1
+fi
+rm -r vmcache prime_c1.vmc* prime_c2.vmc*
+
+#A decompiled program compiles and runs again, and --range lists from
+#the first instruction in the range
+./compiler_dbg prime.vm prime_d.vmc
+./decompiler_dbg prime_d.vmc prime_d.vm && ./compiler_dbg prime_d.vm prime_dd.vmc
+output=`echo 31 | ./vm_dbg prime_dd.vmc`
+range=`./decompiler_dbg --range 41:49 prime_d.vmc - | tr '\n' ' '`
+if [ "$output" != "prime" ] ||
+   [ "$range" != "# code bytes 41 to 49 of prime_d.vmc GET DIV POP PUSH 00000000h # 0  " ]; then
+    echo "\nTest failed for prime.vm with decompiler"
+    echo "\nReal: $range"
+    exit -1
+fi
+rm prime_d.vmc prime_d.vm prime_dd.vmc
+
+#Exact counts from --profile, with the labels of compiler -g
+./compiler_dbg -g prime.vm prime_g.vmc
+output=`echo 31 | ./vm_dbg --profile prime.json prime_g.vmc 2>/dev/null`
+if [ "$output" != "prime" ] ||
+   ! grep -q '"instructions": 624,' prime.json ||
+   ! grep -q '"op": "GOUN", "label": "start", "offset": 42, "hits": 29, "taken": 28, "not_taken": 1' prime.json; then
+    echo "\nTest failed for prime.vm with --profile"
+    exit -1
+fi
+rm prime_g.vmc prime_g.vmc.sym prime.json
+
+#The last instructions, dumped by --trace at exit and read by vmtrace
+output=`echo "3 -4 50" | ./vm_dbg --trace sum.trace sum.vmc`
+trace=`./vmtrace_dbg sum.trace 2 | tr -s ' '`
+if [ "$output" != "49" ] ||
+   [ "$trace" != $'# 80 instructions executed, the last 80 recorded\n# seq pc op depth tos\n 78 96 WRTD 1 49\n 79 97 END 0' ]; then
+    echo "\nTest failed for sum.vm with --trace"
+    echo "\nReal: $trace"
+    exit -1
+fi
+rm sum.trace
+
+#v1 images: GET and PUT take a byte address, which may be past the code
+printf '\x00\x08\x14\xc8\x00\x00\x00\x19\x04\x11' > get_v1.vmc
+printf '\x00\x13\x14\x07\x00\x00\x00\x14\xfa\x00\x00\x00\x1a\x14\xfa\x00\x00\x00\x19\x04\x11' > put_v1.vmc
+for vm in "${vms[@]}"
+do
+    output=`./$vm get_v1.vmc; ./$vm put_v1.vmc`
+    if [ "$output" != $'07' ]; then
+        echo "\nTest failed for v1 GET and PUT with $vm"
+        echo "\nReal: $output"
+        exit -1
+    fi
+done
+rm get_v1.vmc put_v1.vmc
+
+#Images without a single instruction end right away
+printf '\x00\x00' > empty_v1.vmc
+printf 'VMC\x03\x00\x00\x00\x00\x00\x00\x00\x00' > empty_v3.vmc
+for vm in "${vms[@]}"
+do
+    output=`./$vm --no-verify empty_v1.vmc && ./$vm --no-verify empty_v3.vmc &&
+            ./$vm empty_v1.vmc && ./$vm empty_v3.vmc`
+    if [ $? -ne 0 ] || [ "$output" != "" ]; then
+        echo "\nTest failed for an empty image with $vm"
+        echo "\nReal: $output"
+        exit -1
+    fi
+done
+output=`./vm_dbg --stats empty_v3.vmc 2>&1 | head -1`
+if [ "$output" != "verified: 0 instructions reached, stack depth at most 0" ]; then
+    echo "\nTest failed for verifying an empty image"
+    echo "\nReal: $output"
+    exit -1
+fi
+rm empty_v1.vmc empty_v3.vmc
+
+#A v1 program rewriting its own code, run again by the same worker. Every
+#run starts from the code it was loaded with.
+printf '\x00\x19\x14\x13\x00\x00\x00\x19\x04\x14\x2a\x00\x00\x00\x14\x13\x00\x00\x00\x1a\x14\x07\x00\x00\x00\x04\x11' > self_v1.vmc
+for vm in "${vms[@]}"
+do
+    printf 'self_v1.vmc - self.out%d\n' 1 2 3 > self.manifest
+    ./$vm --batch self.manifest --threads 1 2>/dev/null
+    output=`cat self.out1 self.out2 self.out3`
+    if [ "$output" != "742742742" ]; then
+        echo "\nTest failed for v1 self modifying code with $vm --batch"
+        echo "\nReal: $output"
+        exit -1
+    fi
+done
+rm self_v1.vmc self.manifest self.out*
+
+#Verified programs run unchecked. The others, even one that underflows
+#on a branch it never takes, run with every check
+printf '__CODE__\nPUSH 0\nPUSH 0\nEQU\nPOP\nPOP\nPUSH &end\nGOIF\nPOP\n:end\nPUSH 42\nWRTD\nEND\n' > untaken.vm
+./compiler_dbg untaken.vm
+output=`./vm_dbg untaken.vmc`
+stats=`./vm_dbg --stats untaken.vmc 2>&1 >/dev/null | grep verified`
+verified=`echo "3 -4 50" | ./vm_dbg --stats sum.vmc 2>&1 >/dev/null | grep verified`
+if [ "$output" != "42" ] ||
+   [ "$stats" != "not verified: stack underflow in byte number 19" ] ||
+   [ "$verified" != "verified: 37 instructions reached, stack depth at most 3" ]; then
+    echo "\nTest failed for untaken.vm with verification"
+    echo "\nReal: $output $stats"
+    exit -1
+fi
+rm untaken.vm untaken.vmc
 
 echo "--------------------------------------------------"
 echo "                  Test Success!"
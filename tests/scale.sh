@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Generate straight line programs of increasing size and time how long
+# the compiler and each engine take on them. Run from a directory holding
+# the compiler and vm binaries, e.g. build/.
+#
+# USAGE: scale.sh [instruction counts...]
+#
+# Times are in milliseconds.
+
+sizes=("$@")
+if [ ${#sizes[@]} -eq 0 ]; then
+    sizes=(1000 10000 100000 1000000)
+fi
+
+declare -a vms=("vm" "vm --reg" "vm --jit")
+
+# Write a program of about $1 instructions to $2. It increments a counter
+# in the data segment 7 instructions at a time, with a label every 1000
+# blocks, and prints the count.
+gen () {
+    awk -v n="$1" 'BEGIN {
+        blocks = int(n / 7);
+        print ":counter 0";
+        print "__CODE__";
+        for (i = 0; i < blocks; i++) {
+            if (i % 1000 == 0) {
+                printf "PUSH &C%d\nGOTO\n:C%d\n", i, i;
+            }
+            print "PUSH &counter\nGET\nPUSH 1\nADD\nPUSH &counter\nPUT";
+        }
+        print "PUSH &counter\nGET\nWRTD\nEND";
+    }' > "$2"
+}
+
+# Milliseconds since the epoch.
+now () {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+printf "%10s %10s %10s" "insts" "bytes" "compile"
+for vm in "${vms[@]}"
+do
+    printf " %10s" "$vm"
+done
+printf "\n"
+
+for n in "${sizes[@]}"
+do
+    gen $n scale_$n.vm
+
+    start=`now`
+    ./compiler scale_$n.vm
+    if [ $? -ne 0 ]; then
+        echo "scale_$n.vm not compiled."
+        exit -1
+    fi
+    end=`now`
+    printf "%10d %10d %10d" $n `stat -c %s scale_$n.vmc` $((end - start))
+
+    for vm in "${vms[@]}"
+    do
+        start=`now`
+        output=`./$vm scale_$n.vmc`
+        end=`now`
+        if [ "$output" != "$((n / 7))" ]; then
+            echo "\nWrong output from $vm: $output"
+            exit -1
+        fi
+        printf " %10d" $((end - start))
+    done
+    printf "\n"
+    rm scale_$n.vm scale_$n.vmc
+done
+exit 0
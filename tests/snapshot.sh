@@ -0,0 +1,86 @@
+#!/bin/bash
+#
+# Time how long a program that fills a table before reading any input
+# takes to start, run from scratch and restored from a snapshot taken
+# with SNAP once the table is full. Run from a directory holding the
+# compiler and vm binaries, e.g. build/.
+#
+# USAGE: snapshot.sh [table sizes...]
+#
+# Times are in milliseconds, the best of 5 runs.
+
+sizes=("$@")
+if [ ${#sizes[@]} -eq 0 ]; then
+    sizes=(1000 10000 100000 1000000)
+fi
+
+declare -a vms=("vm" "vm --reg" "vm --jit")
+
+# Write a program to $2 that fills a table of $1 squares, takes a
+# snapshot and prints the square of the number it reads.
+gen () {
+    awk -v n="$1" 'BEGIN {
+        print ":i 0\n:n 0\n:table";
+        for (i = 0; i < n; i++) {
+            print "0";
+        }
+        print "__CODE__";
+        print ":fill\nPUSH &i\nGET\nDUP\nMUL\nPUSH &i\nGET\nPUSH 4\nMUL";
+        print "PUSH &table\nADD\nPUT\nPUSH &i\nGET\nPUSH 1\nADD\nDUP";
+        printf "PUSH &i\nPUT\nPUSH %d\nEQU\nPOP\nPOP\nPUSH &fill\nGOUN\n", n;
+        print "SNAP\nPUSH 1\nPUSH &n\nREADN\nPOP\nPUSH &n\nGET\nPUSH 4\nMUL";
+        print "PUSH &table\nADD\nGET\nWRTD\nEND";
+    }' > "$2"
+}
+
+# Milliseconds since the epoch.
+now () {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# The best of 5 runs of "$@" with 3 on stdin, in milliseconds.
+best () {
+    local min=-1
+    for run in 1 2 3 4 5
+    do
+        start=`now`
+        output=`echo 3 | "$@"`
+        end=`now`
+        if [ "$output" != "9" ]; then
+            echo "\nWrong output from $*: $output" >&2
+            exit -1
+        fi
+        if [ $min -lt 0 ] || [ $((end - start)) -lt $min ]; then
+            min=$((end - start))
+        fi
+    done
+    echo $min
+}
+
+printf "%10s %10s" "table" "bytes"
+for vm in "${vms[@]}"
+do
+    printf " %12s %12s" "$vm" "restored"
+done
+printf "\n"
+
+for n in "${sizes[@]}"
+do
+    gen $n snap_$n.vm
+    ./compiler snap_$n.vm
+    if [ $? -ne 0 ]; then
+        echo "snap_$n.vm not compiled."
+        exit -1
+    fi
+    echo 3 | ./vm --snapshot snap_$n.snap snap_$n.vmc > /dev/null
+    printf "%10d %10d" $n `stat -c %s snap_$n.snap`
+
+    for vm in "${vms[@]}"
+    do
+        printf " %12d %12d" `best ./$vm snap_$n.vmc` \
+                            `best ./$vm --restore snap_$n.snap`
+    done
+    printf "\n"
+    rm snap_$n.vm snap_$n.vmc snap_$n.snap
+done
+exit 0